@@ -1,7 +1,8 @@
 #version 330 core
 layout(location = 0) out vec4 out_color;
 
-uniform sampler2D uniform_texture;
+uniform sampler2DArray uniform_texture;
+uniform float uniform_texture_layer;
 uniform vec3 uniform_color;
 
 in vec2 f_texcoord;
@@ -12,7 +13,7 @@ void main(void)
 	vec4 color;
 
 	if(uniform_color.r == 0.0 && uniform_color.g == 0.0 && uniform_color.b == 0.0)
-		color= texture(uniform_texture, f_texcoord);
+		color= texture(uniform_texture, vec3(f_texcoord, uniform_texture_layer));
 	else
 		color = vec4(uniform_color,0.5);
 	
@@ -1,6 +1,6 @@
 #version 330 core
 layout(location = 0) in vec3 coord3d;
-layout(location = 1) in vec2 texcoord;
+layout(location = 2) in vec2 texcoord;
 
 uniform mat4 uniform_model_matrix;
 
@@ -1,11 +1,10 @@
 #version 330 core
+// variants (see Renderer::SHADED_VARIANT): SHADOWS, PCF_MODE (the filter of the shadows, see Renderer::SHADOW_FILTER), TEXTURED
 layout(location = 0) out vec4 out_color;
 
-uniform vec3 uniform_diffuse;
-uniform vec3 uniform_specular;
-uniform float uniform_shininess;
-uniform float uniform_has_texture;
-uniform sampler2D diffuse_texture;
+#if TEXTURED
+uniform sampler2DArray diffuse_texture;
+#endif
 
 // Camera Properties
 uniform vec3 uniform_camera_position;
@@ -18,17 +17,43 @@ uniform vec3 uniform_light_direction;
 uniform vec3 uniform_light_color;
 uniform float uniform_light_umbra;
 uniform float uniform_light_penumbra;
-uniform int uniform_cast_shadows;
+#if SHADOWS
 uniform sampler2D shadowmap_texture;
+// the same depth texture through a comparison sampler, each lookup is a bilinear PCF of 4 texels
+uniform sampler2DShadow shadowmap_compare_texture;
+// prefiltered linear depth moments (variance shadow maps)
+uniform sampler2D shadowmap_moments_texture;
+#endif
 
 float uniform_constant_bias = 0.0001;
 
+#if TEXTURED
 in vec2 f_texcoord;
+#endif
 in vec3 f_position_wcs;
 in vec3 f_normal;
+// material of the draw (rgb: diffuse color, a: texture layer + 1, 0 without a texture / rgb: specular color, a: shininess)
+flat in vec4 f_diffuse;
+flat in vec4 f_specular;
 
 #define PI 3.14159
 
+#define SHADOW_FILTER_PCF5X5 0
+#define SHADOW_FILTER_HARDWARE_PCF 1
+#define SHADOW_FILTER_POISSON 2
+#define SHADOW_FILTER_VSM 3
+
+// radius of the poisson disk, in texels of the shadow map
+#define POISSON_RADIUS 2.5
+// smallest variance of the moments (in squared world units), and the part of the bleeding light that is cut
+#define VSM_MIN_VARIANCE 0.0005
+#define VSM_BLEEDING_REDUCTION 0.3
+
+#if SHADOWS
+const vec2 poisson_disk[8] = vec2[](
+	vec2(-0.326212, -0.405805), vec2(-0.840144, -0.073580), vec2(-0.695914, 0.457137), vec2(-0.203345, 0.620716),
+	vec2(0.962340, -0.194983), vec2(0.473434, -0.480026), vec2(0.519456, 0.767022), vec2(0.185461, -0.893124));
+
 float shadow_pcf2x2(vec3 light_space_xyz)
 {
 	ivec2 shadow_map_size = textureSize(shadowmap_texture, 0);
@@ -76,6 +101,42 @@ float shadow_pcf5x5(vec3 light_space_xyz)
     return factor/25.0f;
 }
 
+float shadow_hardware_pcf(vec3 light_space_xyz)
+{
+	return texture(shadowmap_compare_texture, vec3(light_space_xyz.xy, light_space_xyz.z - uniform_constant_bias));
+}
+
+float shadow_poisson(vec3 light_space_xyz)
+{
+	vec2 texel = 1.0 / vec2(textureSize(shadowmap_compare_texture, 0));
+	float z = light_space_xyz.z - uniform_constant_bias;
+
+	// the disk is rotated per pixel (interleaved gradient noise), the banding of the few taps becomes noise
+	float angle = 2.0 * PI * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+	mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+
+	float factor = 0.0;
+	for (int i = 0; i < 8; i++)
+	{
+		vec2 offset = rotation * poisson_disk[i] * POISSON_RADIUS * texel;
+		factor += texture(shadowmap_compare_texture, vec3(light_space_xyz.xy + offset, z));
+	}
+	return factor / 8.0;
+}
+
+float shadow_vsm(vec2 uv, float depth)
+{
+	vec2 moments = texture(shadowmap_moments_texture, uv).rg;
+	if (depth <= moments.x)
+		return 1.0;
+
+	// Chebyshev upper bound of the lit fraction, the low values are cut against the light bleeding of overlapping casters
+	float variance = max(moments.y - moments.x * moments.x, VSM_MIN_VARIANCE);
+	float d = depth - moments.x;
+	float p_max = variance / (variance + d * d);
+	return clamp((p_max - VSM_BLEEDING_REDUCTION) / (1.0 - VSM_BLEEDING_REDUCTION), 0.0, 1.0);
+}
+
 float shadow_nearest(vec3 light_space_xyz)
 {
 	// sample shadow map
@@ -109,8 +170,17 @@ float shadow(vec3 pwcs)
 	// sample shadow map
 	//return shadow_nearest(plcs.xyz);
 	//return shadow_pcf2x2(plcs.xyz);
+#if PCF_MODE == SHADOW_FILTER_HARDWARE_PCF
+	return shadow_hardware_pcf(plcs.xyz);
+#elif PCF_MODE == SHADOW_FILTER_POISSON
+	return shadow_poisson(plcs.xyz);
+#elif PCF_MODE == SHADOW_FILTER_VSM
+	return shadow_vsm(plcs.xy, -(uniform_light_view_matrix * vec4(pwcs, 1.0)).z);
+#else
 	return shadow_pcf5x5(plcs.xyz);
+#endif
 }
+#endif
 
 float compute_spotlight(vec3 vertex_to_light_direction)
 {
@@ -137,9 +207,11 @@ void main(void)
 {	
 	vec3 normal = normalize(f_normal);
 	
-	vec4 diffuseColor = vec4(uniform_diffuse.rgb, 1);
-	// if we provide a texture, multiply color with the color of the texture
-	diffuseColor = mix(diffuseColor, diffuseColor * texture(diffuse_texture, f_texcoord), uniform_has_texture);
+	vec4 diffuseColor = vec4(f_diffuse.rgb, 1);
+#if TEXTURED
+	// multiply color with the color of the texture
+	diffuseColor *= texture(diffuse_texture, vec3(f_texcoord, f_diffuse.a - 1.0));
+#endif
 	
 	// compute the direction to the light source
 	vec3 vertex_to_light_direction = normalize(uniform_light_position - f_position_wcs.xyz);
@@ -153,10 +225,11 @@ void main(void)
 	float NdotL = max(dot(vertex_to_light_direction, normal), 0.0);
 	float NdotH = max(dot(halfVector, normal), 0.0);
 	
-	#define shadows
-	#ifdef shadows
-	// check if we have shadows
-	float shadow_value = (uniform_cast_shadows == 1)? shadow(f_position_wcs.xyz) : 1.0;
+#if SHADOWS
+	float shadow_value = shadow(f_position_wcs.xyz);
+#else
+	float shadow_value = 1.0;
+#endif
 	// compute the spot effect
 	float spotEffect = compute_spotlight(vertex_to_light_direction);
 	// compute the incident radiance
@@ -164,28 +237,8 @@ void main(void)
 
 	vec3 diffuseReflection = irradiance * diffuseColor.rgb / PI;
 	
-	float specularNormalization = (uniform_shininess + 8) / (8 * PI);
-	vec3 specularReflection = (NdotL > 0.0)? irradiance * specularNormalization * uniform_specular * pow( NdotH, uniform_shininess + 0.001) : vec3(0);
+	float specularNormalization = (f_specular.a + 8) / (8 * PI);
+	vec3 specularReflection = (NdotL > 0.0)? irradiance * specularNormalization * f_specular.rgb * pow( NdotH, f_specular.a + 0.001) : vec3(0);
 	
 	out_color = vec4( diffuseReflection + specularReflection, 1.0);	
-	#endif
-	
-	//#define noshadows
-	#ifdef noshadows
-	
-	// compute the spot effect
-	float spotEffect = compute_spotlight(vertex_to_light_direction);
-	// compute the incident radiance
-	vec3 irradiance = spotEffect * uniform_light_color * NdotL / dist;
-
-	vec3 diffuseReflection = irradiance * diffuseColor.rgb / PI;
-	
-	float specularNormalization = (uniform_shininess + 8) / (8 * PI);
-	vec3 specularReflection = (NdotL > 0.0)? irradiance * specularNormalization * uniform_specular * pow( NdotH, uniform_shininess + 0.001) : vec3(0);
-	
-	out_color = vec4( diffuseReflection + specularReflection, 1.0);	
-	#endif
-	
-	
 }
-
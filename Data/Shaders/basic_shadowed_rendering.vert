@@ -1,24 +1,82 @@
 #version 330 core
+// variants (see Renderer::SHADED_VARIANT): TEXTURED, INSTANCED (multi draw indirect, the per draw data are fetched from a texture buffer)
+#if INSTANCED
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 layout(location = 0) in vec3 coord3d;
-layout(location = 1) in vec3 normal;
+layout(location = 1) in vec2 normal;
 layout(location = 2) in vec2 texcoord;
-layout(location = 3) in vec3 tangent;
-
-uniform mat4 uniform_model_matrix;
-uniform mat4 uniform_normal_matrix;
 
 uniform mat4 uniform_view_matrix;
 uniform mat4 uniform_projection_matrix;
 
+// materials of all the parts, see MaterialTable
+#define MAX_MATERIALS 512
+struct Material
+{
+	// rgb: diffuse color, a: texture layer + 1 (0 without a texture)
+	vec4 diffuse;
+	// rgb: specular color, a: shininess
+	vec4 specular;
+};
+layout(std140) uniform MaterialTable
+{
+	Material materials[MAX_MATERIALS];
+};
+
+#if INSTANCED
+// per draw data, 8 texels per draw:
+// model matrix (4), normal matrix (3 columns, it only transforms directions), material index (1)
+uniform samplerBuffer uniform_draw_data;
+// index of the first draw of the multi draw call
+uniform int uniform_draw_offset;
+#else
+uniform mat4 uniform_model_matrix;
+uniform mat4 uniform_normal_matrix;
+// index of the material of the draw in the table
+uniform int uniform_material_index;
+#endif
+
+#if TEXTURED
 out vec2 f_texcoord;
+#endif
 out vec3 f_position_wcs;
 out vec3 f_normal;
+flat out vec4 f_diffuse;
+flat out vec4 f_specular;
+
+// octahedral normal encoding, see VertexFormat
+vec3 oct_decode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += (n.x >= 0.0) ? -t : t;
+	n.y += (n.y >= 0.0) ? -t : t;
+	return normalize(n);
+}
 
 void main(void) 
 {
-	vec4 position_wcs = uniform_model_matrix * vec4(coord3d, 1.0);
+#if INSTANCED
+	int base = (uniform_draw_offset + gl_DrawIDARB) * 8;
+	mat4 model_matrix = mat4(texelFetch(uniform_draw_data, base + 0), texelFetch(uniform_draw_data, base + 1),
+		texelFetch(uniform_draw_data, base + 2), texelFetch(uniform_draw_data, base + 3));
+	mat4 normal_matrix = mat4(texelFetch(uniform_draw_data, base + 4), texelFetch(uniform_draw_data, base + 5),
+		texelFetch(uniform_draw_data, base + 6), vec4(0.0, 0.0, 0.0, 1.0));
+	int material_index = int(texelFetch(uniform_draw_data, base + 7).x);
+#else
+	mat4 model_matrix = uniform_model_matrix;
+	mat4 normal_matrix = uniform_normal_matrix;
+	int material_index = uniform_material_index;
+#endif
+	f_diffuse = materials[material_index].diffuse;
+	f_specular = materials[material_index].specular;
+
+	vec4 position_wcs = model_matrix * vec4(coord3d, 1.0);
 	f_position_wcs = position_wcs.xyz;
-	f_normal = (uniform_normal_matrix * vec4(normal, 0)).xyz;
+	f_normal = (normal_matrix * vec4(oct_decode(normal), 0)).xyz;
+#if TEXTURED
 	f_texcoord = texcoord;
+#endif
 	gl_Position = uniform_projection_matrix * uniform_view_matrix * position_wcs;
 }
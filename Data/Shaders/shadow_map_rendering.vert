@@ -1,13 +1,32 @@
 #version 330 core
+// variants: INSTANCED (multi draw indirect, the model matrices are fetched from a texture buffer)
+#if INSTANCED
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 layout(location = 0) in vec3 coord3d;
 
-uniform mat4 uniform_model_matrix;
-
 uniform mat4 uniform_view_matrix;
 uniform mat4 uniform_projection_matrix;
 
+#if INSTANCED
+// per draw data, 4 texels per draw: model matrix
+uniform samplerBuffer uniform_draw_data;
+// index of the first draw of the multi draw call
+uniform int uniform_draw_offset;
+#else
+uniform mat4 uniform_model_matrix;
+#endif
+
 void main(void) 
 {
-	vec4 position_wcs = uniform_model_matrix * vec4(coord3d, 1.0);
+#if INSTANCED
+	int base = (uniform_draw_offset + gl_DrawIDARB) * 4;
+	mat4 model_matrix = mat4(texelFetch(uniform_draw_data, base + 0), texelFetch(uniform_draw_data, base + 1),
+		texelFetch(uniform_draw_data, base + 2), texelFetch(uniform_draw_data, base + 3));
+#else
+	mat4 model_matrix = uniform_model_matrix;
+#endif
+
+	vec4 position_wcs = model_matrix * vec4(coord3d, 1.0);
 	gl_Position = uniform_projection_matrix * uniform_view_matrix * position_wcs;
 }
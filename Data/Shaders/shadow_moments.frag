@@ -0,0 +1,38 @@
+#version 330 core
+layout(location = 0) out vec2 out_moments;
+
+in vec2 f_texcoord;
+
+// first pass: the depth buffer of the light, second pass: the moments of the first pass
+uniform sampler2D uniform_texture;
+uniform int uniform_from_depth;
+// one texel along the blur direction
+uniform vec2 uniform_direction;
+// clipping ranges of the light, to linearize its depth buffer
+uniform float uniform_near;
+uniform float uniform_far;
+
+// 7 tap gaussian (sigma ~1.5 texels)
+const float weights[4] = float[](0.266, 0.213, 0.109, 0.036);
+
+vec2 moments(vec2 uv)
+{
+	if (uniform_from_depth == 0)
+		return texture(uniform_texture, uv).rg;
+
+	// distance along the view direction of the light
+	float z_ndc = 2.0 * texture(uniform_texture, uv).r - 1.0;
+	float depth = 2.0 * uniform_near * uniform_far / (uniform_far + uniform_near - z_ndc * (uniform_far - uniform_near));
+	return vec2(depth, depth * depth);
+}
+
+void main(void)
+{
+	vec2 sum = weights[0] * moments(f_texcoord);
+	for (int i = 1; i < 4; i++)
+	{
+		sum += weights[i] * moments(f_texcoord + float(i) * uniform_direction);
+		sum += weights[i] * moments(f_texcoord - float(i) * uniform_direction);
+	}
+	out_moments = sum;
+}
@@ -0,0 +1,101 @@
+#include "AssetLoader.h"
+#include <algorithm>
+#include <chrono>
+
+AssetLoader::AssetLoader()
+{
+	running_jobs = 0;
+	stopping = false;
+}
+
+AssetLoader::~AssetLoader()
+{
+	Shutdown();
+}
+
+void AssetLoader::SubmitJob(std::function<void()> job)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (workers.empty())
+	{
+		// leave one hardware thread to the GL thread
+		unsigned int worker_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+		for (unsigned int i = 0; i < worker_count; i++)
+			workers.emplace_back(&AssetLoader::workerLoop, this);
+	}
+	jobs.push_back(std::move(job));
+	job_available.notify_one();
+}
+
+void AssetLoader::SubmitUpload(std::function<void()> upload)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uploads.push_back(std::move(upload));
+}
+
+unsigned int AssetLoader::ProcessUploads(float budget_ms)
+{
+	auto start_time = std::chrono::steady_clock::now();
+	unsigned int processed = 0;
+	while (true)
+	{
+		std::function<void()> upload;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (uploads.empty()) break;
+			upload = std::move(uploads.front());
+			uploads.pop_front();
+		}
+		upload();
+		processed++;
+
+		if (std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_time).count() >= budget_ms)
+			break;
+	}
+	return processed;
+}
+
+bool AssetLoader::IsIdle()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return jobs.empty() && running_jobs == 0 && uploads.empty();
+}
+
+void AssetLoader::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		jobs.clear();
+	}
+	job_available.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+
+	// the uploads of the finished jobs reference assets that are about to be deleted
+	std::lock_guard<std::mutex> lock(mutex);
+	uploads.clear();
+	stopping = false;
+}
+
+void AssetLoader::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (stopping) return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			running_jobs++;
+		}
+		job();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running_jobs--;
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+/* Singleton Class of the Asset Loader
+The CPU work of an asset (parsing, cooking, decoding) runs as a job on a pool of worker threads.
+A job hands its GL work (buffer and texture uploads) to the upload queue, which is drained in order
+on the GL thread with a time budget per frame, so that loading never stalls the rendering.
+*/
+class AssetLoader
+{
+public:
+	// get the static instance of Asset Loader
+	static AssetLoader& GetInstance()
+	{
+		static AssetLoader loader;
+		return loader;
+	}
+	~AssetLoader();
+
+	// run the job on a worker thread, the workers are started on the first job
+	void SubmitJob(std::function<void()> job);
+	// run the upload on the GL thread in ProcessUploads, can be called from any thread
+	void SubmitUpload(std::function<void()> upload);
+
+	// run the queued uploads until the budget is spent (at least one), returns the number of uploads run
+	unsigned int ProcessUploads(float budget_ms);
+
+	// no queued or running jobs and no queued uploads
+	bool IsIdle();
+
+	// wait for the running jobs and drop the queued jobs and uploads
+	void Shutdown();
+
+protected:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::deque<std::function<void()>> uploads;
+	unsigned int running_jobs;
+	bool stopping;
+	std::mutex mutex;
+	std::condition_variable job_available;
+
+	void workerLoop();
+
+	AssetLoader();
+	void operator=(AssetLoader const&);
+};
+
+#endif
@@ -0,0 +1,425 @@
+#include "BoundingVolumeTree.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+	float surfaceArea(const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+	{
+		glm::vec3 size = bounds_max - bounds_min;
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	bool contains(const glm::vec3& outer_min, const glm::vec3& outer_max, const glm::vec3& inner_min, const glm::vec3& inner_max)
+	{
+		return glm::all(glm::lessThanEqual(outer_min, inner_min)) && glm::all(glm::lessThanEqual(inner_max, outer_max));
+	}
+}
+
+BoundingVolumeTree::BoundingVolumeTree(float margin)
+{
+	root = NULL_NODE;
+	free_list = NULL_NODE;
+	proxy_count = 0;
+	this->margin = margin;
+}
+
+int BoundingVolumeTree::allocateNode()
+{
+	int node;
+	if (free_list != NULL_NODE)
+	{
+		node = free_list;
+		free_list = nodes[node].parent;
+	}
+	else
+	{
+		node = static_cast<int>(nodes.size());
+		nodes.push_back(Node());
+	}
+	nodes[node].parent = NULL_NODE;
+	nodes[node].children[0] = NULL_NODE;
+	nodes[node].children[1] = NULL_NODE;
+	nodes[node].height = 0;
+	nodes[node].user_data = 0;
+	return node;
+}
+
+void BoundingVolumeTree::freeNode(int node)
+{
+	nodes[node].parent = free_list;
+	nodes[node].height = -1;
+	free_list = node;
+}
+
+int BoundingVolumeTree::Insert(const glm::vec3& bounds_min, const glm::vec3& bounds_max, uint32_t user_data)
+{
+	int proxy = allocateNode();
+	nodes[proxy].bounds_min = bounds_min - glm::vec3(margin);
+	nodes[proxy].bounds_max = bounds_max + glm::vec3(margin);
+	nodes[proxy].user_data = user_data;
+	insertLeaf(proxy);
+	proxy_count++;
+	return proxy;
+}
+
+void BoundingVolumeTree::Remove(int proxy)
+{
+	removeLeaf(proxy);
+	freeNode(proxy);
+	proxy_count--;
+}
+
+bool BoundingVolumeTree::Move(int proxy, const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+{
+	glm::vec3 fat_min = bounds_min - glm::vec3(margin);
+	glm::vec3 fat_max = bounds_max + glm::vec3(margin);
+	const Node& leaf = nodes[proxy];
+	if (contains(leaf.bounds_min, leaf.bounds_max, bounds_min, bounds_max))
+	{
+		// still inside, unless the fat bounds are much larger than needed (e.g. the object shrunk)
+		if (contains(fat_min - glm::vec3(4.0f * margin), fat_max + glm::vec3(4.0f * margin), leaf.bounds_min, leaf.bounds_max))
+			return false;
+	}
+
+	removeLeaf(proxy);
+	nodes[proxy].bounds_min = fat_min;
+	nodes[proxy].bounds_max = fat_max;
+	insertLeaf(proxy);
+	return true;
+}
+
+void BoundingVolumeTree::Clear()
+{
+	nodes.clear();
+	root = NULL_NODE;
+	free_list = NULL_NODE;
+	proxy_count = 0;
+}
+
+void BoundingVolumeTree::insertLeaf(int leaf)
+{
+	if (root == NULL_NODE)
+	{
+		root = leaf;
+		nodes[root].parent = NULL_NODE;
+		return;
+	}
+
+	// descend to the sibling with the lowest cost, the cost of a node is the area it adds to its ancestors
+	glm::vec3 leaf_min = nodes[leaf].bounds_min;
+	glm::vec3 leaf_max = nodes[leaf].bounds_max;
+	int index = root;
+	while (!nodes[index].IsLeaf())
+	{
+		const Node& node = nodes[index];
+		float area = surfaceArea(node.bounds_min, node.bounds_max);
+		float combined_area = surfaceArea(glm::min(node.bounds_min, leaf_min), glm::max(node.bounds_max, leaf_max));
+
+		// cost of a new parent of this node and the leaf, and the increase pushed down to the children
+		float cost = 2.0f * combined_area;
+		float inheritance_cost = 2.0f * (combined_area - area);
+
+		float child_costs[2];
+		for (int i = 0; i < 2; i++)
+		{
+			const Node& child = nodes[node.children[i]];
+			float child_area = surfaceArea(glm::min(child.bounds_min, leaf_min), glm::max(child.bounds_max, leaf_max));
+			if (!child.IsLeaf())
+				child_area -= surfaceArea(child.bounds_min, child.bounds_max);
+			child_costs[i] = child_area + inheritance_cost;
+		}
+
+		if (cost < child_costs[0] && cost < child_costs[1])
+			break;
+		index = (child_costs[0] < child_costs[1]) ? node.children[0] : node.children[1];
+	}
+	int sibling = index;
+
+	// a new parent of the sibling and the leaf
+	int old_parent = nodes[sibling].parent;
+	int new_parent = allocateNode();
+	nodes[new_parent].parent = old_parent;
+	nodes[new_parent].bounds_min = glm::min(nodes[sibling].bounds_min, leaf_min);
+	nodes[new_parent].bounds_max = glm::max(nodes[sibling].bounds_max, leaf_max);
+	nodes[new_parent].height = nodes[sibling].height + 1;
+	nodes[new_parent].children[0] = sibling;
+	nodes[new_parent].children[1] = leaf;
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+
+	if (old_parent != NULL_NODE)
+	{
+		int child = (nodes[old_parent].children[0] == sibling) ? 0 : 1;
+		nodes[old_parent].children[child] = new_parent;
+	}
+	else
+		root = new_parent;
+
+	refitAncestors(nodes[leaf].parent);
+}
+
+void BoundingVolumeTree::removeLeaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = NULL_NODE;
+		return;
+	}
+
+	// the sibling takes the place of the parent
+	int parent = nodes[leaf].parent;
+	int grand_parent = nodes[parent].parent;
+	int sibling = (nodes[parent].children[0] == leaf) ? nodes[parent].children[1] : nodes[parent].children[0];
+
+	if (grand_parent != NULL_NODE)
+	{
+		int child = (nodes[grand_parent].children[0] == parent) ? 0 : 1;
+		nodes[grand_parent].children[child] = sibling;
+		nodes[sibling].parent = grand_parent;
+		freeNode(parent);
+		refitAncestors(grand_parent);
+	}
+	else
+	{
+		root = sibling;
+		nodes[sibling].parent = NULL_NODE;
+		freeNode(parent);
+	}
+}
+
+void BoundingVolumeTree::refitAncestors(int node)
+{
+	while (node != NULL_NODE)
+	{
+		node = balance(node);
+
+		int left = nodes[node].children[0];
+		int right = nodes[node].children[1];
+		nodes[node].height = 1 + std::max(nodes[left].height, nodes[right].height);
+		nodes[node].bounds_min = glm::min(nodes[left].bounds_min, nodes[right].bounds_min);
+		nodes[node].bounds_max = glm::max(nodes[left].bounds_max, nodes[right].bounds_max);
+
+		node = nodes[node].parent;
+	}
+}
+
+int BoundingVolumeTree::balance(int a)
+{
+	Node& node_a = nodes[a];
+	if (node_a.IsLeaf() || node_a.height < 2)
+		return a;
+
+	// the higher child (c) replaces a, a takes the lower grandchild of c (f or g) and keeps the other child (b)
+	int difference = nodes[node_a.children[1]].height - nodes[node_a.children[0]].height;
+	if (difference >= -1 && difference <= 1)
+		return a;
+	int higher = (difference > 1) ? 1 : 0;
+	int b = node_a.children[1 - higher];
+	int c = node_a.children[higher];
+	Node& node_b = nodes[b];
+	Node& node_c = nodes[c];
+	int f = node_c.children[0];
+	int g = node_c.children[1];
+	Node& node_f = nodes[f];
+	Node& node_g = nodes[g];
+
+	// swap a and c
+	node_c.children[0] = a;
+	node_c.parent = node_a.parent;
+	node_a.parent = c;
+	if (node_c.parent != NULL_NODE)
+	{
+		int child = (nodes[node_c.parent].children[0] == a) ? 0 : 1;
+		nodes[node_c.parent].children[child] = c;
+	}
+	else
+		root = c;
+
+	// c keeps the higher grandchild
+	int kept = (node_f.height > node_g.height) ? f : g;
+	int moved = (kept == f) ? g : f;
+	node_c.children[1] = kept;
+	node_a.children[higher] = moved;
+	nodes[moved].parent = a;
+
+	node_a.bounds_min = glm::min(node_b.bounds_min, nodes[moved].bounds_min);
+	node_a.bounds_max = glm::max(node_b.bounds_max, nodes[moved].bounds_max);
+	node_a.height = 1 + std::max(node_b.height, nodes[moved].height);
+	node_c.bounds_min = glm::min(node_a.bounds_min, nodes[kept].bounds_min);
+	node_c.bounds_max = glm::max(node_a.bounds_max, nodes[kept].bounds_max);
+	node_c.height = 1 + std::max(node_a.height, nodes[kept].height);
+	return c;
+}
+
+void BoundingVolumeTree::Rebuild()
+{
+	if (root == NULL_NODE)
+		return;
+
+	// keep the leaves, the internal nodes are allocated again
+	std::vector<int> leaves;
+	leaves.reserve(proxy_count);
+	for (int i = 0; i < static_cast<int>(nodes.size()); i++)
+	{
+		if (nodes[i].height < 0)
+			continue;
+		if (nodes[i].IsLeaf())
+			leaves.push_back(i);
+		else
+			freeNode(i);
+	}
+
+	root = build(leaves, 0, leaves.size());
+	nodes[root].parent = NULL_NODE;
+}
+
+int BoundingVolumeTree::build(std::vector<int>& leaves, size_t begin, size_t end)
+{
+	if (end - begin == 1)
+		return leaves[begin];
+
+	// longest axis of the centers
+	glm::vec3 centers_min(FLT_MAX), centers_max(-FLT_MAX);
+	for (size_t i = begin; i < end; i++)
+	{
+		glm::vec3 center = nodes[leaves[i]].bounds_min + nodes[leaves[i]].bounds_max;
+		centers_min = glm::min(centers_min, center);
+		centers_max = glm::max(centers_max, center);
+	}
+	glm::vec3 extent = centers_max - centers_min;
+	int axis = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+
+	size_t middle = (begin + end) / 2;
+	std::nth_element(leaves.begin() + begin, leaves.begin() + middle, leaves.begin() + end, [this, axis](int a, int b)
+	{
+		return nodes[a].bounds_min[axis] + nodes[a].bounds_max[axis] < nodes[b].bounds_min[axis] + nodes[b].bounds_max[axis];
+	});
+
+	// the children are built first, allocating may move the nodes
+	int left = build(leaves, begin, middle);
+	int right = build(leaves, middle, end);
+	int node = allocateNode();
+	nodes[node].children[0] = left;
+	nodes[node].children[1] = right;
+	nodes[node].bounds_min = glm::min(nodes[left].bounds_min, nodes[right].bounds_min);
+	nodes[node].bounds_max = glm::max(nodes[left].bounds_max, nodes[right].bounds_max);
+	nodes[node].height = 1 + std::max(nodes[left].height, nodes[right].height);
+	nodes[left].parent = node;
+	nodes[right].parent = node;
+	return node;
+}
+
+void BoundingVolumeTree::QueryFrustum(const Culling::Frustum& frustum, std::vector<uint32_t>& results) const
+{
+	if (root == NULL_NODE)
+		return;
+
+	// pairs of node and mask of the planes it still has to be tested against
+	const int all_planes = (1 << 6) - 1;
+	stack.clear();
+	stack.push_back(root);
+	stack.push_back(all_planes);
+	while (!stack.empty())
+	{
+		int mask = stack.back();
+		stack.pop_back();
+		int index = stack.back();
+		stack.pop_back();
+		const Node& node = nodes[index];
+
+		if (mask != 0)
+		{
+			glm::vec3 center = 0.5f * (node.bounds_min + node.bounds_max);
+			glm::vec3 extent = 0.5f * (node.bounds_max - node.bounds_min);
+			bool outside = false;
+			for (int i = 0; i < 6 && !outside; i++)
+			{
+				if ((mask & (1 << i)) == 0)
+					continue;
+				const glm::vec4& plane = frustum.planes[i];
+				float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+				float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+				if (distance + radius < 0.0f)
+					outside = true;
+				// the children are inside this plane as well
+				else if (distance - radius >= 0.0f)
+					mask &= ~(1 << i);
+			}
+			if (outside)
+				continue;
+		}
+
+		if (node.IsLeaf())
+			results.push_back(node.user_data);
+		else
+		{
+			stack.push_back(node.children[0]);
+			stack.push_back(mask);
+			stack.push_back(node.children[1]);
+			stack.push_back(mask);
+		}
+	}
+}
+
+void BoundingVolumeTree::QuerySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& results) const
+{
+	if (root == NULL_NODE)
+		return;
+
+	stack.clear();
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+
+		glm::vec3 offset = center - glm::clamp(center, node.bounds_min, node.bounds_max);
+		if (glm::dot(offset, offset) > radius * radius)
+			continue;
+
+		if (node.IsLeaf())
+			results.push_back(node.user_data);
+		else
+		{
+			stack.push_back(node.children[0]);
+			stack.push_back(node.children[1]);
+		}
+	}
+}
+
+void BoundingVolumeTree::QueryRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance, std::vector<uint32_t>& results) const
+{
+	if (root == NULL_NODE)
+		return;
+
+	// axes the ray is parallel to get a large finite inverse, so that the slabs it starts on do not give NaN
+	glm::vec3 inverse_direction;
+	for (int i = 0; i < 3; i++)
+		inverse_direction[i] = (direction[i] != 0.0f) ? 1.0f / direction[i] : FLT_MAX;
+
+	stack.clear();
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+
+		glm::vec3 t0 = (node.bounds_min - origin) * inverse_direction;
+		glm::vec3 t1 = (node.bounds_max - origin) * inverse_direction;
+		glm::vec3 t_near = glm::min(t0, t1);
+		glm::vec3 t_far = glm::max(t0, t1);
+		float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+		float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+		if (enter > exit)
+			continue;
+
+		if (node.IsLeaf())
+			results.push_back(node.user_data);
+		else
+		{
+			stack.push_back(node.children[0]);
+			stack.push_back(node.children[1]);
+		}
+	}
+}
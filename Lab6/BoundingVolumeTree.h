@@ -0,0 +1,79 @@
+#ifndef BOUNDING_VOLUME_TREE_H
+#define BOUNDING_VOLUME_TREE_H
+
+#include <vector>
+#include <cstdint>
+#include "glm\glm.hpp"
+#include "Culling.h"
+
+/* Dynamic AABB tree over the objects of the scene
+Every object is a leaf (proxy) with a world space AABB enlarged by a margin, so a moving object is reinserted
+only when it leaves its fat bounds. The leaves are inserted next to the sibling that grows the surface area the least
+and the tree is kept balanced by rotations, Rebuild splits the leaves top down again after many static changes.
+The queries visit only the subtrees whose bounds intersect the volume, a subtree completely inside a frustum is
+reported without testing it further.
+*/
+class BoundingVolumeTree
+{
+public:
+	static const int NULL_NODE = -1;
+
+	BoundingVolumeTree(float margin = 0.5f);
+
+	// add an object, returns its proxy
+	int Insert(const glm::vec3& bounds_min, const glm::vec3& bounds_max, uint32_t user_data);
+	void Remove(int proxy);
+	// refit a moving object, returns true if it left its fat bounds (or they are much larger) and it was reinserted
+	bool Move(int proxy, const glm::vec3& bounds_min, const glm::vec3& bounds_max);
+	void Clear();
+	// rebuild the hierarchy of the current proxies (their ids are kept)
+	void Rebuild();
+
+	uint32_t GetUserData(int proxy) const { return nodes[proxy].user_data; }
+	void SetUserData(int proxy, uint32_t user_data) { nodes[proxy].user_data = user_data; }
+	const glm::vec3& GetFatMin(int proxy) const { return nodes[proxy].bounds_min; }
+	const glm::vec3& GetFatMax(int proxy) const { return nodes[proxy].bounds_max; }
+	unsigned int GetProxyCount() const { return proxy_count; }
+	int GetHeight() const { return (root == NULL_NODE) ? 0 : nodes[root].height; }
+
+	// the user data of the proxies whose fat bounds intersect the volume are appended to results
+	void QueryFrustum(const Culling::Frustum& frustum, std::vector<uint32_t>& results) const;
+	void QuerySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& results) const;
+	// direction is normalized, the proxies are appended in the order they are found
+	void QueryRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance, std::vector<uint32_t>& results) const;
+
+private:
+	struct Node
+	{
+		glm::vec3 bounds_min;
+		glm::vec3 bounds_max;
+		// next node of the free list when the node is not used
+		int parent;
+		int children[2];
+		// 0 for leaves, -1 for free nodes
+		int height;
+		uint32_t user_data;
+
+		bool IsLeaf() const { return children[0] == NULL_NODE; }
+	};
+	std::vector<Node> nodes;
+	int root;
+	int free_list;
+	unsigned int proxy_count;
+	float margin;
+	// traversal stack of the queries
+	mutable std::vector<int> stack;
+
+	int allocateNode();
+	void freeNode(int node);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	// rotate the children of an unbalanced node up, returns the new root of the subtree
+	int balance(int node);
+	// refit the bounds and heights of the ancestors of a node, balancing them
+	void refitAncestors(int node);
+	// top down split of leaves[begin, end) by the median of their centers along the longest axis
+	int build(std::vector<int>& leaves, size_t begin, size_t end);
+};
+
+#endif
@@ -0,0 +1,353 @@
+#include "CookedMesh.h"
+#include "GeometricMesh.h"
+#include "VertexFormat.h"
+#include "Tools.h"
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+
+// every section starts at a multiple of this
+#define SECTION_ALIGNMENT 16
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + SECTION_ALIGNMENT - 1) & ~static_cast<uint64_t>(SECTION_ALIGNMENT - 1);
+}
+
+static void copyString(char* destination, size_t capacity, const std::string& source)
+{
+	memset(destination, 0, capacity);
+	strncpy(destination, source.c_str(), capacity - 1);
+}
+
+// hash a source file in steps, dropping the hashed pages so that large sources don't stay resident
+static uint64_t hashFile(MappedFile& source)
+{
+	const size_t step = 16 * 1024 * 1024;
+	uint64_t hash = Tools::HashFNV1a(nullptr, 0);
+	for (size_t offset = 0; offset < source.GetSize(); offset += step)
+	{
+		size_t size = std::min(step, source.GetSize() - offset);
+		hash = Tools::HashFNV1a(source.GetData() + offset, size, hash);
+		source.Discard(offset, size);
+	}
+	return hash;
+}
+
+CookedMesh::CookedMesh()
+{
+	header = nullptr;
+}
+
+CookedMesh::~CookedMesh()
+{
+	Close();
+}
+
+std::string CookedMesh::GetCacheFilename(const char* source_filename)
+{
+	return std::string(source_filename) + ".cmesh";
+}
+
+bool CookedMesh::Cook(const char* cache_filename, const GeometricMesh* mesh, const std::vector<std::string>& dependencies)
+{
+	std::vector<unsigned char> vertex_data;
+	unsigned int vertex_format = VertexFormat::ChooseFlags(mesh);
+	glm::mat4 dequantization_matrix = VertexFormat::Pack(mesh, vertex_format, vertex_data);
+
+	glm::vec3 bounds_min(FLT_MAX);
+	glm::vec3 bounds_max(-FLT_MAX);
+	for (const glm::vec3& position : mesh->vertices)
+	{
+		bounds_min = glm::min(bounds_min, position);
+		bounds_max = glm::max(bounds_max, position);
+	}
+
+	Writer writer;
+	bool written = writer.Begin(cache_filename, vertex_format, dequantization_matrix, bounds_min, bounds_max);
+	written = written && writer.AppendVertices(vertex_data.data(), static_cast<uint32_t>(mesh->vertices.size()));
+	written = written && writer.AppendIndices(mesh->indices.data(), static_cast<uint32_t>(mesh->indices.size()));
+	written = written && writer.Finish(mesh->objects, mesh->materials, dependencies, mesh->lod_errors);
+	return written;
+}
+
+CookedMesh::Writer::Writer()
+{
+	file = NULL;
+	indices_file = NULL;
+	written = 0;
+}
+
+CookedMesh::Writer::~Writer()
+{
+	Abort();
+}
+
+bool CookedMesh::Writer::Begin(const char* cache_filename, unsigned int vertex_format, const glm::mat4& dequantization_matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+{
+	Abort();
+
+	memset(&header, 0, sizeof(Header));
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.vertex_format = vertex_format;
+	header.vertex_stride = VertexFormat::GetLayout(vertex_format).stride;
+	memcpy(header.dequantization_matrix, &dequantization_matrix[0][0], sizeof(header.dequantization_matrix));
+	for (int i = 0; i < 3; i++)
+	{
+		header.bounds_min[i] = bounds_min[i];
+		header.bounds_max[i] = bounds_max[i];
+	}
+	header.vertices_offset = alignOffset(sizeof(Header));
+
+	// write to a temporary file first so that a failed write never leaves a broken cache
+	this->cache_filename = cache_filename;
+	temporary_filename = this->cache_filename + ".tmp";
+	indices_filename = this->cache_filename + ".indices.tmp";
+	file = fopen(temporary_filename.c_str(), "wb");
+	indices_file = fopen(indices_filename.c_str(), "w+b");
+	if (file == NULL || indices_file == NULL)
+	{
+		printf("CookedMesh: could not create %s\n", temporary_filename.c_str());
+		Abort();
+		return false;
+	}
+
+	// the header is written again by Finish
+	written = 0;
+	return write(&header, sizeof(Header)) && writePadding(header.vertices_offset);
+}
+
+bool CookedMesh::Writer::AppendVertices(const void* data, uint32_t count)
+{
+	if (count == 0) return file != NULL;
+	header.vertex_count += count;
+	return write(data, static_cast<size_t>(count) * header.vertex_stride);
+}
+
+bool CookedMesh::Writer::AppendIndices(const uint32_t* indices, uint32_t count)
+{
+	if (indices_file == NULL) return false;
+	header.index_count += count;
+	return fwrite(indices, sizeof(uint32_t), count, indices_file) == count;
+}
+
+bool CookedMesh::Writer::Finish(const std::vector<GeometricMesh::MeshObject>& objects, const std::vector<OBJMaterial>& source_materials, const std::vector<std::string>& dependencies,
+	const std::vector<float>& lod_errors)
+{
+	if (file == NULL)
+		return false;
+
+	header.lod_count = static_cast<uint32_t>(std::min<size_t>(lod_errors.size() + 1, MeshSimplifier::MAX_LEVELS));
+	header.lod_errors[0] = 0.0f;
+	for (uint32_t level = 1; level < header.lod_count; level++)
+		header.lod_errors[level] = lod_errors[level - 1];
+
+	std::vector<Part> parts(objects.size());
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		memset(&parts[i], 0, sizeof(Part));
+		// unknown materials fall back to the default one
+		parts[i].material = (objects[i].material_id >= 0) ? objects[i].material_id : 0;
+		parts[i].start[0] = objects[i].start;
+		parts[i].count[0] = objects[i].end - objects[i].start;
+		for (uint32_t level = 1; level < header.lod_count; level++)
+		{
+			// an object without the level (e.g. from the streaming cook) keeps its previous one
+			const GeometricMesh::Lod* lod = (level - 1 < objects[i].lods.size()) ? &objects[i].lods[level - 1] : nullptr;
+			parts[i].start[level] = (lod != nullptr) ? lod->start : parts[i].start[level - 1];
+			parts[i].count[level] = (lod != nullptr) ? lod->end - lod->start : parts[i].count[level - 1];
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			parts[i].bounds_min[c] = objects[i].bounds_min[c];
+			parts[i].bounds_max[c] = objects[i].bounds_max[c];
+		}
+		parts[i].bounds_min[3] = parts[i].bounds_max[3] = 0.0f;
+	}
+	header.part_count = static_cast<uint32_t>(parts.size());
+
+	std::vector<Material> materials(source_materials.size());
+	for (size_t i = 0; i < source_materials.size(); i++)
+	{
+		const OBJMaterial& source = source_materials[i];
+		memset(&materials[i], 0, sizeof(Material));
+		memcpy(materials[i].diffuse, source.diffuse, sizeof(materials[i].diffuse));
+		memcpy(materials[i].specular, source.specular, sizeof(materials[i].specular));
+		materials[i].shininess = source.shininess;
+		materials[i].alpha = source.alpha;
+		copyString(materials[i].name, sizeof(materials[i].name), source.name);
+		copyString(materials[i].texture, sizeof(materials[i].texture), source.texture);
+	}
+	header.material_count = static_cast<uint32_t>(materials.size());
+
+	std::vector<Dependency> dependency_table(dependencies.size());
+	for (size_t i = 0; i < dependencies.size(); i++)
+	{
+		if (!InitDependency(dependencies[i].c_str(), dependency_table[i]))
+		{
+			Abort();
+			return false;
+		}
+	}
+	header.dependency_count = static_cast<uint32_t>(dependency_table.size());
+
+	// section layout
+	header.indices_offset = alignOffset(header.vertices_offset + static_cast<uint64_t>(header.vertex_count) * header.vertex_stride);
+	header.parts_offset = alignOffset(header.indices_offset + static_cast<uint64_t>(header.index_count) * sizeof(uint32_t));
+	header.materials_offset = alignOffset(header.parts_offset + parts.size() * sizeof(Part));
+	header.dependencies_offset = alignOffset(header.materials_offset + materials.size() * sizeof(Material));
+	header.file_size = header.dependencies_offset + dependency_table.size() * sizeof(Dependency);
+
+	// copy the spilled indices after the vertices
+	bool succeeded = writePadding(header.indices_offset) && fseek(indices_file, 0, SEEK_SET) == 0;
+	std::vector<unsigned char> buffer(1 << 20);
+	size_t read;
+	while (succeeded && (read = fread(buffer.data(), 1, buffer.size(), indices_file)) > 0)
+		succeeded = write(buffer.data(), read);
+	succeeded = succeeded && !ferror(indices_file);
+
+	succeeded = succeeded && writePadding(header.parts_offset) && write(parts.data(), parts.size() * sizeof(Part));
+	succeeded = succeeded && writePadding(header.materials_offset) && write(materials.data(), materials.size() * sizeof(Material));
+	succeeded = succeeded && writePadding(header.dependencies_offset) && write(dependency_table.data(), dependency_table.size() * sizeof(Dependency));
+	succeeded = succeeded && written == header.file_size;
+	succeeded = succeeded && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(Header), 1, file) == 1;
+
+	succeeded = (fclose(file) == 0) && succeeded;
+	file = NULL;
+	fclose(indices_file);
+	indices_file = NULL;
+	remove(indices_filename.c_str());
+
+	if (succeeded)
+	{
+		remove(cache_filename.c_str());
+		succeeded = rename(temporary_filename.c_str(), cache_filename.c_str()) == 0;
+	}
+	if (!succeeded)
+		remove(temporary_filename.c_str());
+	return succeeded;
+}
+
+void CookedMesh::Writer::Abort()
+{
+	if (file != NULL)
+	{
+		fclose(file);
+		remove(temporary_filename.c_str());
+	}
+	if (indices_file != NULL)
+	{
+		fclose(indices_file);
+		remove(indices_filename.c_str());
+	}
+	file = NULL;
+	indices_file = NULL;
+}
+
+bool CookedMesh::Writer::writePadding(uint64_t offset)
+{
+	static const unsigned char zeros[SECTION_ALIGNMENT] = {};
+	if (offset < written || offset - written > SECTION_ALIGNMENT) return false;
+	return write(zeros, static_cast<size_t>(offset - written));
+}
+
+bool CookedMesh::Writer::write(const void* data, size_t size)
+{
+	if (file == NULL) return false;
+	if (size == 0) return true;
+	written += size;
+	return fwrite(data, 1, size, file) == size;
+}
+
+bool CookedMesh::Open(const char* cache_filename)
+{
+	Close();
+	if (!file.Open(cache_filename))
+		return false;
+
+	if (file.GetSize() < sizeof(Header))
+	{
+		Close();
+		return false;
+	}
+	header = reinterpret_cast<const Header*>(file.GetData());
+
+	// reject foreign, old or truncated files
+	bool valid = header->magic == MAGIC && header->version == VERSION && header->file_size == file.GetSize();
+	valid = valid && header->lod_count >= 1 && header->lod_count <= MeshSimplifier::MAX_LEVELS;
+	valid = valid && header->vertex_stride == static_cast<uint32_t>(VertexFormat::GetLayout(header->vertex_format).stride);
+	valid = valid && header->vertices_offset + static_cast<uint64_t>(header->vertex_count) * header->vertex_stride <= header->file_size;
+	valid = valid && header->indices_offset + static_cast<uint64_t>(header->index_count) * sizeof(uint32_t) <= header->file_size;
+	valid = valid && header->parts_offset + static_cast<uint64_t>(header->part_count) * sizeof(Part) <= header->file_size;
+	valid = valid && header->materials_offset + static_cast<uint64_t>(header->material_count) * sizeof(Material) <= header->file_size;
+	valid = valid && header->dependencies_offset + static_cast<uint64_t>(header->dependency_count) * sizeof(Dependency) <= header->file_size;
+	if (valid)
+	{
+		const Part* parts = GetParts();
+		for (uint32_t i = 0; i < header->part_count && valid; i++)
+		{
+			valid = parts[i].material < header->material_count;
+			for (uint32_t level = 0; level < header->lod_count && valid; level++)
+				valid = static_cast<uint64_t>(parts[i].start[level]) + parts[i].count[level] <= header->index_count;
+		}
+	}
+	valid = valid && validateDependencies();
+
+	if (!valid)
+		Close();
+	return valid;
+}
+
+void CookedMesh::Close()
+{
+	file.Close();
+	header = nullptr;
+}
+
+bool CookedMesh::validateDependencies() const
+{
+	const Dependency* dependencies = reinterpret_cast<const Dependency*>(file.GetData() + header->dependencies_offset);
+	for (uint32_t i = 0; i < header->dependency_count; i++)
+		if (!ValidateDependency(dependencies[i]))
+			return false;
+	return true;
+}
+
+bool CookedMesh::InitDependency(const char* filename, Dependency& dependency)
+{
+	memset(&dependency, 0, sizeof(Dependency));
+	copyString(dependency.filename, sizeof(dependency.filename), filename);
+	if (!Tools::GetFileInfo(filename, dependency.modification_time, dependency.size))
+		return false;
+	MappedFile source;
+	if (source.Open(filename))
+		dependency.hash = hashFile(source);
+	return true;
+}
+
+bool CookedMesh::ValidateDependency(const Dependency& dependency)
+{
+	char filename[sizeof(dependency.filename)];
+	memcpy(filename, dependency.filename, sizeof(filename));
+	filename[sizeof(filename) - 1] = '\0';
+
+	int64_t modification_time;
+	uint64_t size;
+	if (!Tools::GetFileInfo(filename, modification_time, size) || size != dependency.size)
+		return false;
+	if (modification_time == dependency.modification_time)
+		return true;
+
+	// touched but maybe not modified (e.g. checked out again), compare the contents
+	MappedFile source;
+	return source.Open(filename) && hashFile(source) == dependency.hash;
+}
+
+glm::mat4 CookedMesh::GetDequantizationMatrix() const
+{
+	glm::mat4 matrix;
+	memcpy(&matrix[0][0], header->dequantization_matrix, sizeof(header->dequantization_matrix));
+	return matrix;
+}
@@ -0,0 +1,156 @@
+#ifndef COOKED_MESH_H
+#define COOKED_MESH_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "glm\glm.hpp"
+#include <cstdio>
+#include "MappedFile.h"
+#include "GeometricMesh.h"
+#include "MeshSimplifier.h"
+
+/* Binary cache of a loaded mesh (.cmesh next to the source OBJ)
+It holds the final packed vertices and indices (see VertexFormat), the parts and their levels of detail, the material table,
+the bounds and the source files it was built from. The file is memory mapped and the vertex / index
+streams are uploaded straight from the mapping.
+A cache is valid when every source file has the stored size and modification time,
+or, if only the time differs, the stored content hash.
+*/
+class CookedMesh
+{
+public:
+	static const uint32_t MAGIC = 0x48534D43; // "CMSH"
+	static const uint32_t VERSION = 3;
+
+	struct Part
+	{
+		uint32_t material;
+		uint32_t padding[3];
+		// index range of every level of detail (header.lod_count of them)
+		uint32_t start[MeshSimplifier::MAX_LEVELS];
+		uint32_t count[MeshSimplifier::MAX_LEVELS];
+		// model space bounds of the part (w unused)
+		float bounds_min[4];
+		float bounds_max[4];
+	};
+
+	struct Material
+	{
+		float diffuse[4];
+		float specular[4];
+		float shininess;
+		float alpha;
+		uint32_t padding[2];
+		char name[64];
+		char texture[256];
+	};
+
+	struct Dependency
+	{
+		int64_t modification_time;
+		uint64_t size;
+		uint64_t hash;
+		uint64_t padding;
+		char filename[256];
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vertex_format;
+		uint32_t vertex_stride;
+		uint32_t vertex_count;
+		uint32_t index_count;
+		uint32_t part_count;
+		uint32_t material_count;
+		uint32_t dependency_count;
+		uint32_t lod_count;
+		uint32_t padding[2];
+		// geometric error of every level of detail, in model units (0 for the full detail one)
+		float lod_errors[MeshSimplifier::MAX_LEVELS];
+		float dequantization_matrix[16];
+		float bounds_min[4];
+		float bounds_max[4];
+		// byte offsets of the sections from the start of the file
+		uint64_t vertices_offset;
+		uint64_t indices_offset;
+		uint64_t parts_offset;
+		uint64_t materials_offset;
+		uint64_t dependencies_offset;
+		uint64_t file_size;
+	};
+
+	/* Incremental writer of a cache file
+	The vertices are written straight to the file and the indices to a temporary file that is appended
+	at the end, so that meshes larger than the memory can be cooked block by block.
+	*/
+	class Writer
+	{
+	public:
+		Writer();
+		~Writer();
+
+		bool Begin(const char* cache_filename, unsigned int vertex_format, const glm::mat4& dequantization_matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max);
+		// packed vertices (see VertexFormat::Pack)
+		bool AppendVertices(const void* data, uint32_t count);
+		// indices relative to the first vertex of the mesh
+		bool AppendIndices(const uint32_t* indices, uint32_t count);
+		// write the tables and replace the cache file, the object ranges (and their levels, see MeshSimplifier) are in indices
+		bool Finish(const std::vector<GeometricMesh::MeshObject>& objects, const std::vector<OBJMaterial>& materials, const std::vector<std::string>& dependencies,
+			const std::vector<float>& lod_errors);
+		// delete the temporary files
+		void Abort();
+
+	private:
+		Header header;
+		std::string cache_filename;
+		std::string temporary_filename;
+		std::string indices_filename;
+		FILE* file;
+		FILE* indices_file;
+		uint64_t written;
+
+		bool writePadding(uint64_t offset);
+		bool write(const void* data, size_t size);
+
+		Writer(const Writer&);
+		void operator=(const Writer&);
+	};
+
+	CookedMesh();
+	~CookedMesh();
+
+	// name of the cache file of a source mesh
+	static std::string GetCacheFilename(const char* source_filename);
+
+	// write the cache of a loaded mesh, the dependencies are the source OBJ and its MTL files
+	static bool Cook(const char* cache_filename, const GeometricMesh* mesh, const std::vector<std::string>& dependencies);
+
+	// describe a source file, and check that it did not change since (also used by CookedTexture)
+	static bool InitDependency(const char* filename, Dependency& dependency);
+	static bool ValidateDependency(const Dependency& dependency);
+
+	// map the cache and validate it against its sources, returns false if it has to be rebuilt
+	bool Open(const char* cache_filename);
+	void Close();
+	bool IsOpen() const { return header != nullptr; }
+
+	const Header& GetHeader() const { return *header; }
+	const void* GetVertexData() const { return file.GetData() + header->vertices_offset; }
+	const uint32_t* GetIndices() const { return reinterpret_cast<const uint32_t*>(file.GetData() + header->indices_offset); }
+	const Part* GetParts() const { return reinterpret_cast<const Part*>(file.GetData() + header->parts_offset); }
+	const Material* GetMaterials() const { return reinterpret_cast<const Material*>(file.GetData() + header->materials_offset); }
+	glm::mat4 GetDequantizationMatrix() const;
+	glm::vec3 GetBoundsMin() const { return glm::vec3(header->bounds_min[0], header->bounds_min[1], header->bounds_min[2]); }
+	glm::vec3 GetBoundsMax() const { return glm::vec3(header->bounds_max[0], header->bounds_max[1], header->bounds_max[2]); }
+
+private:
+	MappedFile file;
+	const Header* header;
+
+	bool validateDependencies() const;
+};
+
+#endif
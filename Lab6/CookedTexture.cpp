@@ -0,0 +1,424 @@
+#include "CookedTexture.h"
+#include "SDL2/SDL_image.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <functional>
+
+// every section starts at a multiple of this
+#define SECTION_ALIGNMENT 16
+
+// byte order R, G, B, A in memory
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+#define DECODE_PIXEL_FORMAT SDL_PIXELFORMAT_RGBA8888
+#else
+#define DECODE_PIXEL_FORMAT SDL_PIXELFORMAT_ABGR8888
+#endif
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + SECTION_ALIGNMENT - 1) & ~static_cast<uint64_t>(SECTION_ALIGNMENT - 1);
+}
+
+// decode an image to RGBA, bottom row first (the GL origin)
+static bool decodeImage(const char* filename, uint32_t& width, uint32_t& height, std::vector<unsigned char>& pixels, bool& has_alpha)
+{
+	SDL_Surface* source = IMG_Load(filename);
+	if (source == 0)
+	{
+		printf("Could not Load texture %s\n", filename);
+		printf("SDL load Error %s\n", SDL_GetError());
+		return false;
+	}
+	has_alpha = source->format->Amask != 0;
+	SDL_Surface* surf = SDL_ConvertSurfaceFormat(source, DECODE_PIXEL_FORMAT, 0);
+	SDL_FreeSurface(source);
+	if (surf == 0)
+	{
+		printf("Could not convert texture %s\n", filename);
+		return false;
+	}
+
+	width = surf->w;
+	height = surf->h;
+	const size_t row_size = static_cast<size_t>(width) * 4;
+	pixels.resize(row_size * height);
+	SDL_LockSurface(surf);
+	for (uint32_t y = 0; y < height; y++)
+		memcpy(&pixels[(height - y - 1) * row_size], &static_cast<unsigned char*>(surf->pixels)[y * surf->pitch], row_size);
+	SDL_UnlockSurface(surf);
+	SDL_FreeSurface(surf);
+
+	// images saved with an alpha channel are often opaque
+	bool translucent = false;
+	for (size_t i = 3; i < pixels.size() && has_alpha && !translucent; i += 4)
+		translucent = pixels[i] != 255;
+	has_alpha = translucent;
+	return true;
+}
+
+// box filter an RGBA level to the next one, the last row / column of odd sizes is dropped
+static void downsample(const std::vector<unsigned char>& source, uint32_t width, uint32_t height, std::vector<unsigned char>& destination)
+{
+	const uint32_t next_width = std::max(1u, width / 2);
+	const uint32_t next_height = std::max(1u, height / 2);
+	destination.resize(static_cast<size_t>(next_width) * next_height * 4);
+	for (uint32_t y = 0; y < next_height; y++)
+	{
+		const unsigned char* row0 = &source[static_cast<size_t>(std::min(2 * y, height - 1)) * width * 4];
+		const unsigned char* row1 = &source[static_cast<size_t>(std::min(2 * y + 1, height - 1)) * width * 4];
+		for (uint32_t x = 0; x < next_width; x++)
+		{
+			const uint32_t x0 = std::min(2 * x, width - 1) * 4;
+			const uint32_t x1 = std::min(2 * x + 1, width - 1) * 4;
+			for (int c = 0; c < 4; c++)
+				destination[(static_cast<size_t>(y) * next_width + x) * 4 + c] = static_cast<unsigned char>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+		}
+	}
+}
+
+static uint16_t packColor(const int* color)
+{
+	return static_cast<uint16_t>(((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3));
+}
+
+static void unpackColor(uint16_t packed, int* color)
+{
+	color[0] = ((packed >> 11) & 31) * 255 / 31;
+	color[1] = ((packed >> 5) & 63) * 255 / 63;
+	color[2] = (packed & 31) * 255 / 31;
+}
+
+// BC1 color block of 16 RGBA pixels: the end points are the corners of the bounding box along
+// the diagonal that follows the colors, slightly inset, and every pixel picks the nearest of the 4 colors
+static void encodeColorBlock(const unsigned char* block, unsigned char* output)
+{
+	int minimum[3] = { 255, 255, 255 };
+	int maximum[3] = { 0, 0, 0 };
+	int mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			minimum[c] = std::min(minimum[c], static_cast<int>(block[i * 4 + c]));
+			maximum[c] = std::max(maximum[c], static_cast<int>(block[i * 4 + c]));
+			mean[c] += block[i * 4 + c];
+		}
+	}
+
+	// flip green and blue when they decrease with red
+	int covariance[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+		for (int c = 1; c < 3; c++)
+			covariance[c] += (block[i * 4] * 16 - mean[0]) * (block[i * 4 + c] * 16 - mean[c]);
+	for (int c = 1; c < 3; c++)
+		if (covariance[c] < 0) std::swap(minimum[c], maximum[c]);
+
+	int end_points[2][3];
+	for (int c = 0; c < 3; c++)
+	{
+		const int inset = (maximum[c] - minimum[c]) / 16;
+		end_points[0][c] = maximum[c] - inset;
+		end_points[1][c] = minimum[c] + inset;
+	}
+	uint16_t color0 = packColor(end_points[0]);
+	uint16_t color1 = packColor(end_points[1]);
+	// the 4 color mode needs color0 > color1
+	if (color0 < color1) std::swap(color0, color1);
+
+	uint32_t indices = 0;
+	if (color0 != color1)
+	{
+		int palette[4][3];
+		unpackColor(color0, palette[0]);
+		unpackColor(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int best_distance = INT32_MAX;
+			for (int p = 0; p < 4; p++)
+			{
+				int distance = 0;
+				for (int c = 0; c < 3; c++)
+					distance += (block[i * 4 + c] - palette[p][c]) * (block[i * 4 + c] - palette[p][c]);
+				if (distance < best_distance)
+				{
+					best = p;
+					best_distance = distance;
+				}
+			}
+			indices |= static_cast<uint32_t>(best) << (2 * i);
+		}
+	}
+
+	output[0] = color0 & 0xff;
+	output[1] = color0 >> 8;
+	output[2] = color1 & 0xff;
+	output[3] = color1 >> 8;
+	for (int i = 0; i < 4; i++)
+		output[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+// BC3 alpha block, 8 alpha values between the extremes
+static void encodeAlphaBlock(const unsigned char* block, unsigned char* output)
+{
+	int alpha0 = 0;
+	int alpha1 = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		alpha0 = std::max(alpha0, static_cast<int>(block[i * 4 + 3]));
+		alpha1 = std::min(alpha1, static_cast<int>(block[i * 4 + 3]));
+	}
+
+	uint64_t indices = 0;
+	if (alpha0 != alpha1)
+	{
+		int palette[8] = { alpha0, alpha1 };
+		for (int p = 1; p < 7; p++)
+			palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			for (int p = 1; p < 8; p++)
+				if (std::abs(block[i * 4 + 3] - palette[p]) < std::abs(block[i * 4 + 3] - palette[best]))
+					best = p;
+			indices |= static_cast<uint64_t>(best) << (3 * i);
+		}
+	}
+
+	output[0] = static_cast<unsigned char>(alpha0);
+	output[1] = static_cast<unsigned char>(alpha1);
+	for (int i = 0; i < 6; i++)
+		output[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+static uint32_t levelSize(CookedTexture::FORMAT format, uint32_t width, uint32_t height)
+{
+	switch (format)
+	{
+	case CookedTexture::FORMAT_RGB8: return width * height * 3;
+	case CookedTexture::FORMAT_RGBA8: return width * height * 4;
+	case CookedTexture::FORMAT_BC1: return ((width + 3) / 4) * ((height + 3) / 4) * 8;
+	default: return ((width + 3) / 4) * ((height + 3) / 4) * 16;
+	}
+}
+
+// write an RGBA level in the format of the file
+static void encodeLevel(CookedTexture::FORMAT format, const std::vector<unsigned char>& pixels, uint32_t width, uint32_t height, unsigned char* output)
+{
+	if (format == CookedTexture::FORMAT_RGBA8)
+	{
+		memcpy(output, pixels.data(), pixels.size());
+		return;
+	}
+	if (format == CookedTexture::FORMAT_RGB8)
+	{
+		for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+			memcpy(&output[i * 3], &pixels[i * 4], 3);
+		return;
+	}
+
+	// the blocks of the edges repeat the last row / column
+	unsigned char block[16 * 4];
+	for (uint32_t block_y = 0; block_y < height; block_y += 4)
+	{
+		for (uint32_t block_x = 0; block_x < width; block_x += 4)
+		{
+			for (uint32_t y = 0; y < 4; y++)
+				for (uint32_t x = 0; x < 4; x++)
+					memcpy(&block[(y * 4 + x) * 4], &pixels[(static_cast<size_t>(std::min(block_y + y, height - 1)) * width + std::min(block_x + x, width - 1)) * 4], 4);
+
+			if (format == CookedTexture::FORMAT_BC3)
+			{
+				encodeAlphaBlock(block, output);
+				output += 8;
+			}
+			encodeColorBlock(block, output);
+			output += 8;
+		}
+	}
+}
+
+CookedTexture::CookedTexture()
+{
+	data = nullptr;
+	header = nullptr;
+}
+
+std::string CookedTexture::GetCacheFilename(const char* source_filename)
+{
+	return std::string(source_filename) + ".ctex";
+}
+
+bool CookedTexture::cook(const char* source_filename, bool compressed, std::vector<unsigned char>& file)
+{
+	Header cooked_header;
+	memset(&cooked_header, 0, sizeof(Header));
+	if (!CookedMesh::InitDependency(source_filename, cooked_header.source))
+	{
+		printf("Could not Load texture %s\n", source_filename);
+		return false;
+	}
+
+	uint32_t width, height;
+	bool has_alpha;
+	std::vector<unsigned char> pixels;
+	if (!decodeImage(source_filename, width, height, pixels, has_alpha))
+		return false;
+
+	FORMAT format;
+	if (compressed) format = (has_alpha) ? FORMAT_BC3 : FORMAT_BC1;
+	else format = (has_alpha) ? FORMAT_RGBA8 : FORMAT_RGB8;
+
+	// full chain down to 1x1
+	uint32_t level_count = 1;
+	while ((std::max(width, height) >> level_count) > 0)
+		level_count++;
+
+	cooked_header.magic = MAGIC;
+	cooked_header.version = VERSION;
+	cooked_header.format = format;
+	cooked_header.width = width;
+	cooked_header.height = height;
+	cooked_header.level_count = level_count;
+	cooked_header.levels_offset = alignOffset(sizeof(Header));
+
+	std::vector<Level> levels(level_count);
+	uint64_t offset = alignOffset(cooked_header.levels_offset + level_count * sizeof(Level));
+	for (uint32_t i = 0; i < level_count; i++)
+	{
+		memset(&levels[i], 0, sizeof(Level));
+		levels[i].width = std::max(1u, width >> i);
+		levels[i].height = std::max(1u, height >> i);
+		levels[i].size = levelSize(format, levels[i].width, levels[i].height);
+		levels[i].offset = offset;
+		offset = alignOffset(offset + levels[i].size);
+	}
+	cooked_header.file_size = levels.back().offset + levels.back().size;
+
+	file.assign(static_cast<size_t>(cooked_header.file_size), 0);
+	memcpy(file.data(), &cooked_header, sizeof(Header));
+	memcpy(&file[static_cast<size_t>(cooked_header.levels_offset)], levels.data(), level_count * sizeof(Level));
+
+	std::vector<unsigned char> next;
+	for (uint32_t i = 0; i < level_count; i++)
+	{
+		if (i > 0)
+		{
+			downsample(pixels, levels[i - 1].width, levels[i - 1].height, next);
+			pixels.swap(next);
+		}
+		encodeLevel(format, pixels, levels[i].width, levels[i].height, &file[static_cast<size_t>(levels[i].offset)]);
+	}
+	return true;
+}
+
+bool CookedTexture::Load(const char* source_filename, bool compressed)
+{
+	std::string cache_filename = GetCacheFilename(source_filename);
+	if (Open(cache_filename.c_str(), compressed))
+		return true;
+
+	Close();
+	if (!cook(source_filename, compressed, memory))
+		return false;
+
+	// write to a temporary file first, the name is unique as two loads of the same image may run at once
+	std::string temporary_filename = cache_filename + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	FILE* output = fopen(temporary_filename.c_str(), "wb");
+	bool written = output != NULL && fwrite(memory.data(), 1, memory.size(), output) == memory.size();
+	if (output != NULL) written = (fclose(output) == 0) && written;
+	if (written)
+	{
+		remove(cache_filename.c_str());
+		written = rename(temporary_filename.c_str(), cache_filename.c_str()) == 0;
+	}
+	if (!written)
+	{
+		remove(temporary_filename.c_str());
+		printf("CookedTexture: could not write %s\n", cache_filename.c_str());
+	}
+
+	data = memory.data();
+	header = reinterpret_cast<const Header*>(data);
+	return true;
+}
+
+bool CookedTexture::Open(const char* cache_filename, bool compressed)
+{
+	Close();
+	if (!file.Open(cache_filename))
+		return false;
+
+	data = file.GetData();
+	header = reinterpret_cast<const Header*>(data);
+	if (!validate(file.GetSize(), compressed))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void CookedTexture::Close()
+{
+	file.Close();
+	memory.clear();
+	memory.shrink_to_fit();
+	data = nullptr;
+	header = nullptr;
+}
+
+bool CookedTexture::validate(size_t size, bool compressed) const
+{
+	// reject foreign, old or truncated files
+	if (size < sizeof(Header))
+		return false;
+	bool valid = header->magic == MAGIC && header->version == VERSION && header->file_size == size;
+	valid = valid && header->format <= FORMAT_BC3 && IsCompressed() == compressed;
+	valid = valid && header->level_count > 0 && header->level_count <= 32;
+	valid = valid && header->levels_offset + static_cast<uint64_t>(header->level_count) * sizeof(Level) <= header->file_size;
+	if (valid)
+	{
+		const Level* levels = GetLevels();
+		for (uint32_t i = 0; i < header->level_count && valid; i++)
+		{
+			valid = levels[i].width == std::max(1u, header->width >> i) && levels[i].height == std::max(1u, header->height >> i);
+			valid = valid && levels[i].size == levelSize(static_cast<FORMAT>(header->format), levels[i].width, levels[i].height);
+			valid = valid && levels[i].offset + levels[i].size <= header->file_size;
+		}
+	}
+	return valid && CookedMesh::ValidateDependency(header->source);
+}
+
+GLenum CookedTexture::GetInternalFormat() const
+{
+	switch (header->format)
+	{
+	case FORMAT_RGB8: return GL_RGB8;
+	case FORMAT_RGBA8: return GL_RGBA8;
+	case FORMAT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	default: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+}
+
+GLenum CookedTexture::GetPixelFormat() const
+{
+	return (header->format == FORMAT_RGB8 || header->format == FORMAT_BC1) ? GL_RGB : GL_RGBA;
+}
+
+size_t CookedTexture::GetMemorySize(unsigned int level_count) const
+{
+	size_t bytes = 0;
+	const Level* levels = GetLevels();
+	for (unsigned int i = 0; i < level_count && i < header->level_count; i++)
+		bytes += (IsCompressed()) ? levels[i].size : static_cast<size_t>(levels[i].width) * levels[i].height * 4;
+	return bytes;
+}
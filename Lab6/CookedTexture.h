@@ -0,0 +1,92 @@
+#ifndef COOKED_TEXTURE_H
+#define COOKED_TEXTURE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "GLEW\glew.h"
+#include "MappedFile.h"
+#include "CookedMesh.h"
+
+/* Cooked texture (.ctex next to the source image)
+It holds the full mip chain, bottom row first, either as tightly packed RGB / RGBA or BC1 / BC3 (S3TC) blocks,
+so the levels are uploaded as they are without any runtime processing.
+The file is memory mapped, a cache is valid while the source image is unchanged (see CookedMesh::Dependency)
+and it was cooked with the requested compression.
+*/
+class CookedTexture
+{
+public:
+	static const uint32_t MAGIC = 0x58455443; // "CTEX"
+	static const uint32_t VERSION = 1;
+
+	enum FORMAT
+	{
+		FORMAT_RGB8,
+		FORMAT_RGBA8,
+		// S3TC blocks, for images without and with alpha
+		FORMAT_BC1,
+		FORMAT_BC3,
+	};
+
+	struct Level
+	{
+		// from the start of the file
+		uint64_t offset;
+		uint32_t size;
+		uint32_t width;
+		uint32_t height;
+		uint32_t padding[3];
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t level_count;
+		uint32_t padding[2];
+		uint64_t levels_offset;
+		uint64_t file_size;
+		CookedMesh::Dependency source;
+	};
+
+	CookedTexture();
+
+	// name of the cache file of a source image
+	static std::string GetCacheFilename(const char* source_filename);
+
+	// open the cache of a source image, cooks it first if it is missing or out of date
+	// (in memory only if the cache can not be written)
+	bool Load(const char* source_filename, bool compressed);
+	// map a cache and validate it against its source
+	bool Open(const char* cache_filename, bool compressed);
+	void Close();
+
+	const Header& GetHeader() const { return *header; }
+	const Level* GetLevels() const { return reinterpret_cast<const Level*>(data + header->levels_offset); }
+	const unsigned char* GetData() const { return data; }
+	bool IsCompressed() const { return header->format == FORMAT_BC1 || header->format == FORMAT_BC3; }
+
+	// GL formats of the levels, the pixel format is not used by compressed textures
+	GLenum GetInternalFormat() const;
+	GLenum GetPixelFormat() const;
+	// bytes of the texture in GPU memory, the drivers store RGB as RGBA
+	size_t GetMemorySize(unsigned int level_count) const;
+
+private:
+	MappedFile file;
+	// the file is cooked in memory when the cache can not be written
+	std::vector<unsigned char> memory;
+	const unsigned char* data;
+	const Header* header;
+
+	bool validate(size_t size, bool compressed) const;
+
+	// decode the source image and build the whole file
+	static bool cook(const char* source_filename, bool compressed, std::vector<unsigned char>& file);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include "Culling.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+Culling::Frustum Culling::ExtractFrustum(const glm::mat4& view_projection_matrix)
+{
+	// rows of the matrix (glm is column major)
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(view_projection_matrix[0][i], view_projection_matrix[1][i], view_projection_matrix[2][i], view_projection_matrix[3][i]);
+
+	// left, right, bottom, top, near, far
+	Frustum frustum;
+	for (int i = 0; i < 3; i++)
+	{
+		frustum.planes[2 * i] = rows[3] + rows[i];
+		frustum.planes[2 * i + 1] = rows[3] - rows[i];
+	}
+	for (glm::vec4& plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+	return frustum;
+}
+
+glm::vec4 Culling::SphereFromAABB(const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+{
+	return glm::vec4(0.5f * (bounds_min + bounds_max), 0.5f * glm::length(bounds_max - bounds_min));
+}
+
+glm::vec4 Culling::TransformSphere(const glm::mat4& matrix, const glm::vec4& sphere)
+{
+	glm::vec3 center = glm::vec3(matrix * glm::vec4(glm::vec3(sphere), 1.0f));
+	float scale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+	return glm::vec4(center, sphere.w * scale);
+}
+
+void Culling::TestSpheres(const Frustum& frustum, const glm::vec4* spheres, size_t count, unsigned char* visible)
+{
+	size_t i = 0;
+#ifdef CULLING_SSE
+	// 4 spheres per iteration, transposed to x x x x / y y y y / z z z z / r r r r
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&spheres[i][0]);
+		__m128 y = _mm_loadu_ps(&spheres[i + 1][0]);
+		__m128 z = _mm_loadu_ps(&spheres[i + 2][0]);
+		__m128 r = _mm_loadu_ps(&spheres[i + 3][0]);
+		_MM_TRANSPOSE4_PS(x, y, z, r);
+		__m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), r);
+
+		// a sphere is outside when it is behind any plane by more than its radius
+		__m128 outside = _mm_setzero_ps();
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negative_radius));
+		}
+		int mask = _mm_movemask_ps(outside);
+		for (int j = 0; j < 4; j++)
+			visible[i + j] = ((mask >> j) & 1) ? 0 : 1;
+	}
+#endif
+	for (; i < count; i++)
+	{
+		visible[i] = 1;
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			if (glm::dot(glm::vec3(plane), glm::vec3(spheres[i])) + plane.w < -spheres[i].w)
+			{
+				visible[i] = 0;
+				break;
+			}
+		}
+	}
+}
+
+void Culling::TransformAABB(const glm::mat4& matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max, glm::vec3& world_min, glm::vec3& world_max)
+{
+	glm::vec3 center = glm::vec3(matrix * glm::vec4(0.5f * (bounds_min + bounds_max), 1.0f));
+	glm::vec3 extent = 0.5f * (bounds_max - bounds_min);
+	glm::vec3 world_extent(0.0f);
+	for (int i = 0; i < 3; i++)
+		world_extent += glm::abs(glm::vec3(matrix[i])) * extent[i];
+	world_min = center - world_extent;
+	world_max = center + world_extent;
+}
+
+bool Culling::TestAABB(const Frustum& frustum, const glm::mat4& matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+{
+	// world space AABB of the transformed box
+	glm::vec3 world_min, world_max;
+	TransformAABB(matrix, bounds_min, bounds_max, world_min, world_max);
+	glm::vec3 center = 0.5f * (world_min + world_max);
+	glm::vec3 world_extent = 0.5f * (world_max - world_min);
+
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		// distance of the corner furthest along the normal
+		if (glm::dot(glm::vec3(plane), center) + glm::dot(glm::abs(glm::vec3(plane)), world_extent) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+bool Culling::ProjectAABB(const glm::mat4& view_projection_matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max, glm::vec3& ndc_min, glm::vec3& ndc_max)
+{
+	ndc_min = glm::vec3(FLT_MAX);
+	ndc_max = glm::vec3(-FLT_MAX);
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 position((corner & 1) ? bounds_max.x : bounds_min.x, (corner & 2) ? bounds_max.y : bounds_min.y, (corner & 4) ? bounds_max.z : bounds_min.z);
+		glm::vec4 clip = view_projection_matrix * glm::vec4(position, 1.0f);
+		// the division flips the corners behind the eye
+		if (clip.w <= 0.0f)
+			return false;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		ndc_min = glm::min(ndc_min, ndc);
+		ndc_max = glm::max(ndc_max, ndc);
+	}
+	return true;
+}
+
+bool Culling::TestShadowReach(const glm::vec3& caster_min, const glm::vec3& caster_max, const glm::vec3& receiver_min, const glm::vec3& receiver_max)
+{
+	// the shadow of the caster is its rectangle extruded away from the light (+z)
+	return caster_min.x <= receiver_max.x && caster_max.x >= receiver_min.x
+		&& caster_min.y <= receiver_max.y && caster_max.y >= receiver_min.y
+		&& caster_min.z <= receiver_max.z;
+}
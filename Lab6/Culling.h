@@ -0,0 +1,42 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <cstddef>
+#include "glm\glm.hpp"
+
+/* Visibility tests of bounding volumes against a view frustum
+The bounds are stored as model space AABBs, the renderer transforms their bounding spheres to world space
+and tests them four at a time against the planes of the frustum (SSE, with a scalar fallback).
+*/
+namespace Culling
+{
+	// the 6 planes (xyz: inward normal, w: distance) of the frustum of a view projection matrix
+	struct Frustum
+	{
+		glm::vec4 planes[6];
+	};
+
+	Frustum ExtractFrustum(const glm::mat4& view_projection_matrix);
+
+	// bounding sphere of an AABB (xyz: center, w: radius)
+	glm::vec4 SphereFromAABB(const glm::vec3& bounds_min, const glm::vec3& bounds_max);
+	// transform a sphere, the radius is scaled by the largest axis scale of the matrix
+	glm::vec4 TransformSphere(const glm::mat4& matrix, const glm::vec4& sphere);
+	// world space AABB of a transformed AABB
+	void TransformAABB(const glm::mat4& matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max, glm::vec3& world_min, glm::vec3& world_max);
+
+	// visible[i] is 1 if sphere i intersects the frustum, 0 if it is completely outside
+	void TestSpheres(const Frustum& frustum, const glm::vec4* spheres, size_t count, unsigned char* visible);
+
+	// exact plane test of a transformed AABB (the positive vertex of every plane), for bounds the spheres fit badly
+	bool TestAABB(const Frustum& frustum, const glm::mat4& matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max);
+
+	// normalized device coordinates bounds of a world space AABB, false if part of the box is behind the eye of the projection.
+	// In the space of a perspective light its rays are parallel to z, which makes the shadow tests simple boxes
+	bool ProjectAABB(const glm::mat4& view_projection_matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max, glm::vec3& ndc_min, glm::vec3& ndc_max);
+	// a caster can shadow a receiver when its rectangle overlaps the receiver one and it starts in front of the receiver's far side
+	// (both in the post projective space of the light, see ProjectAABB)
+	bool TestShadowReach(const glm::vec3& caster_min, const glm::vec3& caster_max, const glm::vec3& receiver_min, const glm::vec3& receiver_max);
+};
+
+#endif
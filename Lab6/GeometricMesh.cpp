@@ -1,6 +1,7 @@
 #include "GeometricMesh.h"
 #include "ObjLoader.h"
 #include <sstream>
+#include <cfloat>
 
 GeometricMesh::GeometricMesh()
 {
@@ -29,6 +30,22 @@ int GeometricMesh::findMaterialID(std::string str)
 	return -1;
 }
 
+void GeometricMesh::ComputeObjectBounds()
+{
+	for (MeshObject& object : objects)
+	{
+		object.bounds_min = glm::vec3(FLT_MAX);
+		object.bounds_max = glm::vec3(-FLT_MAX);
+		for (unsigned int i = object.start; i < object.end; i++)
+		{
+			object.bounds_min = glm::min(object.bounds_min, vertices[indices[i]]);
+			object.bounds_max = glm::max(object.bounds_max, vertices[indices[i]]);
+		}
+		if (object.start == object.end)
+			object.bounds_min = object.bounds_max = glm::vec3(0.0f);
+	}
+}
+
 void GeometricMesh::printObjects(void)
 {
 	printf("\n          OBJECTS   :\n");
@@ -14,23 +14,41 @@ public:
 	struct OBJMaterial* findMaterial(std::string str);
 	int findMaterialID(std::string str);
 
+	// compute the bounds of every object from the vertices its indices reference
+	void ComputeObjectBounds();
+
 	/// test functions
 	void printObjects(void);
 	void printMaterials(void);
 
 	// variables
+	// range in the index buffer of a simplified level of an object (see MeshSimplifier)
+	struct Lod
+	{
+		unsigned int start;
+		unsigned int end;
+	};
 	struct MeshObject
 	{
 		int material_id;
+		// range in the index buffer
 		unsigned int start;
 		unsigned int end;
 		std::string name;
+		// bounds of the vertices of the range, see ComputeObjectBounds
+		glm::vec3 bounds_min;
+		glm::vec3 bounds_max;
+		// levels 1.. of the object, [start, end) is the full detail level
+		std::vector<Lod> lods;
 	};
+	// geometric error of the levels 1.. (the same for every object), in the units of the positions
+	std::vector<float> lod_errors;
 	std::vector<MeshObject> objects;
 	std::vector<OBJMaterial> materials;
 	std::vector<glm::vec3> vertices;
 	std::vector<glm::vec3> normals;
 	std::vector<glm::vec2> textureCoord;
+	std::vector<unsigned int> indices;
 	std::vector<glm::vec3> tangents;
 	std::vector<glm::vec3> bitangents;
 };
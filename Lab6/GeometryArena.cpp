@@ -0,0 +1,135 @@
+#include "GeometryArena.h"
+#include "VertexFormat.h"
+#include <algorithm>
+#include <cstdio>
+
+// initial capacity of a new pool
+#define ARENA_INITIAL_VERTICES (64 * 1024)
+#define ARENA_INITIAL_INDICES (256 * 1024)
+
+GeometryArena::GeometryArena()
+{
+
+}
+
+GeometryArena::~GeometryArena()
+{
+	Clear();
+}
+
+void GeometryArena::Clear()
+{
+	for (Pool& pool : pools)
+	{
+		glDeleteVertexArrays(1, &pool.vao);
+		glDeleteBuffers(1, &pool.vbo);
+		glDeleteBuffers(1, &pool.ibo);
+	}
+	pools.clear();
+}
+
+GeometryArena::Pool& GeometryArena::findPool(unsigned int vertex_format)
+{
+	for (Pool& pool : pools)
+	{
+		if (pool.vertex_format == vertex_format)
+			return pool;
+	}
+
+	Pool pool;
+	pool.vertex_format = vertex_format;
+	pool.stride = VertexFormat::GetLayout(vertex_format).stride;
+	pool.vao = pool.vbo = pool.ibo = 0;
+	pool.vertex_capacity = pool.vertex_count = 0;
+	pool.index_capacity = pool.index_count = 0;
+	glGenVertexArrays(1, &pool.vao);
+	pools.push_back(pool);
+
+	growPool(pools.back(), ARENA_INITIAL_VERTICES, ARENA_INITIAL_INDICES);
+	return pools.back();
+}
+
+void GeometryArena::growPool(Pool& pool, unsigned int vertex_capacity, unsigned int index_capacity)
+{
+	GLuint buffers[2];
+	glGenBuffers(2, buffers);
+
+	// copy the used part of the old buffers into the new ones
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+	glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(vertex_capacity) * pool.stride, NULL, GL_STATIC_DRAW);
+	if (pool.vbo != 0 && pool.vertex_count > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, pool.vbo);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, static_cast<GLsizeiptr>(pool.vertex_count) * pool.stride);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+	glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(index_capacity) * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+	if (pool.ibo != 0 && pool.index_count > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, pool.ibo);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, static_cast<GLsizeiptr>(pool.index_count) * sizeof(GLuint));
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glDeleteBuffers(1, &pool.vbo);
+	glDeleteBuffers(1, &pool.ibo);
+	pool.vbo = buffers[0];
+	pool.ibo = buffers[1];
+	pool.vertex_capacity = vertex_capacity;
+	pool.index_capacity = index_capacity;
+
+	// point the vao of the pool to the new buffers
+	glBindVertexArray(pool.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+	VertexFormat::SetAttributePointers(VertexFormat::GetLayout(pool.vertex_format));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.ibo);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+GeometryArena::Allocation GeometryArena::Allocate(unsigned int vertex_format, const void* vertex_data, unsigned int vertex_count, const GLuint* indices, unsigned int index_count)
+{
+	Pool& pool = findPool(vertex_format);
+
+	if (pool.vertex_count + vertex_count > pool.vertex_capacity || pool.index_count + index_count > pool.index_capacity)
+	{
+		unsigned int new_vertex_capacity = std::max(pool.vertex_capacity, pool.vertex_count + vertex_count);
+		unsigned int new_index_capacity = std::max(pool.index_capacity, pool.index_count + index_count);
+		// grow geometrically so that loading many meshes copies every byte a few times at most
+		if (new_vertex_capacity > pool.vertex_capacity) new_vertex_capacity = std::max(new_vertex_capacity, 2 * pool.vertex_capacity);
+		if (new_index_capacity > pool.index_capacity) new_index_capacity = std::max(new_index_capacity, 2 * pool.index_capacity);
+		growPool(pool, new_vertex_capacity, new_index_capacity);
+	}
+
+	Allocation allocation;
+	allocation.vao = pool.vao;
+	allocation.base_vertex = static_cast<GLint>(pool.vertex_count);
+	allocation.first_index = pool.index_count;
+	allocation.vertex_count = vertex_count;
+	allocation.index_count = index_count;
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(pool.vertex_count) * pool.stride, static_cast<GLsizeiptr>(vertex_count) * pool.stride, vertex_data);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// the element buffer is uploaded through the copy target, it is only bound to the element target inside the vao
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.ibo);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(pool.index_count) * sizeof(GLuint), static_cast<GLsizeiptr>(index_count) * sizeof(GLuint), indices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	pool.vertex_count += vertex_count;
+	pool.index_count += index_count;
+	return allocation;
+}
+
+void GeometryArena::PrintStatistics() const
+{
+	for (const Pool& pool : pools)
+	{
+		printf("Geometry arena pool (format %u, %d bytes per vertex): %u / %u vertices, %u / %u indices\n",
+			pool.vertex_format, pool.stride, pool.vertex_count, pool.vertex_capacity, pool.index_count, pool.index_capacity);
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include "GLEW\glew.h"
+#include <vector>
+
+/* Singleton Class of the Geometry Arena
+The vertices and indices of every mesh are sub-allocated from a few large shared buffers,
+one pool (vertex buffer + index buffer + vao) per vertex format, so that drawing the whole scene
+needs no vao switches. The meshes are addressed with a base vertex and a first index.
+The pools grow by copying into a larger buffer, the vao of a pool never changes.
+*/
+class GeometryArena
+{
+public:
+	struct Allocation
+	{
+		GLuint vao;
+		GLint base_vertex;
+		unsigned int first_index;
+		unsigned int vertex_count;
+		unsigned int index_count;
+	};
+
+	// get the static instance of Geometry Arena
+	static GeometryArena& GetInstance()
+	{
+		static GeometryArena arena;
+		return arena;
+	}
+	~GeometryArena();
+
+	// delete all pools
+	void Clear();
+
+	// copy the vertices (packed with the given VertexFormat flags) and the indices into the pool of the format
+	Allocation Allocate(unsigned int vertex_format, const void* vertex_data, unsigned int vertex_count, const GLuint* indices, unsigned int index_count);
+
+	// print the used / allocated memory of every pool
+	void PrintStatistics() const;
+
+protected:
+	struct Pool
+	{
+		unsigned int vertex_format;
+		GLsizei stride;
+		GLuint vao;
+		GLuint vbo;
+		GLuint ibo;
+		unsigned int vertex_capacity;
+		unsigned int vertex_count;
+		unsigned int index_capacity;
+		unsigned int index_count;
+	};
+	std::vector<Pool> pools;
+
+	// find or create the pool of the vertex format
+	Pool& findPool(unsigned int vertex_format);
+	// reallocate the buffers of the pool keeping their contents
+	void growPool(Pool& pool, unsigned int vertex_capacity, unsigned int index_capacity);
+
+	GeometryArena();
+	void operator=(GeometryArena const&);
+};
+
+#endif
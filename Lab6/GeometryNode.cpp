@@ -2,93 +2,133 @@
 #include "GeometricMesh.h"
 #include <glm/gtc/type_ptr.hpp>
 #include "TextureManager.h"
-
+#include "VertexFormat.h"
+#include "CookedMesh.h"
+#include "Culling.h"
+#include "MaterialTable.h"
+#include <cfloat>
+#include <algorithm>
 
 GeometryNode::GeometryNode()
 {
 	m_vao = 0;
-	m_vbo_positions = 0;
-	m_vbo_normals = 0;
-	m_vbo_texcoords = 0;
+	m_base_vertex = 0;
+	m_vertex_format = 0;
+	m_dequantization_matrix = glm::mat4(1.0f);
+	m_bounds_min = m_bounds_max = glm::vec3(0.0f);
+	m_bounding_sphere = glm::vec4(0.0f);
+	m_lod_count = 1;
+	for (int level = 0; level < MeshSimplifier::MAX_LEVELS; level++)
+		m_lod_errors[level] = 0.0f;
+	m_load_state = PENDING;
 }
 
 GeometryNode::~GeometryNode()
 {
-	// delete buffers
-	glDeleteVertexArrays(1, &m_vao);
-	glDeleteBuffers(1, &m_vbo_positions);
-	glDeleteBuffers(1, &m_vbo_normals);
-	glDeleteBuffers(1, &m_vbo_texcoords);
+	// the buffers belong to the GeometryArena
 }
 
 void GeometryNode::Init(GeometricMesh* mesh)
 {
-	glGenVertexArrays(1, &m_vao);
-	glBindVertexArray(m_vao);
-
-	glGenBuffers(1, &m_vbo_positions);
-	glBindBuffer(GL_ARRAY_BUFFER, m_vbo_positions);
-	glBufferData(GL_ARRAY_BUFFER, mesh->vertices.size() * sizeof(glm::vec3), &mesh->vertices[0], GL_STATIC_DRAW);
+	// interleaved and quantized vertices, the positions are dequantized through the model matrix
+	std::vector<unsigned char> vertex_data;
+	unsigned int vertex_format = VertexFormat::ChooseFlags(mesh);
+	glm::mat4 dequantization_matrix = VertexFormat::Pack(mesh, vertex_format, vertex_data);
+	VertexFormat::Layout layout = VertexFormat::GetLayout(vertex_format);
+	printf("Vertex buffer: %zu vertices x %d bytes = %zu bytes (%zu bytes as separate float streams)\n",
+		mesh->vertices.size(), layout.stride, vertex_data.size(), mesh->vertices.size() * (2 * sizeof(glm::vec3) + sizeof(glm::vec2)));
 
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(
-		0,				// attribute index
-		3,              // number of elements per vertex, here (x,y,z)
-		GL_FLOAT,       // the type of each element
-		GL_FALSE,       // take our values as-is
-		0,		         // no extra data between each position
-		0				// pointer to the C array or an offset to our buffer
-	);
+	glm::vec3 bounds_min(FLT_MAX);
+	glm::vec3 bounds_max(-FLT_MAX);
+	for (const glm::vec3& position : mesh->vertices)
+	{
+		bounds_min = glm::min(bounds_min, position);
+		bounds_max = glm::max(bounds_max, position);
+	}
 
-	glGenBuffers(1, &m_vbo_normals);
-	glBindBuffer(GL_ARRAY_BUFFER, m_vbo_normals);
-	glBufferData(GL_ARRAY_BUFFER, mesh->normals.size() * sizeof(glm::vec3), &mesh->normals[0], GL_STATIC_DRAW);
+	initGeometry(vertex_format, dequantization_matrix, bounds_min, bounds_max, vertex_data.data(),
+		static_cast<unsigned int>(mesh->vertices.size()), mesh->indices.data(), static_cast<unsigned int>(mesh->indices.size()));
 
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(
-		1,				// attribute index
-		3,              // number of elements per vertex, here (x,y,z)
-		GL_FLOAT,		// the type of each element
-		GL_FALSE,       // take our values as-is
-		0,		         // no extra data between each position
-		0				// pointer to the C array or an offset to our buffer
-	);
+	m_lod_count = static_cast<unsigned int>(std::min<size_t>(mesh->lod_errors.size() + 1, MeshSimplifier::MAX_LEVELS));
+	for (unsigned int level = 1; level < m_lod_count; level++)
+		m_lod_errors[level] = mesh->lod_errors[level - 1];
 
-	if (!mesh->textureCoord.empty())
+	for (int i = 0; i < mesh->objects.size(); i++)
 	{
-		glGenBuffers(1, &m_vbo_texcoords);
-		glBindBuffer(GL_ARRAY_BUFFER, m_vbo_texcoords);
-		glBufferData(GL_ARRAY_BUFFER, mesh->textureCoord.size() * sizeof(glm::vec2), &mesh->textureCoord[0], GL_STATIC_DRAW);
-
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(
-			2,				// attribute index
-			2,              // number of elements per vertex, here (x,y,z)
-			GL_FLOAT,		// the type of each element
-			GL_FALSE,       // take our values as-is
-			0,		         // no extra data between each position
-			0				// pointer to the C array or an offset to our buffer
-		);
+		const GeometricMesh::MeshObject& object = mesh->objects[i];
+		unsigned int start[MeshSimplifier::MAX_LEVELS] = { object.start };
+		unsigned int count[MeshSimplifier::MAX_LEVELS] = { object.end - object.start };
+		for (unsigned int level = 1; level < m_lod_count; level++)
+		{
+			start[level] = object.lods[level - 1].start;
+			count[level] = object.lods[level - 1].end - object.lods[level - 1].start;
+		}
+		auto material = mesh->materials[object.material_id];
+		addPart(start, count, object.bounds_min, object.bounds_max,
+			material.diffuse, material.specular, material.shininess, material.texture.c_str());
 	}
+	m_load_state = READY;
+}
 
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
+void GeometryNode::Init(const CookedMesh& cooked)
+{
+	// the streams are uploaded straight from the mapped file
+	const CookedMesh::Header& header = cooked.GetHeader();
+	initGeometry(header.vertex_format, cooked.GetDequantizationMatrix(), cooked.GetBoundsMin(), cooked.GetBoundsMax(),
+		cooked.GetVertexData(), header.vertex_count, cooked.GetIndices(), header.index_count);
 
-	// *********************************************************************
+	m_lod_count = header.lod_count;
+	for (unsigned int level = 0; level < m_lod_count; level++)
+		m_lod_errors[level] = header.lod_errors[level];
 
-	for (int i = 0; i < mesh->objects.size(); i++)
+	const CookedMesh::Part* cooked_parts = cooked.GetParts();
+	const CookedMesh::Material* materials = cooked.GetMaterials();
+	for (unsigned int i = 0; i < header.part_count; i++)
 	{
-		Objects part;
-		part.start_offset = mesh->objects[i].start;
-		part.count = mesh->objects[i].end - mesh->objects[i].start;
-		auto material = mesh->materials[mesh->objects[i].material_id];
-		
-		part.diffuseColor = glm::vec4(material.diffuse[0], material.diffuse[1], material.diffuse[2], 1.0);
-		part.specularColor = glm::vec3(material.specular[0], material.specular[1], material.specular[2]);
-		part.shininess = material.shininess;
-		part.textureID = (material.texture.empty())? 0 : TextureManager::GetInstance().RequestTexture(material.texture.c_str());
+		const CookedMesh::Part& part = cooked_parts[i];
+		const CookedMesh::Material& material = materials[part.material];
+		addPart(part.start, part.count, glm::vec3(part.bounds_min[0], part.bounds_min[1], part.bounds_min[2]),
+			glm::vec3(part.bounds_max[0], part.bounds_max[1], part.bounds_max[2]), material.diffuse, material.specular, material.shininess, material.texture);
+	}
+	m_load_state = READY;
+}
+
+void GeometryNode::initGeometry(unsigned int vertex_format, const glm::mat4& dequantization_matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+	const void* vertex_data, unsigned int vertex_count, const GLuint* indices, unsigned int index_count)
+{
+	m_vertex_format = vertex_format;
+	m_dequantization_matrix = dequantization_matrix;
+	m_bounds_min = bounds_min;
+	m_bounds_max = bounds_max;
+	m_bounding_sphere = Culling::SphereFromAABB(bounds_min, bounds_max);
+
+	// sub-allocate the vertices and indices from the shared buffers of the vertex format
+	m_allocation = GeometryArena::GetInstance().Allocate(vertex_format, vertex_data, vertex_count, indices, index_count);
+	m_vao = m_allocation.vao;
+	m_base_vertex = m_allocation.base_vertex;
+}
 
-		parts.push_back(part);
+void GeometryNode::addPart(const unsigned int* start, const unsigned int* count, const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+	const float* diffuse, const float* specular, float shininess, const char* texture)
+{
+	Objects part;
+	for (unsigned int level = 0; level < MeshSimplifier::MAX_LEVELS; level++)
+	{
+		// the levels past m_lod_count repeat the coarsest one
+		unsigned int source = std::min(level, m_lod_count - 1);
+		part.lods[level].start_offset = m_allocation.first_index + start[source];
+		part.lods[level].count = count[source];
 	}
-}
\ No newline at end of file
+	part.diffuseColor = glm::vec3(diffuse[0], diffuse[1], diffuse[2]);
+	part.specularColor = glm::vec3(specular[0], specular[1], specular[2]);
+	part.shininess = shininess;
+	part.texture_filename = texture;
+	part.textureID = 0;
+	part.texture_layer = -1;
+	part.material_index = MaterialTable::GetInstance().Add(part.diffuseColor, part.specularColor, part.shininess, part.texture_filename);
+	part.bounds_min = bounds_min;
+	part.bounds_max = bounds_max;
+	part.bounding_sphere = Culling::SphereFromAABB(bounds_min, bounds_max);
+
+	parts.push_back(part);
+}
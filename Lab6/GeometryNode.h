@@ -2,9 +2,13 @@
 #define GEOMETRY_NODE_H
 
 #include <vector>
+#include <string>
 #include "GLEW\glew.h"
 #include <unordered_map>
 #include "glm\gtx\hash.hpp"
+#include "GeometryArena.h"
+#include "TextureManager.h"
+#include "MeshSimplifier.h"
 
 class GeometryNode
 {
@@ -13,22 +17,74 @@ public:
 	~GeometryNode();
 
 	void Init(class GeometricMesh* mesh);
+	// initialize from a mapped mesh cache
+	void Init(const class CookedMesh& cooked);
+
+	// a node is drawn once one of the Init functions has run (see AssetLoader)
+	enum LOAD_STATE
+	{
+		PENDING,
+		READY,
+		FAILED,
+	};
+	LOAD_STATE GetLoadState() const { return m_load_state; }
+	bool IsReady() const { return m_load_state == READY; }
+	void SetLoadFailed() { m_load_state = FAILED; }
 
 	struct Objects
 	{
-		unsigned int start_offset;
-		unsigned int count;
+		// first index (in the arena index buffer) and number of indices of every level of detail of the part
+		struct Lod
+		{
+			unsigned int start_offset;
+			unsigned int count;
+		};
+		Lod lods[MeshSimplifier::MAX_LEVELS];
 		glm::vec3 diffuseColor;
 		glm::vec3 specularColor;
 		float shininess;
+		// diffuse texture of the material, it is packed with the other textures of the same size and format
+		// by Renderer (see TextureManager::RequestTextureArraysAsync)
+		std::string texture_filename;
+		// keeps the GL_TEXTURE_2D_ARRAY alive in the TextureManager, textureID is its GL id
+		TextureHandle texture;
 		GLuint textureID;
+		// layer of the texture in the array, -1 without a texture
+		int texture_layer;
+		// index of the material in the MaterialTable, also sorts the draws
+		unsigned int material_index;
+		// model space bounds and their bounding sphere (xyz: center, w: radius), used for culling
+		glm::vec3 bounds_min;
+		glm::vec3 bounds_max;
+		glm::vec4 bounding_sphere;
 	};
 	std::vector<Objects> parts;
 
+	// vao of the GeometryArena pool that holds the vertices
 	GLuint m_vao;
-	GLuint m_vbo_positions;
-	GLuint m_vbo_normals;
-	GLuint m_vbo_texcoords;
+	// added to every index of the node
+	GLint m_base_vertex;
+	// flags of the interleaved vertices, see VertexFormat
+	unsigned int m_vertex_format;
+	// maps the quantized positions to model space, multiplied into the model matrix
+	glm::mat4 m_dequantization_matrix;
+	// model space bounds
+	glm::vec3 m_bounds_min;
+	glm::vec3 m_bounds_max;
+	glm::vec4 m_bounding_sphere;
+	// levels of detail of the parts and their geometric error in model units (level 0 is the full detail one)
+	unsigned int m_lod_count;
+	float m_lod_errors[MeshSimplifier::MAX_LEVELS];
+
+private:
+	GeometryArena::Allocation m_allocation;
+	LOAD_STATE m_load_state;
+
+	void initGeometry(unsigned int vertex_format, const glm::mat4& dequantization_matrix, const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+		const void* vertex_data, unsigned int vertex_count, const GLuint* indices, unsigned int index_count);
+	// start and count hold the range of each of the m_lod_count levels
+	void addPart(const unsigned int* start, const unsigned int* count, const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+		const float* diffuse, const float* specular, float shininess, const char* texture);
 };
 
 #endif
\ No newline at end of file
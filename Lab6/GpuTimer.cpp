@@ -0,0 +1,108 @@
+#include "GpuTimer.h"
+#include "SDL2\SDL.h"
+#include <algorithm>
+
+GpuTimer::GpuTimer()
+{
+	section_count = 0;
+	current = -1;
+	oldest = 0;
+	open_section = -1;
+}
+
+GpuTimer::~GpuTimer()
+{
+	Destroy();
+}
+
+void GpuTimer::Init(int section_count)
+{
+	Destroy();
+	this->section_count = section_count;
+	for (Frame& frame : frames)
+	{
+		frame.queries.resize(section_count);
+		frame.issued.assign(section_count, 0);
+		glGenQueries(section_count, frame.queries.data());
+		frame.tag = 0;
+		frame.pending = false;
+	}
+	current = -1;
+	oldest = 0;
+	open_section = -1;
+}
+
+void GpuTimer::Destroy()
+{
+	for (Frame& frame : frames)
+	{
+		if (!frame.queries.empty())
+			glDeleteQueries(static_cast<GLsizei>(frame.queries.size()), frame.queries.data());
+		frame.queries.clear();
+		frame.issued.clear();
+		frame.pending = false;
+	}
+	section_count = 0;
+}
+
+void GpuTimer::BeginFrame(unsigned int tag)
+{
+	if (section_count == 0) return;
+	current = (current + 1) % LATENCY;
+	Frame& frame = frames[current];
+	// the results of a frame that was never read are dropped
+	if (frame.pending && oldest == current)
+		oldest = (oldest + 1) % LATENCY;
+	frame.tag = tag;
+	frame.pending = true;
+	std::fill(frame.issued.begin(), frame.issued.end(), 0);
+}
+
+void GpuTimer::Begin(int section)
+{
+	if (current < 0) return;
+	SDL_assert(open_section < 0);
+	glBeginQuery(GL_TIME_ELAPSED, frames[current].queries[section]);
+	frames[current].issued[section] = 1;
+	open_section = section;
+}
+
+void GpuTimer::End(int section)
+{
+	if (current < 0) return;
+	// a mismatch would book the time to the wrong section
+	SDL_assert(open_section == section);
+	glEndQuery(GL_TIME_ELAPSED);
+	open_section = -1;
+}
+
+bool GpuTimer::Resolve(unsigned int& tag, std::vector<float>& milliseconds)
+{
+	if (section_count == 0) return false;
+	Frame& frame = frames[oldest];
+	// the frame being recorded is never complete
+	if (!frame.pending || oldest == current)
+		return false;
+
+	for (int i = 0; i < section_count; i++)
+	{
+		if (!frame.issued[i]) continue;
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return false;
+	}
+
+	milliseconds.assign(section_count, 0.0f);
+	for (int i = 0; i < section_count; i++)
+	{
+		if (!frame.issued[i]) continue;
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &nanoseconds);
+		milliseconds[i] = static_cast<float>(nanoseconds * 1e-6);
+	}
+	tag = frame.tag;
+	frame.pending = false;
+	oldest = (oldest + 1) % LATENCY;
+	return true;
+}
@@ -0,0 +1,54 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <vector>
+#include "GLEW\glew.h"
+
+/* GPU time of the sections of a frame (GL_TIME_ELAPSED queries)
+Every frame gets its own set of queries and its results are read LATENCY frames later,
+so that waiting for the results never stalls the pipeline. A frame carries a tag
+(e.g. the technique it used) so that the caller can sort the results when they arrive.
+The sections can't overlap, only one GL_TIME_ELAPSED query may be active at a time.
+*/
+class GpuTimer
+{
+public:
+	static const int LATENCY = 4;
+
+	GpuTimer();
+	~GpuTimer();
+
+	void Init(int section_count);
+	void Destroy();
+
+	// start the queries of a new frame
+	void BeginFrame(unsigned int tag);
+	// time a section of the current frame, End must close the section opened by the last Begin
+	void Begin(int section);
+	void End(int section);
+
+	// the oldest frame whose results are available, times in milliseconds (0 for the sections it skipped).
+	// Returns false if there is none
+	bool Resolve(unsigned int& tag, std::vector<float>& milliseconds);
+
+private:
+	struct Frame
+	{
+		std::vector<GLuint> queries;
+		std::vector<unsigned char> issued;
+		unsigned int tag;
+		bool pending;
+	};
+	Frame frames[LATENCY];
+	int section_count;
+	// frame being recorded and oldest pending one
+	int current;
+	int oldest;
+	// section of the active query, -1 if none
+	int open_section;
+
+	GpuTimer(const GpuTimer&);
+	void operator=(const GpuTimer&);
+};
+
+#endif
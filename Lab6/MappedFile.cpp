@@ -0,0 +1,201 @@
+#include "MappedFile.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	data = nullptr;
+	size = 0;
+	writable = false;
+#ifdef _WIN32
+	file_handle = INVALID_HANDLE_VALUE;
+	mapping_handle = NULL;
+#else
+	file_descriptor = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+
+	file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	// empty files can not be mapped
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping_handle == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	data = static_cast<const unsigned char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr)
+	{
+		Close();
+		return false;
+	}
+	size = static_cast<size_t>(file_size.QuadPart);
+	return true;
+}
+
+bool MappedFile::Create(const char* filename, size_t file_size)
+{
+	Close();
+	if (file_size == 0)
+		return false;
+
+	file_handle = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	// the mapping extends the file to its size, the new pages are zero
+	LARGE_INTEGER mapping_size;
+	mapping_size.QuadPart = static_cast<LONGLONG>(file_size);
+	mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READWRITE, mapping_size.HighPart, mapping_size.LowPart, NULL);
+	if (mapping_handle == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	data = static_cast<const unsigned char*>(MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, 0));
+	if (data == nullptr)
+	{
+		Close();
+		return false;
+	}
+	size = file_size;
+	writable = true;
+	return true;
+}
+
+void MappedFile::Discard(size_t offset, size_t length)
+{
+	if (data == nullptr || offset >= size) return;
+	// unlocking pages that are not locked removes them from the working set
+	VirtualUnlock(const_cast<unsigned char*>(data) + offset, std::min(length, size - offset));
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr) UnmapViewOfFile(data);
+	if (mapping_handle != NULL) CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+	data = nullptr;
+	size = 0;
+	writable = false;
+	mapping_handle = NULL;
+	file_handle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+
+	file_descriptor = open(filename, O_RDONLY);
+	if (file_descriptor < 0)
+		return false;
+
+	struct stat file_stat;
+	// empty files can not be mapped
+	if (fstat(file_descriptor, &file_stat) != 0 || file_stat.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	madvise(mapping, static_cast<size_t>(file_stat.st_size), MADV_SEQUENTIAL);
+
+	data = static_cast<const unsigned char*>(mapping);
+	size = static_cast<size_t>(file_stat.st_size);
+	return true;
+}
+
+bool MappedFile::Create(const char* filename, size_t file_size)
+{
+	Close();
+	if (file_size == 0)
+		return false;
+
+	file_descriptor = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file_descriptor < 0)
+		return false;
+
+	// the new pages of the file are zero
+	if (ftruncate(file_descriptor, static_cast<off_t>(file_size)) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	data = static_cast<const unsigned char*>(mapping);
+	size = file_size;
+	writable = true;
+	return true;
+}
+
+void MappedFile::Discard(size_t offset, size_t length)
+{
+	if (data == nullptr || offset >= size) return;
+	// only whole pages can be dropped
+	const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t begin = (offset + page_size - 1) / page_size * page_size;
+	size_t end = std::min(offset + length, size) / page_size * page_size;
+	// the written pages of a created file are flushed to the file first
+	if (begin < end && writable) msync(const_cast<unsigned char*>(data) + begin, end - begin, MS_SYNC);
+	if (begin < end) madvise(const_cast<unsigned char*>(data) + begin, end - begin, MADV_DONTNEED);
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr) munmap(const_cast<unsigned char*>(data), size);
+	if (file_descriptor >= 0) close(file_descriptor);
+	data = nullptr;
+	size = 0;
+	writable = false;
+	file_descriptor = -1;
+}
+
+#endif
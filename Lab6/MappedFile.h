@@ -0,0 +1,46 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+/* Memory mapping of a whole file
+Uses file mappings on Windows and mmap on POSIX systems.
+Open maps an existing file read only, Create makes a new zero filled file of a fixed size mapped read / write
+(used for temporary tables that should be paged to disk instead of kept in memory).
+The data stay valid until Close() or the destruction of the object.
+*/
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const char* filename);
+	bool Create(const char* filename, size_t file_size);
+	void Close();
+
+	// drop the pages of a range that will not be read again from the working set, the data stay valid
+	void Discard(size_t offset, size_t length);
+
+	bool IsOpen() const { return data != nullptr; }
+	const unsigned char* GetData() const { return data; }
+	// null unless the file was created
+	unsigned char* GetWritableData() const { return (writable) ? const_cast<unsigned char*>(data) : nullptr; }
+	size_t GetSize() const { return size; }
+
+private:
+	const unsigned char* data;
+	size_t size;
+	bool writable;
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#else
+	int file_descriptor;
+#endif
+
+	MappedFile(const MappedFile&);
+	void operator=(const MappedFile&);
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "MaterialTable.h"
+#include <cstdio>
+
+MaterialTable::MaterialTable()
+{
+	buffer = 0;
+	Clear();
+}
+
+MaterialTable::~MaterialTable()
+{
+	if (buffer != 0)
+		glDeleteBuffers(1, &buffer);
+}
+
+void MaterialTable::Clear()
+{
+	if (buffer != 0)
+		glDeleteBuffers(1, &buffer);
+	buffer = 0;
+	lookup.clear();
+	entries.clear();
+
+	Entry default_material;
+	default_material.diffuse = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+	default_material.specular = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	entries.push_back(default_material);
+	dirty = true;
+}
+
+unsigned int MaterialTable::Add(const glm::vec3& diffuse, const glm::vec3& specular, float shininess, const std::string& texture)
+{
+	// the exact values are the key, the parts of a mesh share their material
+	float values[7] = { diffuse.r, diffuse.g, diffuse.b, specular.r, specular.g, specular.b, shininess };
+	std::string key(reinterpret_cast<const char*>(values), sizeof(values));
+	key += texture;
+	auto it = lookup.find(key);
+	if (it != lookup.end())
+		return it->second;
+
+	if (entries.size() >= MAX_MATERIALS)
+	{
+		printf("MaterialTable: more than %u materials, using the default one\n", MAX_MATERIALS);
+		return 0;
+	}
+
+	Entry entry;
+	entry.diffuse = glm::vec4(diffuse, 0.0f);
+	entry.specular = glm::vec4(specular, shininess);
+	entries.push_back(entry);
+	unsigned int index = static_cast<unsigned int>(entries.size()) - 1;
+	lookup[key] = index;
+	dirty = true;
+	return index;
+}
+
+void MaterialTable::SetTextureLayer(unsigned int index, int layer)
+{
+	float value = static_cast<float>(layer + 1);
+	if (index == 0 || entries[index].diffuse.a == value)
+		return;
+	entries[index].diffuse.a = value;
+	dirty = true;
+}
+
+void MaterialTable::Update()
+{
+	if (buffer == 0)
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * sizeof(Entry), NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, buffer);
+		dirty = true;
+	}
+	if (!dirty)
+		return;
+
+	// the table only changes while the meshes and textures load
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, entries.size() * sizeof(Entry), entries.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	dirty = false;
+}
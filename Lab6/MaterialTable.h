@@ -0,0 +1,61 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include "GLEW\glew.h"
+#include "glm\glm.hpp"
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+/* Singleton Class of the Material Table
+Every distinct material of the loaded parts (colors, shininess and diffuse texture) is stored once in a
+uniform buffer, so the draws only pass the index of their material (see GeometryNode::Objects::material_index).
+Entry 0 is a default white material, it is also given out when the table is full.
+*/
+class MaterialTable
+{
+public:
+	// 16 KB, the smallest GL_MAX_UNIFORM_BLOCK_SIZE (same value in basic_shadowed_rendering.vert)
+	static const unsigned int MAX_MATERIALS = 512;
+	// uniform buffer binding point of the table
+	static const GLuint BINDING = 0;
+
+	// get the static instance of Material Table
+	static MaterialTable& GetInstance()
+	{
+		static MaterialTable table;
+		return table;
+	}
+	~MaterialTable();
+
+	// find or add the material, returns its index
+	unsigned int Add(const glm::vec3& diffuse, const glm::vec3& specular, float shininess, const std::string& texture);
+	// the layer of the texture array of the material, once its texture is packed
+	void SetTextureLayer(unsigned int index, int layer);
+	// upload the table if it changed and bind it to BINDING
+	void Update();
+	// delete the buffer and the materials
+	void Clear();
+
+	unsigned int GetCount() const { return static_cast<unsigned int>(entries.size()); }
+
+protected:
+	// std140 layout of the entries
+	struct Entry
+	{
+		// rgb: diffuse color, a: texture layer + 1 (0 without a texture)
+		glm::vec4 diffuse;
+		// rgb: specular color, a: shininess
+		glm::vec4 specular;
+	};
+	std::vector<Entry> entries;
+	// the values of a material and its texture filename -> index
+	std::unordered_map<std::string, unsigned int> lookup;
+	GLuint buffer;
+	bool dirty;
+
+	MaterialTable();
+	void operator=(MaterialTable const&);
+};
+
+#endif
@@ -0,0 +1,349 @@
+#include "MeshOptimizer.h"
+#include "GeometricMesh.h"
+#include <algorithm>
+#include <cstdio>
+#include <cfloat>
+
+// clusters with less triangles are merged with the previous one before the overdraw sort
+#define MIN_CLUSTER_TRIANGLES 32
+// resolution of the overdraw rasterizer
+#define OVERDRAW_RESOLUTION 256
+
+namespace MeshOptimizer
+{
+	void Optimize(GeometricMesh* mesh, bool sort_for_overdraw)
+	{
+		if (mesh->indices.empty()) return;
+
+		unsigned int vertex_count = static_cast<unsigned int>(mesh->vertices.size());
+		float acmr_before = ComputeACMR(mesh->indices, vertex_count, CACHE_SIZE);
+		float overdraw_before = ComputeOverdraw(mesh->indices, mesh->vertices);
+
+		std::vector<unsigned int> clusters;
+		for (const GeometricMesh::MeshObject& object : mesh->objects)
+		{
+			unsigned int first = object.start / 3;
+			unsigned int count = (object.end - object.start) / 3;
+			OptimizeVertexCache(mesh->indices, first, count, vertex_count, CACHE_SIZE, &clusters);
+			if (sort_for_overdraw)
+				OptimizeOverdraw(mesh->indices, first, count, mesh->vertices, clusters);
+		}
+		OptimizeVertexFetch(mesh);
+
+		vertex_count = static_cast<unsigned int>(mesh->vertices.size());
+		float acmr_after = ComputeACMR(mesh->indices, vertex_count, CACHE_SIZE);
+		float overdraw_after = ComputeOverdraw(mesh->indices, mesh->vertices);
+
+		printf("Mesh optimization: ACMR %.3f -> %.3f, overdraw %.3f -> %.3f\n", acmr_before, acmr_after, overdraw_before, overdraw_after);
+	}
+
+	void OptimizeVertexCache(std::vector<unsigned int>& indices, unsigned int first, unsigned int count, unsigned int vertex_count, int cache_size, std::vector<unsigned int>* clusters)
+	{
+		if (clusters) clusters->clear();
+		if (count == 0) return;
+
+		const unsigned int* triangles = &indices[first * 3];
+
+		// vertex -> triangles adjacency of the range
+		std::vector<unsigned int> live(vertex_count, 0);
+		for (unsigned int i = 0; i < count * 3; i++)
+			live[triangles[i]]++;
+
+		std::vector<unsigned int> adjacency_offset(vertex_count + 1, 0);
+		for (unsigned int v = 0; v < vertex_count; v++)
+			adjacency_offset[v + 1] = adjacency_offset[v] + live[v];
+		std::vector<unsigned int> adjacency(count * 3);
+		{
+			std::vector<unsigned int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+			for (unsigned int t = 0; t < count; t++)
+				for (int j = 0; j < 3; j++)
+					adjacency[fill[triangles[t * 3 + j]]++] = t;
+		}
+
+		// the vertices of the range in order of appearance, walked when there is a dead end
+		std::vector<unsigned int> range_vertices;
+		{
+			std::vector<bool> seen(vertex_count, false);
+			for (unsigned int i = 0; i < count * 3; i++)
+			{
+				if (seen[triangles[i]]) continue;
+				seen[triangles[i]] = true;
+				range_vertices.push_back(triangles[i]);
+			}
+		}
+
+		std::vector<unsigned int> cache_time(vertex_count, 0);
+		std::vector<bool> emitted(count, false);
+		std::vector<unsigned int> dead_end;
+		std::vector<unsigned int> candidates;
+		std::vector<unsigned int> output;
+		output.reserve(count * 3);
+
+		int fanning = static_cast<int>(range_vertices[0]);
+		unsigned int time = cache_size + 1;
+		unsigned int cursor = 1;
+		bool new_cluster = true;
+
+		while (fanning >= 0)
+		{
+			if (new_cluster && clusters)
+				clusters->push_back(static_cast<unsigned int>(output.size() / 3));
+			new_cluster = false;
+
+			// emit all the remaining triangles of the fanning vertex
+			candidates.clear();
+			for (unsigned int a = adjacency_offset[fanning]; a < adjacency_offset[fanning + 1]; a++)
+			{
+				unsigned int t = adjacency[a];
+				if (emitted[t]) continue;
+				for (int j = 0; j < 3; j++)
+				{
+					unsigned int v = triangles[t * 3 + j];
+					output.push_back(v);
+					dead_end.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+					if (time - cache_time[v] > static_cast<unsigned int>(cache_size))
+					{
+						cache_time[v] = time;
+						time++;
+					}
+				}
+				emitted[t] = true;
+			}
+
+			// the next fanning vertex is the candidate that stays longest in the cache
+			int best = -1;
+			int best_priority = -1;
+			for (unsigned int v : candidates)
+			{
+				if (live[v] == 0) continue;
+				int priority = 0;
+				if (time - cache_time[v] + 2 * live[v] <= static_cast<unsigned int>(cache_size))
+					priority = time - cache_time[v];
+				if (priority > best_priority)
+				{
+					best = v;
+					best_priority = priority;
+				}
+			}
+
+			if (best == -1)
+			{
+				// dead end, the cache is effectively flushed so a new cluster starts here
+				new_cluster = true;
+				while (!dead_end.empty() && best == -1)
+				{
+					unsigned int v = dead_end.back();
+					dead_end.pop_back();
+					if (live[v] > 0) best = v;
+				}
+				while (best == -1 && cursor < range_vertices.size())
+				{
+					if (live[range_vertices[cursor]] > 0) best = range_vertices[cursor];
+					cursor++;
+				}
+			}
+			fanning = best;
+		}
+
+		std::copy(output.begin(), output.end(), indices.begin() + first * 3);
+	}
+
+	void OptimizeOverdraw(std::vector<unsigned int>& indices, unsigned int first, unsigned int count, const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& clusters)
+	{
+		if (count == 0 || clusters.size() < 2) return;
+
+		// merge the small clusters so that the sort does not destroy the cache locality
+		std::vector<unsigned int> merged(1, clusters[0]);
+		for (unsigned int c = 1; c < clusters.size(); c++)
+		{
+			if (clusters[c] - merged.back() >= MIN_CLUSTER_TRIANGLES)
+				merged.push_back(clusters[c]);
+		}
+		if (merged.size() < 2) return;
+
+		const unsigned int* triangles = &indices[first * 3];
+
+		// area weighted centroid and normal of every cluster and of the whole range
+		struct Cluster
+		{
+			unsigned int start;
+			unsigned int end;
+			float sort_key;
+		};
+		std::vector<Cluster> sorted(merged.size());
+		std::vector<glm::vec3> centroids(merged.size());
+		std::vector<glm::vec3> normals(merged.size());
+		glm::vec3 range_centroid(0.0f);
+		float range_area = 0.0f;
+
+		for (unsigned int c = 0; c < merged.size(); c++)
+		{
+			sorted[c].start = merged[c];
+			sorted[c].end = (c + 1 < merged.size()) ? merged[c + 1] : count;
+
+			glm::vec3 centroid(0.0f);
+			glm::vec3 normal(0.0f);
+			float area = 0.0f;
+			for (unsigned int t = sorted[c].start; t < sorted[c].end; t++)
+			{
+				const glm::vec3& a = positions[triangles[t * 3 + 0]];
+				const glm::vec3& b = positions[triangles[t * 3 + 1]];
+				const glm::vec3& p = positions[triangles[t * 3 + 2]];
+				glm::vec3 n = glm::cross(b - a, p - a);
+				float triangle_area = glm::length(n);
+				centroid += (a + b + p) * (triangle_area / 3.0f);
+				normal += n;
+				area += triangle_area;
+			}
+			range_centroid += centroid;
+			range_area += area;
+			centroids[c] = (area > 0.0f) ? centroid / area : positions[triangles[sorted[c].start * 3]];
+			float length = glm::length(normal);
+			normals[c] = (length > 0.0f) ? normal / length : glm::vec3(0.0f);
+		}
+		if (range_area > 0.0f) range_centroid /= range_area;
+
+		// clusters far from the center and facing outwards occlude the rest, draw them first
+		for (unsigned int c = 0; c < merged.size(); c++)
+			sorted[c].sort_key = glm::dot(centroids[c] - range_centroid, normals[c]);
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) { return a.sort_key > b.sort_key; });
+
+		std::vector<unsigned int> output;
+		output.reserve(count * 3);
+		for (const Cluster& cluster : sorted)
+			output.insert(output.end(), triangles + cluster.start * 3, triangles + cluster.end * 3);
+		std::copy(output.begin(), output.end(), indices.begin() + first * 3);
+	}
+
+	void OptimizeVertexFetch(GeometricMesh* mesh)
+	{
+		const unsigned int unused = 0xFFFFFFFF;
+		std::vector<unsigned int> remap(mesh->vertices.size(), unused);
+		unsigned int next = 0;
+		for (unsigned int& index : mesh->indices)
+		{
+			if (remap[index] == unused) remap[index] = next++;
+			index = remap[index];
+		}
+
+		// scatter every attribute to its new position
+		auto reorder = [&remap, next](auto& attribute)
+		{
+			if (attribute.size() != remap.size()) return;
+			auto reordered = attribute;
+			reordered.resize(next);
+			for (unsigned int v = 0; v < remap.size(); v++)
+				if (remap[v] != unused) reordered[remap[v]] = attribute[v];
+			attribute.swap(reordered);
+		};
+		reorder(mesh->vertices);
+		reorder(mesh->normals);
+		reorder(mesh->textureCoord);
+		reorder(mesh->tangents);
+		reorder(mesh->bitangents);
+	}
+
+	float ComputeACMR(const std::vector<unsigned int>& indices, unsigned int vertex_count, int cache_size)
+	{
+		if (indices.empty()) return 0.0f;
+
+		// FIFO: a vertex is still in the cache if less than cache_size misses happened after its insertion
+		std::vector<unsigned int> inserted(vertex_count, 0);
+		unsigned int misses = 0;
+		for (unsigned int index : indices)
+		{
+			if (inserted[index] == 0 || misses - inserted[index] >= static_cast<unsigned int>(cache_size))
+			{
+				misses++;
+				inserted[index] = misses;
+			}
+		}
+		return misses / (indices.size() / 3.0f);
+	}
+
+	float ComputeOverdraw(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions)
+	{
+		if (indices.empty()) return 0.0f;
+
+		glm::vec3 min_position(FLT_MAX);
+		glm::vec3 max_position(-FLT_MAX);
+		for (const glm::vec3& p : positions)
+		{
+			min_position = glm::min(min_position, p);
+			max_position = glm::max(max_position, p);
+		}
+		glm::vec3 center = (min_position + max_position) * 0.5f;
+		float extent = glm::max(glm::max(max_position.x - min_position.x, max_position.y - min_position.y), max_position.z - min_position.z);
+		if (extent <= 0.0f) return 0.0f;
+		float scale = (OVERDRAW_RESOLUTION - 1) / extent;
+
+		const glm::vec3 directions[6] = {
+			glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0),
+			glm::vec3(0, 1, 0), glm::vec3(0, -1, 0),
+			glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+
+		std::vector<float> depth(OVERDRAW_RESOLUTION * OVERDRAW_RESOLUTION);
+		unsigned long long shaded = 0;
+		unsigned long long covered = 0;
+
+		for (const glm::vec3& forward : directions)
+		{
+			// right x up = -forward, so counter clockwise triangles have a positive area when front facing
+			glm::vec3 helper = (glm::abs(forward.y) < 0.5f) ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1);
+			glm::vec3 right = glm::normalize(glm::cross(forward, helper));
+			glm::vec3 up = glm::cross(-forward, right);
+
+			std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+			for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+			{
+				glm::vec3 screen[3];
+				for (int j = 0; j < 3; j++)
+				{
+					glm::vec3 p = positions[indices[i + j]] - center;
+					screen[j] = glm::vec3(
+						glm::dot(p, right) * scale + OVERDRAW_RESOLUTION * 0.5f,
+						glm::dot(p, up) * scale + OVERDRAW_RESOLUTION * 0.5f,
+						glm::dot(p, forward));
+				}
+
+				float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+				// back facing or degenerate
+				if (area <= 0.0f) continue;
+
+				int min_x = glm::max(0, static_cast<int>(glm::floor(glm::min(glm::min(screen[0].x, screen[1].x), screen[2].x))));
+				int max_x = glm::min(OVERDRAW_RESOLUTION - 1, static_cast<int>(glm::ceil(glm::max(glm::max(screen[0].x, screen[1].x), screen[2].x))));
+				int min_y = glm::max(0, static_cast<int>(glm::floor(glm::min(glm::min(screen[0].y, screen[1].y), screen[2].y))));
+				int max_y = glm::min(OVERDRAW_RESOLUTION - 1, static_cast<int>(glm::ceil(glm::max(glm::max(screen[0].y, screen[1].y), screen[2].y))));
+
+				for (int y = min_y; y <= max_y; y++)
+				{
+					for (int x = min_x; x <= max_x; x++)
+					{
+						// barycentrics of the pixel center
+						float px = x + 0.5f;
+						float py = y + 0.5f;
+						float w0 = (screen[2].x - screen[1].x) * (py - screen[1].y) - (screen[2].y - screen[1].y) * (px - screen[1].x);
+						float w1 = (screen[0].x - screen[2].x) * (py - screen[2].y) - (screen[0].y - screen[2].y) * (px - screen[2].x);
+						float w2 = (screen[1].x - screen[0].x) * (py - screen[0].y) - (screen[1].y - screen[0].y) * (px - screen[0].x);
+						if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) continue;
+
+						float z = (w0 * screen[0].z + w1 * screen[1].z + w2 * screen[2].z) / area;
+						float& stored = depth[y * OVERDRAW_RESOLUTION + x];
+						// early-z, only the fragments that pass the test are shaded
+						if (z < stored)
+						{
+							if (stored == FLT_MAX) covered++;
+							stored = z;
+							shaded++;
+						}
+					}
+				}
+			}
+		}
+
+		return (covered > 0) ? static_cast<float>(shaded) / covered : 0.0f;
+	}
+};
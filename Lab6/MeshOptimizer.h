@@ -0,0 +1,40 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <vector>
+#include "glm\glm.hpp"
+
+class GeometricMesh;
+
+/* Post load optimization of indexed meshes
+The triangles of every mesh object are reordered for the post-transform vertex cache (Tipsify),
+the clusters that Tipsify produces are optionally sorted so that the outer facing ones are drawn first (less overdraw)
+and finally the vertices are reordered in the order of first use for vertex fetch locality.
+The object ranges are kept, only the order inside every range changes.
+*/
+namespace MeshOptimizer
+{
+	// size of the simulated FIFO post-transform cache
+	const int CACHE_SIZE = 16;
+
+	// run all the stages on the mesh and print the ACMR / overdraw before and after
+	void Optimize(GeometricMesh* mesh, bool sort_for_overdraw = true);
+
+	// Tipsify on the triangles [first, first + count) of the index buffer.
+	// If clusters is not null it receives the first triangle of every cluster (relative to first)
+	void OptimizeVertexCache(std::vector<unsigned int>& indices, unsigned int first, unsigned int count, unsigned int vertex_count, int cache_size, std::vector<unsigned int>* clusters = nullptr);
+
+	// sort the clusters of the range by their orientation relative to the center of the range
+	void OptimizeOverdraw(std::vector<unsigned int>& indices, unsigned int first, unsigned int count, const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& clusters);
+
+	// reorder the vertex attributes in order of first use, unused vertices are removed
+	void OptimizeVertexFetch(GeometricMesh* mesh);
+
+	// average cache misses per triangle of a FIFO cache
+	float ComputeACMR(const std::vector<unsigned int>& indices, unsigned int vertex_count, int cache_size);
+
+	// shaded / covered pixels of a small software rasterizer over the 6 axis views
+	float ComputeOverdraw(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions);
+};
+
+#endif
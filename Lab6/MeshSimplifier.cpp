@@ -0,0 +1,388 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "GeometricMesh.h"
+#include <unordered_map>
+#include "glm\gtx\hash.hpp"
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <cfloat>
+
+#define NO_VERTEX 0xFFFFFFFFu
+// a collapse may not turn a triangle by more than this (cosine of the angle between the old and the new normal)
+#define MIN_NORMAL_COSINE 0.2f
+// error budget of the first level (fraction of the diagonal of the mesh), it doubles at every level
+#define LOD_ERROR_FRACTION 0.005f
+
+namespace
+{
+	// sum of the squared distances to a set of planes, weighted by the areas of their triangles
+	struct Quadric
+	{
+		double a00, a01, a02, a11, a12, a22;
+		double b0, b1, b2;
+		double c;
+		double weight;
+
+		void Add(const Quadric& other)
+		{
+			a00 += other.a00; a01 += other.a01; a02 += other.a02;
+			a11 += other.a11; a12 += other.a12; a22 += other.a22;
+			b0 += other.b0; b1 += other.b1; b2 += other.b2;
+			c += other.c;
+			weight += other.weight;
+		}
+
+		// mean squared distance of p to the planes
+		double Evaluate(const glm::vec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double error = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+				+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+			return (weight > 0.0) ? std::max(error, 0.0) / weight : 0.0;
+		}
+	};
+
+	Quadric planeQuadric(const glm::vec3& normal, float distance, float weight)
+	{
+		Quadric q;
+		double a = normal.x, b = normal.y, c = normal.z, d = distance;
+		q.a00 = weight * a * a; q.a01 = weight * a * b; q.a02 = weight * a * c;
+		q.a11 = weight * b * b; q.a12 = weight * b * c; q.a22 = weight * c * c;
+		q.b0 = weight * a * d; q.b1 = weight * b * d; q.b2 = weight * c * d;
+		q.c = weight * d * d;
+		q.weight = weight;
+		return q;
+	}
+
+	uint64_t edgeKey(unsigned int a, unsigned int b)
+	{
+		return (a < b) ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+	}
+
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		double cost;
+	};
+}
+
+namespace MeshSimplifier
+{
+	float Simplify(const std::vector<glm::vec3>& positions, const unsigned int* indices, unsigned int index_count, unsigned int target_index_count, float target_error, std::vector<unsigned int>& result)
+	{
+		result.assign(indices, indices + index_count);
+		if (index_count <= target_index_count)
+			return 0.0f;
+
+		// local ids of the vertices of the range
+		std::unordered_map<unsigned int, unsigned int> local_ids;
+		std::vector<unsigned int> vertices;
+		std::vector<unsigned int> triangles(index_count);
+		for (unsigned int i = 0; i < index_count; i++)
+		{
+			auto inserted = local_ids.emplace(indices[i], static_cast<unsigned int>(vertices.size()));
+			if (inserted.second)
+				vertices.push_back(indices[i]);
+			triangles[i] = inserted.first->second;
+		}
+		unsigned int vertex_count = static_cast<unsigned int>(vertices.size());
+
+		// the vertices with the same position (split by the attributes) form a group, the collapses are between groups
+		std::unordered_map<glm::vec3, unsigned int> group_ids;
+		std::vector<unsigned int> group(vertex_count);
+		std::vector<glm::vec3> group_positions;
+		for (unsigned int v = 0; v < vertex_count; v++)
+		{
+			auto inserted = group_ids.emplace(positions[vertices[v]], static_cast<unsigned int>(group_positions.size()));
+			if (inserted.second)
+				group_positions.push_back(positions[vertices[v]]);
+			group[v] = inserted.first->second;
+		}
+		unsigned int group_count = static_cast<unsigned int>(group_positions.size());
+
+		// the edges that do not have exactly two triangles are borders (or non-manifold), their vertices are locked
+		std::vector<unsigned char> locked(group_count, 0);
+		{
+			std::vector<uint64_t> edges;
+			edges.reserve(index_count);
+			for (unsigned int i = 0; i < index_count; i += 3)
+				for (int j = 0; j < 3; j++)
+				{
+					unsigned int a = group[triangles[i + j]], b = group[triangles[i + (j + 1) % 3]];
+					if (a != b) edges.push_back(edgeKey(a, b));
+				}
+			std::sort(edges.begin(), edges.end());
+			for (size_t i = 0; i < edges.size();)
+			{
+				size_t run = i + 1;
+				while (run < edges.size() && edges[run] == edges[i]) run++;
+				if (run - i != 2)
+				{
+					locked[edges[i] >> 32] = 1;
+					locked[edges[i] & 0xFFFFFFFFu] = 1;
+				}
+				i = run;
+			}
+		}
+
+		// planes of the triangles around every group
+		std::vector<Quadric> quadrics(group_count, planeQuadric(glm::vec3(0.0f), 0.0f, 0.0f));
+		for (unsigned int i = 0; i < index_count; i += 3)
+		{
+			const glm::vec3& p0 = group_positions[group[triangles[i]]];
+			glm::vec3 normal = glm::cross(group_positions[group[triangles[i + 1]]] - p0, group_positions[group[triangles[i + 2]]] - p0);
+			float length = glm::length(normal);
+			if (length == 0.0f) continue;
+			normal /= length;
+			Quadric q = planeQuadric(normal, -glm::dot(normal, p0), 0.5f * length);
+			for (int j = 0; j < 3; j++)
+				quadrics[group[triangles[i + j]]].Add(q);
+		}
+
+		std::vector<unsigned int> redirect(vertex_count);
+		std::iota(redirect.begin(), redirect.end(), 0u);
+		std::vector<unsigned int> mapping(vertex_count, NO_VERTEX);
+		std::vector<unsigned int> mapped_vertices;
+		std::vector<unsigned int> group_marks(group_count, 0);
+		unsigned int mark = 0;
+		std::vector<unsigned char> touched(group_count);
+		std::vector<unsigned int> adjacency_offset(group_count + 1);
+		std::vector<unsigned int> adjacency;
+		std::vector<uint64_t> edges;
+		std::vector<Collapse> collapses;
+		double max_error = 0.0;
+		double max_cost = static_cast<double>(target_error) * target_error;
+		bool limit_cost = true;
+
+		unsigned int target_triangle_count = target_index_count / 3;
+		while (triangles.size() / 3 > target_triangle_count)
+		{
+			unsigned int triangle_count = static_cast<unsigned int>(triangles.size() / 3);
+
+			// triangles around every group
+			std::fill(adjacency_offset.begin(), adjacency_offset.end(), 0u);
+			for (unsigned int v : triangles)
+				adjacency_offset[group[v] + 1]++;
+			std::partial_sum(adjacency_offset.begin(), adjacency_offset.end(), adjacency_offset.begin());
+			adjacency.resize(triangles.size());
+			{
+				std::vector<unsigned int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+				for (unsigned int i = 0; i < triangles.size(); i++)
+					adjacency[fill[group[triangles[i]]]++] = i / 3;
+			}
+
+			// the cheaper direction of every edge, a locked group never moves
+			edges.clear();
+			for (unsigned int i = 0; i < triangles.size(); i += 3)
+				for (int j = 0; j < 3; j++)
+				{
+					unsigned int a = group[triangles[i + j]], b = group[triangles[i + (j + 1) % 3]];
+					if (a != b) edges.push_back(edgeKey(a, b));
+				}
+			std::sort(edges.begin(), edges.end());
+			edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+			collapses.clear();
+			for (uint64_t edge : edges)
+			{
+				unsigned int a = static_cast<unsigned int>(edge >> 32), b = static_cast<unsigned int>(edge & 0xFFFFFFFFu);
+				if (locked[a] && locked[b]) continue;
+				Quadric q = quadrics[a];
+				q.Add(quadrics[b]);
+				Collapse collapse;
+				collapse.from = locked[a] ? b : a;
+				collapse.to = locked[a] ? a : b;
+				collapse.cost = q.Evaluate(group_positions[collapse.to]);
+				if (!locked[a] && !locked[b])
+				{
+					double reverse_cost = q.Evaluate(group_positions[a]);
+					if (reverse_cost < collapse.cost)
+					{
+						collapse.from = b;
+						collapse.to = a;
+						collapse.cost = reverse_cost;
+					}
+				}
+				collapses.push_back(collapse);
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+			// an interior collapse removes two triangles, the groups around a collapse wait for the next pass
+			unsigned int goal = (triangle_count - target_triangle_count) / 2 + 1;
+			if (collapses.empty())
+				break;
+			// the collapses skipped because of their neighbours are cheaper than the ones far down the list, they get the next pass
+			double cost_limit = (limit_cost) ? std::min(collapses[std::min<size_t>(goal, collapses.size()) - 1].cost * 1.5, max_cost) : max_cost;
+			unsigned int applied = 0;
+			std::fill(touched.begin(), touched.end(), 0);
+			for (const Collapse& collapse : collapses)
+			{
+				if (applied >= goal || collapse.cost > cost_limit) break;
+				if (touched[collapse.from] || touched[collapse.to]) continue;
+
+				bool valid = true;
+				const glm::vec3& target = group_positions[collapse.to];
+
+				// every used vertex of the group moves onto the vertex of the target it shares an edge with,
+				// a vertex without one (the other side of a seam that the edge is not on) can't move
+				mapped_vertices.clear();
+				for (unsigned int a = adjacency_offset[collapse.from]; a < adjacency_offset[collapse.from + 1] && valid; a++)
+				{
+					const unsigned int* triangle = &triangles[adjacency[a] * 3];
+					for (int j = 0; j < 3 && valid; j++)
+					{
+						if (group[triangle[j]] != collapse.from) continue;
+						unsigned int v = triangle[j];
+						if (mapping[v] == NO_VERTEX)
+						{
+							mapping[v] = v;
+							mapped_vertices.push_back(v);
+						}
+						for (int k = 0; k < 3; k++)
+						{
+							if (group[triangle[k]] != collapse.to) continue;
+							if (mapping[v] == v) mapping[v] = triangle[k];
+							else if (mapping[v] != triangle[k]) valid = false;
+						}
+					}
+				}
+				for (unsigned int v : mapped_vertices)
+					valid = valid && mapping[v] != v;
+
+				// no triangle may flip over or turn too much
+				for (unsigned int a = adjacency_offset[collapse.from]; a < adjacency_offset[collapse.from + 1] && valid; a++)
+				{
+					const unsigned int* triangle = &triangles[adjacency[a] * 3];
+					glm::vec3 p[3], q[3];
+					bool removed = false;
+					for (int j = 0; j < 3; j++)
+					{
+						p[j] = group_positions[group[triangle[j]]];
+						q[j] = (group[triangle[j]] == collapse.from) ? target : p[j];
+						removed = removed || group[triangle[j]] == collapse.to;
+					}
+					if (removed) continue;
+					glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+					glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+					if (glm::dot(n0, n1) < MIN_NORMAL_COSINE * glm::length(n0) * glm::length(n1))
+						valid = false;
+				}
+
+				// link condition, the edge may share only the two vertices opposite to it (else the surface pinches)
+				if (valid)
+				{
+					mark += 2;
+					for (unsigned int a = adjacency_offset[collapse.from]; a < adjacency_offset[collapse.from + 1]; a++)
+						for (int j = 0; j < 3; j++)
+							group_marks[group[triangles[adjacency[a] * 3 + j]]] = mark;
+					unsigned int shared = 0;
+					for (unsigned int a = adjacency_offset[collapse.to]; a < adjacency_offset[collapse.to + 1]; a++)
+						for (int j = 0; j < 3; j++)
+						{
+							unsigned int g = group[triangles[adjacency[a] * 3 + j]];
+							if (g == collapse.from || g == collapse.to || group_marks[g] != mark) continue;
+							group_marks[g] = mark + 1;
+							shared++;
+						}
+					valid = shared <= 2;
+				}
+
+				if (valid)
+				{
+					for (unsigned int v : mapped_vertices)
+						redirect[v] = mapping[v];
+					quadrics[collapse.to].Add(quadrics[collapse.from]);
+					for (unsigned int a = adjacency_offset[collapse.from]; a < adjacency_offset[collapse.from + 1]; a++)
+						for (int j = 0; j < 3; j++)
+							touched[group[triangles[adjacency[a] * 3 + j]]] = 1;
+					max_error = std::max(max_error, collapse.cost);
+					applied++;
+				}
+				for (unsigned int v : mapped_vertices)
+					mapping[v] = NO_VERTEX;
+			}
+			// when the valid collapses are all past the limit, the next pass takes them up to the error budget
+			if (applied == 0 && !limit_cost)
+				break;
+			limit_cost = applied > 0;
+			if (applied == 0)
+				continue;
+
+			// move the collapsed vertices and drop the triangles that became degenerate
+			size_t written = 0;
+			for (size_t i = 0; i < triangles.size(); i += 3)
+			{
+				unsigned int a = redirect[triangles[i]], b = redirect[triangles[i + 1]], c = redirect[triangles[i + 2]];
+				if (group[a] == group[b] || group[b] == group[c] || group[c] == group[a]) continue;
+				triangles[written++] = a;
+				triangles[written++] = b;
+				triangles[written++] = c;
+			}
+			triangles.resize(written);
+		}
+
+		result.resize(triangles.size());
+		for (size_t i = 0; i < triangles.size(); i++)
+			result[i] = vertices[triangles[i]];
+		return static_cast<float>(std::sqrt(max_error));
+	}
+
+	void GenerateLods(GeometricMesh* mesh, int level_count)
+	{
+		mesh->lod_errors.clear();
+		for (GeometricMesh::MeshObject& object : mesh->objects)
+			object.lods.clear();
+		if (level_count <= 1 || mesh->indices.empty()) return;
+
+		unsigned int vertex_count = static_cast<unsigned int>(mesh->vertices.size());
+		size_t full_index_count = mesh->indices.size();
+		std::vector<unsigned int> simplified;
+		glm::vec3 bounds_min(FLT_MAX), bounds_max(-FLT_MAX);
+		for (const glm::vec3& position : mesh->vertices)
+		{
+			bounds_min = glm::min(bounds_min, position);
+			bounds_max = glm::max(bounds_max, position);
+		}
+		float target_error = glm::length(bounds_max - bounds_min) * LOD_ERROR_FRACTION;
+		for (int level = 1; level < std::min(level_count, MAX_LEVELS); level++)
+		{
+			if (level > 1) target_error *= 2.0f;
+			size_t level_index_count = 0;
+			float level_error = 0.0f;
+			for (GeometricMesh::MeshObject& object : mesh->objects)
+			{
+				// every level is simplified from the full detail triangles, so that its error is measured against them
+				unsigned int count = object.end - object.start;
+				unsigned int target = ((count / 3) >> level) * 3;
+				float error = Simplify(mesh->vertices, &mesh->indices[object.start], count, target, target_error, simplified);
+
+				// keep the previous range if the object can not get any simpler (e.g. it is all borders)
+				const GeometricMesh::Lod* previous = (level > 1) ? &object.lods.back() : nullptr;
+				unsigned int previous_count = (previous != nullptr) ? previous->end - previous->start : count;
+				GeometricMesh::Lod lod;
+				if (simplified.size() >= previous_count)
+				{
+					lod.start = (previous != nullptr) ? previous->start : object.start;
+					lod.end = (previous != nullptr) ? previous->end : object.end;
+					error = (level > 1) ? mesh->lod_errors.back() : 0.0f;
+				}
+				else
+				{
+					lod.start = static_cast<unsigned int>(mesh->indices.size());
+					mesh->indices.insert(mesh->indices.end(), simplified.begin(), simplified.end());
+					lod.end = static_cast<unsigned int>(mesh->indices.size());
+					MeshOptimizer::OptimizeVertexCache(mesh->indices, lod.start / 3, (lod.end - lod.start) / 3, vertex_count, MeshOptimizer::CACHE_SIZE);
+				}
+				object.lods.push_back(lod);
+				level_index_count += lod.end - lod.start;
+				level_error = std::max(level_error, error);
+			}
+			mesh->lod_errors.push_back(level_error);
+			printf("LOD %d: %zu -> %zu triangles, error %f\n", level, full_index_count / 3, level_index_count / 3, level_error);
+		}
+	}
+}
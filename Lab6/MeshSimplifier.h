@@ -0,0 +1,30 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <vector>
+#include "glm\glm.hpp"
+
+class GeometricMesh;
+
+/* Offline generation of the levels of detail of a mesh
+The triangles are simplified by edge collapses in the order of their quadric error (Garland-Heckbert).
+A collapse moves a vertex onto one of its neighbours, so every level only has its own indices and shares the
+vertices of the full detail mesh. The open borders of an object are locked (no cracks between the parts)
+and the vertices on attribute seams (uv / normal splits) only collapse along the seam.
+*/
+namespace MeshSimplifier
+{
+	// levels of detail of a mesh, including the full detail one
+	const int MAX_LEVELS = 4;
+
+	// simplify the triangles indices[0, index_count) to about target_index_count indices, without collapses past target_error.
+	// Returns the error of the result, the root mean square distance to the original planes (in the units of the positions)
+	float Simplify(const std::vector<glm::vec3>& positions, const unsigned int* indices, unsigned int index_count, unsigned int target_index_count, float target_error, std::vector<unsigned int>& result);
+
+	// append the simplified levels of every object after the full detail indices, level i aims at 1 / 2^i of the triangles
+	// as far as its error budget allows
+	// (see GeometricMesh::MeshObject::lods and GeometricMesh::lod_errors)
+	void GenerateLods(GeometricMesh* mesh, int level_count = MAX_LEVELS);
+};
+
+#endif
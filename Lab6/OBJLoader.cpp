@@ -5,12 +5,28 @@
 #include <fstream>
 #include <iostream>
 #include "Tools.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include <unordered_map>
+#include "glm\gtx\hash.hpp"
+#include "MappedFile.h"
+#include "CookedMesh.h"
+#include "VertexFormat.h"
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <cfloat>
 
 using namespace std;
 
 OBJLoader::OBJLoader(void)
 {
 	mesh = nullptr;
+	threadCount = 0;
+	lastParseSeconds = 0.0;
+	lastFileSize = 0;
 }
 
 
@@ -18,8 +34,30 @@ OBJLoader::~OBJLoader(void)
 {
 }
 
+// files smaller than this are parsed on the calling thread
+#define PARALLEL_PARSE_MIN_BYTES (1024 * 1024)
+
+// size of the file ranges that cookStreaming parses at once, per thread
+#define STREAMING_WINDOW_BYTES (8 * 1024 * 1024)
+
+// the part of a file parsed by one thread
+struct OBJLoader::Chunk
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+	std::vector<Face> faces;
+	// one bit per face index (vertices, normals, texcoords x 3 corners) that is relative
+	// to the start of the chunk and has to be offset while merging (negative indices)
+	std::vector<unsigned short> relative;
+	std::vector<Event> events;
+};
+
 /*
-Because sometimes there are faces that point to not yet defined vertices we will do a 2-pass scan
+The file is mapped and split into line aligned chunks that are parsed in parallel.
+The chunks are merged in order: the attribute arrays are concatenated, the negative face indices are offset
+by the attribute counts of the previous chunks and the group / material statements are replayed.
+Because sometimes there are faces that point to not yet defined vertices the faces are resolved after the merge
 */
 GeometricMesh* OBJLoader::load(const char* filename)
 {
@@ -28,25 +66,19 @@ GeometricMesh* OBJLoader::load(const char* filename)
 	shared_vertices.clear();
 	shared_normals.clear();
 	shared_textcoord.clear();
-	elements.clear();
 	shared_faces.clear();
+	materialFiles.clear();
 	hasTextures = hasNormals = false;
 
-	char buff[1024];
-	char str[1024];
-
-	FILE *pFile;
 	folderPath = Tools::GetFolderPath(filename);
-	pFile = fopen(filename, "r");
-	if (pFile == NULL)
+	MappedFile file;
+	if (!file.Open(filename))
 	{
 		printf("ObjLoaderMeshNext: Error opening file %s \n", filename);
 		return nullptr;
 	}
-	
-	mesh = new GeometricMesh();
 
-	int str_pos;
+	mesh = new GeometricMesh();
 
 	// add a default material
 	mesh->materials.push_back(OBJMaterial());
@@ -58,343 +90,730 @@ GeometricMesh* OBJLoader::load(const char* filename)
 	mesh->objects.push_back(defaultOb);
 	int currentMaterialID = 0;
 
-	//read the file
-	while (fgets(buff, 1024, pFile) != NULL)
+	auto start_time = std::chrono::steady_clock::now();
+
+	// parse the whole file and merge the chunks
+	std::vector<Chunk> chunks;
+	const char* data = reinterpret_cast<const char*>(file.GetData());
+	unsigned int thread_count = (threadCount > 0) ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	if (file.GetSize() < PARALLEL_PARSE_MIN_BYTES) thread_count = 1;
+	parseRange(data, data + file.GetSize(), thread_count, chunks);
+
+	for (const Chunk& chunk : chunks)
 	{
-		if (sscanf(buff, "%s %n", str, &str_pos) >= 1)
-		{
-			if (strcmp(str, "v") == 0) read_vertex(buff + str_pos);
-			else if (strcmp(str, "vt") == 0) read_texcoord(buff + str_pos);
-			else if (strcmp(str, "vn") == 0) read_normal(buff + str_pos);
-			else if (strcmp(str, "f") == 0) read_faceLimited(buff + str_pos);
-			else if (strcmp(str, "usemtl") == 0) read_usemtl(buff + str_pos, currentMaterialID);
-			else if (strcmp(str, "mtllib") == 0) read_mtllib(buff + str_pos, filename);
-			else if (strcmp(str, "g") == 0 || strcmp(str, "o") == 0) add_new_group(buff + str_pos, currentMaterialID);
-			else if (strcmp(str, "#") == 0) { /* ignoring this line */ }
-			else { /* ignoring this line */ }
-		}
+		const glm::ivec3 base(static_cast<int>(shared_vertices.size()), static_cast<int>(shared_normals.size()), static_cast<int>(shared_textcoord.size()));
+		mergeChunk(chunk, base, static_cast<unsigned int>(shared_faces.size()), currentMaterialID, shared_faces);
+
+		shared_vertices.insert(shared_vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+		shared_normals.insert(shared_normals.end(), chunk.normals.begin(), chunk.normals.end());
+		shared_textcoord.insert(shared_textcoord.end(), chunk.texcoords.begin(), chunk.texcoords.end());
 	}
-	fclose(pFile);
+
+	lastParseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	lastFileSize = file.GetSize();
+	file.Close();
 
 	// Generate vertices and other data from faces
 	generateDataFromFaces();
 
 	// close the last object
-	mesh->objects.back().end = static_cast<unsigned int>(mesh->vertices.size());
+	mesh->objects.back().end = static_cast<unsigned int>(mesh->indices.size());
 
-	printf("Done reading OBJ file \n");
+	printf("Done reading OBJ file %s: %zu vertices welded to %zu (%zu indices)\n",
+		filename, shared_faces.size() * 3, mesh->vertices.size(), mesh->indices.size());
 
 	// remove empty objects
 	mesh->objects.erase(std::remove_if(mesh->objects.begin(), mesh->objects.end(), [](GeometricMesh::MeshObject ob) { return ob.start == ob.end; }), mesh->objects.end());
 
-	// if normals doesn't exist create them
-	if (mesh->normals.empty())
-	{
-		printf("normals not found\n");
+	// reorder the triangles and vertices for the gpu caches
+	MeshOptimizer::Optimize(mesh);
+	mesh->ComputeObjectBounds();
+	// simplified levels of detail after the full detail indices
+	MeshSimplifier::GenerateLods(mesh);
 
-		bool flatShading = false;
-		if (flatShading) calculate_flat_normals();
-		else calculate_avg_normals(shared_vertices, mesh->normals, elements);
-	}
 	return mesh;
 }
 
-// read vertices x,y,z
-inline void OBJLoader::read_vertex(const char* buff)
+// table of fixed size records, appended to a temporary file and mapped for random access once complete
+template <typename T>
+class SpillTable
 {
-	glm::vec3 v;
-	char* pEnd;
-	v.x = strtof(buff, &pEnd);
-	v.y = strtof(pEnd, &pEnd);
-	v.z = strtof(pEnd, &pEnd);
-	//sscanf(buff, "%f %f %f", &v.x, &v.y, &v.z);
-	shared_vertices.push_back(v);
-}
+public:
+	SpillTable() { file = NULL; count = 0; }
+	~SpillTable() { Close(); }
+
+	bool Create(const std::string& spill_filename)
+	{
+		filename = spill_filename;
+		file = fopen(filename.c_str(), "wb");
+		return file != NULL;
+	}
+
+	bool Append(const T* records, size_t record_count)
+	{
+		count += record_count;
+		return record_count == 0 || fwrite(records, sizeof(T), record_count, file) == record_count;
+	}
+
+	// finish the writing and map the table
+	bool Map()
+	{
+		bool written = fclose(file) == 0;
+		file = NULL;
+		return written && (count == 0 || (mapping.Open(filename.c_str()) && mapping.GetSize() == count * sizeof(T)));
+	}
 
-// read texture coordinates u,v
-inline void OBJLoader::read_texcoord(const char* buff)
+	void Close()
+	{
+		mapping.Close();
+		if (file != NULL) fclose(file);
+		file = NULL;
+		if (!filename.empty()) remove(filename.c_str());
+		filename.clear();
+	}
+
+	// the records [first, first + record_count) will not be read again for a while
+	void Discard(size_t first, size_t record_count) { mapping.Discard(first * sizeof(T), record_count * sizeof(T)); }
+
+	const T& operator[](size_t i) const { return reinterpret_cast<const T*>(mapping.GetData())[i]; }
+	size_t Size() const { return count; }
+
+private:
+	std::string filename;
+	FILE* file;
+	size_t count;
+	MappedFile mapping;
+};
+
+/*
+The file is parsed in line aligned windows (each one in parallel chunks) and the attributes and faces are spilled to
+temporary files next to the cache. The spilled tables are then mapped and the faces are processed in blocks:
+every block is welded, optimized for the vertex cache and packed, and its vertices and indices are appended to the cache.
+Only the current window, the current block, the materials and the objects are kept in memory.
+The vertices shared by two blocks are duplicated and the triangles are only reordered inside their block.
+*/
+bool OBJLoader::cookStreaming(const char* filename, const char* cache_filename, unsigned int block_triangles)
 {
-	glm::vec2 vt;
-	char* pEnd;
-	vt.x = strtof(buff, &pEnd);
-	vt.y = strtof(pEnd, &pEnd);
-	//sscanf(buff, "%f %f", &vt.x, &vt.y);
-	shared_textcoord.push_back(vt);
+	printf("Start streaming OBJ file %s\n", filename);
+
+	materialFiles.clear();
+	folderPath = Tools::GetFolderPath(filename);
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		printf("ObjLoaderMeshNext: Error opening file %s \n", filename);
+		return false;
+	}
+
+	// the objects and the materials of the mesh, the geometry never goes through it
+	GeometricMesh tables;
+	mesh = &tables;
+	tables.materials.push_back(OBJMaterial());
+	GeometricMesh::MeshObject defaultOb;
+	defaultOb.start = 0;
+	defaultOb.material_id = 0;
+	tables.objects.push_back(defaultOb);
+	int currentMaterialID = 0;
+
+	const std::string spill_prefix = std::string(cache_filename) + ".";
+	SpillTable<glm::vec3> positions;
+	SpillTable<glm::vec3> normals;
+	SpillTable<glm::vec2> texcoords;
+	SpillTable<Face> faces;
+	bool succeeded = positions.Create(spill_prefix + "positions.tmp") && normals.Create(spill_prefix + "normals.tmp")
+		&& texcoords.Create(spill_prefix + "texcoords.tmp") && faces.Create(spill_prefix + "faces.tmp");
+
+	glm::vec3 bounds_min(FLT_MAX);
+	glm::vec3 bounds_max(-FLT_MAX);
+	float max_abs_texcoord = 0.0f;
+
+	const char* data = reinterpret_cast<const char*>(file.GetData());
+	const char* data_end = data + file.GetSize();
+	unsigned int thread_count = (threadCount > 0) ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	const size_t window_size = static_cast<size_t>(STREAMING_WINDOW_BYTES) * thread_count;
+	std::vector<Chunk> chunks;
+	std::vector<Face> chunk_faces;
+	for (const char* window = data; window < data_end && succeeded;)
+	{
+		const char* window_end = data_end;
+		if (static_cast<size_t>(data_end - window) > window_size)
+		{
+			const char* line_end = static_cast<const char*>(memchr(window + window_size, '\n', data_end - (window + window_size)));
+			if (line_end != nullptr) window_end = line_end + 1;
+		}
+		parseRange(window, window_end, thread_count, chunks);
+
+		for (const Chunk& chunk : chunks)
+		{
+			const glm::ivec3 base(static_cast<int>(positions.Size()), static_cast<int>(normals.Size()), static_cast<int>(texcoords.Size()));
+			chunk_faces.clear();
+			mergeChunk(chunk, base, static_cast<unsigned int>(faces.Size()), currentMaterialID, chunk_faces);
+
+			for (const glm::vec3& position : chunk.vertices)
+			{
+				bounds_min = glm::min(bounds_min, position);
+				bounds_max = glm::max(bounds_max, position);
+			}
+			for (const glm::vec2& texcoord : chunk.texcoords)
+				max_abs_texcoord = glm::max(max_abs_texcoord, glm::max(glm::abs(texcoord.x), glm::abs(texcoord.y)));
+
+			succeeded = succeeded && positions.Append(chunk.vertices.data(), chunk.vertices.size()) && normals.Append(chunk.normals.data(), chunk.normals.size())
+				&& texcoords.Append(chunk.texcoords.data(), chunk.texcoords.size()) && faces.Append(chunk_faces.data(), chunk_faces.size());
+		}
+		// the parsed text is not needed any more
+		file.Discard(window - data, window_end - window);
+		window = window_end;
+	}
+	std::vector<Chunk>().swap(chunks);
+	std::vector<Face>().swap(chunk_faces);
+	file.Close();
+
+	succeeded = succeeded && positions.Map() && normals.Map() && texcoords.Map() && faces.Map();
+	if (!succeeded)
+	{
+		printf("ObjLoaderMeshNext: could not write the temporary files of %s\n", cache_filename);
+		mesh = nullptr;
+		return false;
+	}
+
+	const unsigned int face_count = static_cast<unsigned int>(faces.Size());
+	tables.objects.back().end = 3 * face_count;
+	tables.objects.erase(std::remove_if(tables.objects.begin(), tables.objects.end(), [](GeometricMesh::MeshObject ob) { return ob.start == ob.end; }), tables.objects.end());
+
+	hasTextures = texcoords.Size() > 0;
+	hasNormals = normals.Size() > 0;
+
+	// if some faces don't have normals, average the face normals around each position in a mapped table
+	bool missingNormals = !hasNormals;
+	for (unsigned int face = 0; face < face_count && !missingNormals; face++)
+		missingNormals = glm::any(glm::lessThan(faces[face].normals, glm::ivec3(0)));
+	const std::string position_normals_filename = spill_prefix + "position_normals.tmp";
+	MappedFile position_normals_file;
+	glm::vec3* position_normals = nullptr;
+	if (missingNormals && positions.Size() > 0)
+	{
+		printf("normals not found\n");
+		if (!position_normals_file.Create(position_normals_filename.c_str(), positions.Size() * sizeof(glm::vec3)))
+		{
+			printf("ObjLoaderMeshNext: could not write the temporary files of %s\n", cache_filename);
+			mesh = nullptr;
+			return false;
+		}
+		position_normals = reinterpret_cast<glm::vec3*>(position_normals_file.GetWritableData());
+		for (unsigned int face = 0; face < face_count; face++)
+		{
+			const glm::ivec3& v = faces[face].vertices;
+			glm::vec3 normal = glm::cross(positions[v.y] - positions[v.x], positions[v.z] - positions[v.x]);
+			for (int j = 0; j < 3; j++)
+				position_normals[v[j]] += normal;
+			if ((face + 1) % block_triangles == 0)
+				faces.Discard(face + 1 - block_triangles, block_triangles);
+		}
+		for (size_t v = 0; v < positions.Size(); v++)
+		{
+			float length = glm::length(position_normals[v]);
+			position_normals[v] = (length > 0.0f) ? position_normals[v] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+	}
+
+	if (positions.Size() == 0)
+		bounds_min = bounds_max = glm::vec3(0.0f);
+	unsigned int vertex_format = VertexFormat::ChooseFlags(max_abs_texcoord);
+	glm::mat4 dequantization_matrix = VertexFormat::GetDequantizationMatrix(vertex_format, bounds_min, bounds_max);
+	CookedMesh::Writer writer;
+	succeeded = writer.Begin(cache_filename, vertex_format, dequantization_matrix, bounds_min, bounds_max);
+
+	// the object bounds are grown block by block
+	for (GeometricMesh::MeshObject& object : tables.objects)
+	{
+		object.bounds_min = glm::vec3(FLT_MAX);
+		object.bounds_max = glm::vec3(-FLT_MAX);
+	}
+
+	GeometricMesh block;
+	std::unordered_map<glm::ivec3, unsigned int> welded;
+	welded.reserve(static_cast<size_t>(block_triangles) * 3);
+	std::vector<unsigned char> vertex_data;
+	std::vector<unsigned int> clusters;
+	unsigned int vertex_base = 0;
+	unsigned int block_count = 0;
+	for (unsigned int first = 0; first < face_count && succeeded; first += block_triangles)
+	{
+		const unsigned int last = std::min(face_count, first + block_triangles);
+
+		// weld the unique (position, normal, texcoord) triplets of the block
+		block.vertices.clear();
+		block.normals.clear();
+		block.textureCoord.clear();
+		block.indices.clear();
+		welded.clear();
+		for (unsigned int face = first; face < last; face++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				const int v = faces[face].vertices[i];
+				const int vn = faces[face].normals[i];
+				const int vt = (hasTextures) ? faces[face].texcoords[i] : -1;
+				const glm::ivec3 key(v, (vn >= 0) ? vn : -1, vt);
+
+				auto it = welded.find(key);
+				if (it != welded.end())
+				{
+					block.indices.push_back(it->second);
+					continue;
+				}
+
+				unsigned int index = static_cast<unsigned int>(block.vertices.size());
+				welded[key] = index;
+				block.indices.push_back(index);
+
+				block.vertices.push_back(positions[v]);
+				block.normals.push_back((vn >= 0) ? normals[vn] : position_normals[v]);
+				if (hasTextures)
+					block.textureCoord.push_back((vt >= 0) ? texcoords[vt] : glm::vec2(0.f));
+			}
+		}
+
+		// reorder the triangles of every object inside the block, the object ranges stay in place
+		const unsigned int vertex_count = static_cast<unsigned int>(block.vertices.size());
+		for (GeometricMesh::MeshObject& object : tables.objects)
+		{
+			unsigned int start = std::max(object.start / 3, first);
+			unsigned int end = std::min(object.end / 3, last);
+			if (start >= end) continue;
+			for (unsigned int i = 3 * (start - first); i < 3 * (end - first); i++)
+			{
+				object.bounds_min = glm::min(object.bounds_min, block.vertices[block.indices[i]]);
+				object.bounds_max = glm::max(object.bounds_max, block.vertices[block.indices[i]]);
+			}
+			MeshOptimizer::OptimizeVertexCache(block.indices, start - first, end - start, vertex_count, MeshOptimizer::CACHE_SIZE, &clusters);
+			MeshOptimizer::OptimizeOverdraw(block.indices, start - first, end - start, block.vertices, clusters);
+		}
+		MeshOptimizer::OptimizeVertexFetch(&block);
+
+		VertexFormat::Pack(&block, vertex_format, dequantization_matrix, vertex_data);
+		for (unsigned int& index : block.indices)
+			index += vertex_base;
+		succeeded = writer.AppendVertices(vertex_data.data(), static_cast<uint32_t>(block.vertices.size()))
+			&& writer.AppendIndices(block.indices.data(), static_cast<uint32_t>(block.indices.size()));
+		vertex_base += static_cast<unsigned int>(block.vertices.size());
+		block_count++;
+		faces.Discard(first, last - first);
+	}
+
+	std::vector<std::string> dependencies(1, filename);
+	dependencies.insert(dependencies.end(), materialFiles.begin(), materialFiles.end());
+	// the blocks are never in memory together, so the streamed meshes only have their full detail level
+	succeeded = succeeded && writer.Finish(tables.objects, tables.materials, dependencies, std::vector<float>());
+
+	position_normals_file.Close();
+	remove(position_normals_filename.c_str());
+	mesh = nullptr;
+
+	if (succeeded)
+		printf("Done streaming OBJ file %s: %u triangles in %u blocks, %u vertices\n", filename, face_count, block_count, vertex_base);
+	else
+		printf("ObjLoaderMeshNext: could not write %s\n", cache_filename);
+	return succeeded;
 }
-// read normals x,y,z
-inline void OBJLoader::read_normal(const char* buff)
+
+void OBJLoader::parseRange(const char* begin, const char* end, unsigned int thread_count, std::vector<Chunk>& chunks)
 {
-	glm::vec3 n;
-	char* pEnd;
-	n.x = strtof(buff, &pEnd);
-	n.y = strtof(pEnd, &pEnd);
-	n.z = strtof(pEnd, &pEnd);
-	//sscanf(buff, "%f %f %f", &n.x, &n.y, &n.z);
-	shared_normals.push_back(n);
+	// split the range at line boundaries
+	std::vector<const char*> boundaries(1, begin);
+	for (unsigned int i = 1; i < thread_count; i++)
+	{
+		const char* split = std::max(boundaries.back(), begin + (end - begin) * i / thread_count);
+		const char* line_end = static_cast<const char*>(memchr(split, '\n', end - split));
+		if (line_end == nullptr) break;
+		boundaries.push_back(line_end + 1);
+	}
+	boundaries.push_back(end);
+
+	chunks.clear();
+	chunks.resize(boundaries.size() - 1);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < chunks.size(); i++)
+		threads.emplace_back(parseChunk, boundaries[i], boundaries[i + 1], std::ref(chunks[i]));
+	parseChunk(boundaries[0], boundaries[1], chunks[0]);
+	for (std::thread& thread : threads)
+		thread.join();
 }
 
-// format v/vt/vn v/vt/vn v/vt/vn, only read a triangle or a quad (Or more not tested)
-void OBJLoader::read_face(const char* buff)
+void OBJLoader::mergeChunk(const Chunk& chunk, const glm::ivec3& base, unsigned int face_base, int& currentMaterialID, std::vector<Face>& faces)
 {
-	int step = 0;
-	std::vector<glm::ivec3> vertices_pointers;
-	vertices_pointers.reserve(6);
-	glm::ivec3 vertex_pointer(0);
-
-	vertex_pointer = read_face_component(buff + step, step);
-	//while (glm::all(glm::greaterThanEqual(vertex_pointer, glm::ivec3(0))))
-	while (vertex_pointer.x >= 0)// && (vertex_pointer.x >= 0 || vertex_pointer.y >= 0 || vertex_pointer.z >= 0)) // vertex index should always exist
+	for (const Event& event : chunk.events)
 	{
-		vertices_pointers.push_back(vertex_pointer);
-		vertex_pointer = read_face_component(buff + step, step);
+		unsigned int face_position = face_base + event.face;
+		if (event.type == Event::MTLLIB) read_mtllib(event.name);
+		else if (event.type == Event::USEMTL) read_usemtl(event.name, face_position, currentMaterialID);
+		else add_new_group(event.name, face_position, currentMaterialID);
 	}
 
-	/*
-	*  I read 5 vertices                              |1|2|3|4|5|
-	*  I add the extra necessery padding ( pad = 2 )
-	*  So i add 2*pad+size                            |1|2|3|4|5|_|_|_|_|
-	*  Then i put from the last index to the 3rd
-	*  into their correct positions                   |1|2|3|4|5|_|_|_|5|  and  |1|2|3|4|5|4|_|_|5|
-	*  Then put at x and x+1 position
-	*  ( e.g. from 4th -> last with i+=3 ) the
-	*  correct vertices
-	*  |1|2|3|x|5|4|_|_|5| -> |1|2|3|1|5|_|_|_|5| and |1|2|3|1|x|4|_|_|5| -> |1|2|3|1|3|4|_|_|5|
-	*
-	*/
-
-	int number_of_faces = static_cast<int>(vertices_pointers.size() - 3) + 1;
-
-	for (int face = 0; face < number_of_faces; face++)
+	for (unsigned int f = 0; f < chunk.faces.size(); f++)
 	{
-		//break them using triangle fan :( it is easy for quads
-
-		Face f;
-		f.vertices = glm::ivec3(vertices_pointers[face + 0].x, vertices_pointers[face + 1].x, vertices_pointers[face + 2].x);
-		f.normals = glm::ivec3(vertices_pointers[face + 0].y, vertices_pointers[face + 1].y, vertices_pointers[face + 2].y);
-		f.texcoords = glm::ivec3(vertices_pointers[face + 0].z, vertices_pointers[face + 1].z, vertices_pointers[face + 2].z);
-
-		shared_faces.push_back(f);
+		Face face = chunk.faces[f];
+		unsigned short relative = chunk.relative[f];
+		for (int j = 0; j < 3; j++)
+		{
+			if (relative & (1 << (0 + j))) face.vertices[j] += base.x;
+			if (relative & (1 << (3 + j))) face.normals[j] += base.y;
+			if (relative & (1 << (6 + j))) face.texcoords[j] += base.z;
+		}
+		faces.push_back(face);
 	}
 }
 
-// format v/vt/vn v/vt/vn v/vt/vn, only read a triangle or a quad
-void OBJLoader::read_faceLimited(const char* buff)
+void OBJLoader::benchmark(const char* filename, int iterations)
 {
-	int step = 0;
-	glm::ivec3 vertices_pointers[4];
-	vertices_pointers[0] = read_face_component(buff + step, step);
-	vertices_pointers[1] = read_face_component(buff + step, step);
-	vertices_pointers[2] = read_face_component(buff + step, step);
-	vertices_pointers[3] = read_face_component(buff + step, step);
-
-	// if it is a triangle
-	if (vertices_pointers[0].x >= 0 && vertices_pointers[1].x >= 0 && vertices_pointers[2].x >= 0)
+	OBJLoader loader;
+	unsigned int thread_counts[2] = { 1, std::max(1u, std::thread::hardware_concurrency()) };
+	double throughput[2] = { 0.0, 0.0 };
+
+	for (int t = 0; t < 2; t++)
 	{
-		Face f;
-		f.vertices = glm::ivec3(vertices_pointers[0].x, vertices_pointers[1].x, vertices_pointers[2].x);
-		f.normals = glm::ivec3(vertices_pointers[0].y, vertices_pointers[1].y, vertices_pointers[2].y);
-		f.texcoords = glm::ivec3(vertices_pointers[0].z, vertices_pointers[1].z, vertices_pointers[2].z);
-		shared_faces.push_back(f);
-
-		// if it was a quad, add another triangle so we can form a quad
-		if (vertices_pointers[3].x >= 0)
+		loader.setThreadCount(thread_counts[t]);
+		double best = 0.0;
+		for (int i = 0; i < iterations; i++)
 		{
-			Face f;
-			f.vertices = glm::ivec3(vertices_pointers[2].x, vertices_pointers[3].x, vertices_pointers[0].x);
-			f.normals = glm::ivec3(vertices_pointers[2].y, vertices_pointers[3].y, vertices_pointers[0].y);
-			f.texcoords = glm::ivec3(vertices_pointers[2].z, vertices_pointers[3].z, vertices_pointers[0].z);
-			shared_faces.push_back(f);
+			GeometricMesh* result = loader.load(filename);
+			if (result == nullptr) return;
+			delete result;
+			double megabytes = loader.lastFileSize / (1024.0 * 1024.0);
+			if (loader.lastParseSeconds > 0.0) best = std::max(best, megabytes / loader.lastParseSeconds);
 		}
+		throughput[t] = best;
+	}
+
+	for (int t = 0; t < 2; t++)
+		printf("OBJ parse throughput of %s with %u thread(s): %.1f MB/s (best of %d)\n", filename, thread_counts[t], throughput[t], iterations);
+}
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char* skipSpaces(const char* p, const char* end)
+{
+	while (p < end && isSpace(*p)) p++;
+	return p;
+}
+
+// read an integer, returns false if there are no digits
+static inline bool parseInt(const char*& p, const char* end, int& value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
 	}
+	if (p >= end || !isDigit(*p)) return false;
+	int result = 0;
+	while (p < end && isDigit(*p))
+		result = result * 10 + (*p++ - '0');
+	value = (negative) ? -result : result;
+	return true;
 }
 
-glm::ivec3 OBJLoader::read_face_component(const char* buff, int& offset)
+// read a float like strtof, 0 if there is no number
+static inline float parseFloat(const char*& p, const char* end)
 {
-	int index = 0;
-	int v, vt, vn;
-	// v/vt/vn format
-	if (sscanf(buff, "%d/%d/%d%n", &v, &vt, &vn, &index) >= 3)
+	static const double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	p = skipSpaces(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
 	{
-		v += v < 0 ? (int)shared_vertices.size() : -1;
-		vn += vn < 0 ? (int)shared_normals.size() : -1;
-		vt += vt < 0 ? (int)shared_textcoord.size() : -1;
-		elements.push_back(v);
-		offset += index;
-		return glm::ivec3(v, vn, vt);
+		negative = *p == '-';
+		p++;
 	}
-	// v//vn format
-	if (sscanf(buff, "%d//%d%n", &v, &vn, &index) >= 2)
+
+	// up to 19 significant digits fit in the mantissa, the rest only move the exponent
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	while (p < end && isDigit(*p))
 	{
-		v += v < 0 ? (int)shared_vertices.size() : -1;
-		vn += vn < 0 ? (int)shared_normals.size() : -1;
-		elements.push_back(v);
-		offset += index;
-		return glm::ivec3(v, vn, -1);
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa != 0) digits++;
+		}
+		else exponent++;
+		p++;
 	}
-	// v/vt format
-	if (sscanf(buff, "%d/%d%n", &v, &vt, &index) >= 2)
+	if (p < end && *p == '.')
 	{
-		v += v < 0 ? (int)shared_vertices.size() : -1;
-		vt += vt < 0 ? (int)shared_textcoord.size() : -1;
-		elements.push_back(v);
-		offset += index;
-		return glm::ivec3(v, -1, vt);
+		p++;
+		while (p < end && isDigit(*p))
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0) digits++;
+				exponent--;
+			}
+			p++;
+		}
 	}
-	// v format
-	if (sscanf(buff, "%d%n", &v, &index) >= 1)
+	if (p < end && (*p == 'e' || *p == 'E'))
 	{
-		v += v < 0 ? (int)shared_vertices.size() : -1;
-		elements.push_back(v);
-		offset += index;
-		return glm::ivec3(v, -1, -1);
+		const char* exponent_start = p++;
+		int exponent_value;
+		if (parseInt(p, end, exponent_value)) exponent += exponent_value;
+		else p = exponent_start;
 	}
-	return glm::ivec3(-1);
+
+	double result = static_cast<double>(mantissa);
+	if (exponent < 0)
+		result = (exponent >= -22) ? result / powers_of_ten[-exponent] : result * pow(10.0, exponent);
+	else if (exponent > 0)
+		result = (exponent <= 22) ? result * powers_of_ten[exponent] : result * pow(10.0, exponent);
+	return static_cast<float>((negative) ? -result : result);
 }
 
-void OBJLoader::generateDataFromFaces()
+// first whitespace separated token of the rest of the line
+static inline std::string parseToken(const char* p, const char* end)
 {
-	hasTextures = !shared_textcoord.empty();
-
-	mesh->vertices.reserve(shared_faces.size() * 3);
-	mesh->normals.reserve(shared_faces.size() * 3);
-	if (hasTextures)
-		mesh->textureCoord.reserve(shared_faces.size() * 3);
+	p = skipSpaces(p, end);
+	const char* token_end = p;
+	while (token_end < end && !isSpace(*token_end)) token_end++;
+	return std::string(p, token_end);
+}
 
-	const glm::ivec3 zeroVec(0);
+void OBJLoader::parseChunk(const char* begin, const char* end, Chunk& chunk)
+{
+	const char* line = begin;
+	while (line < end)
+	{
+		const char* line_end = static_cast<const char*>(memchr(line, '\n', end - line));
+		if (line_end == nullptr) line_end = end;
 
-	for (int face = 0; face < shared_faces.size(); face++)
-	{		
-		mesh->vertices.push_back(shared_vertices[shared_faces[face].vertices.x]);
-		mesh->vertices.push_back(shared_vertices[shared_faces[face].vertices.y]);
-		mesh->vertices.push_back(shared_vertices[shared_faces[face].vertices.z]);
+		const char* p = skipSpaces(line, line_end);
+		const char* keyword_end = p;
+		while (keyword_end < line_end && !isSpace(*keyword_end)) keyword_end++;
+		size_t keyword_length = keyword_end - p;
+		p = keyword_end;
 
-		if (glm::any(glm::greaterThanEqual(shared_faces[face].normals, glm::ivec3(0))))
+		if (keyword_length == 1 && *(keyword_end - 1) == 'v')
+		{
+			// read vertices x,y,z
+			glm::vec3 v;
+			v.x = parseFloat(p, line_end);
+			v.y = parseFloat(p, line_end);
+			v.z = parseFloat(p, line_end);
+			chunk.vertices.push_back(v);
+		}
+		else if (keyword_length == 2 && keyword_end[-2] == 'v' && keyword_end[-1] == 't')
+		{
+			// read texture coordinates u,v
+			glm::vec2 vt;
+			vt.x = parseFloat(p, line_end);
+			vt.y = parseFloat(p, line_end);
+			chunk.texcoords.push_back(vt);
+		}
+		else if (keyword_length == 2 && keyword_end[-2] == 'v' && keyword_end[-1] == 'n')
 		{
-			mesh->normals.push_back(shared_normals[shared_faces[face].normals.x]);
-			mesh->normals.push_back(shared_normals[shared_faces[face].normals.y]);
-			mesh->normals.push_back(shared_normals[shared_faces[face].normals.z]);
+			// read normals x,y,z
+			glm::vec3 n;
+			n.x = parseFloat(p, line_end);
+			n.y = parseFloat(p, line_end);
+			n.z = parseFloat(p, line_end);
+			chunk.normals.push_back(n);
+		}
+		else if (keyword_length == 1 && *(keyword_end - 1) == 'f')
+		{
+			// format v/vt/vn v//vn v/vt v, only read a triangle or a quad
+			glm::ivec3 components[4];
+			unsigned short relative[4];
+			const int counts[3] = { static_cast<int>(chunk.vertices.size()), static_cast<int>(chunk.normals.size()), static_cast<int>(chunk.texcoords.size()) };
+			int count = 0;
+			while (count < 4)
+			{
+				p = skipSpaces(p, line_end);
+				// (v, vn, vt) as raw OBJ indices, 0 = missing
+				int raw[3] = { 0, 0, 0 };
+				if (!parseInt(p, line_end, raw[0])) break;
+				if (p < line_end && *p == '/')
+				{
+					p++;
+					if (p < line_end && *p != '/') parseInt(p, line_end, raw[2]);
+					if (p < line_end && *p == '/')
+					{
+						p++;
+						parseInt(p, line_end, raw[1]);
+					}
+				}
+				// skip anything else up to the next component
+				while (p < line_end && !isSpace(*p)) p++;
 
-			if (glm::any(glm::greaterThanEqual(shared_faces[face].texcoords, glm::ivec3(0))))
+				relative[count] = 0;
+				for (int a = 0; a < 3; a++)
+				{
+					if (raw[a] < 0)
+					{
+						// relative to the attributes parsed so far, made absolute while merging
+						components[count][a] = counts[a] + raw[a];
+						relative[count] |= 1 << a;
+					}
+					else components[count][a] = raw[a] - 1;
+				}
+				count++;
+			}
+
+			// if it is a triangle, if it was a quad add another triangle so we can form a quad
+			const int corners[2][3] = { { 0, 1, 2 }, { 2, 3, 0 } };
+			for (int triangle = 0; triangle < count - 2 && triangle < 2; triangle++)
 			{
-				mesh->textureCoord.push_back(shared_textcoord[shared_faces[face].texcoords.x]);
-				mesh->textureCoord.push_back(shared_textcoord[shared_faces[face].texcoords.y]);
-				mesh->textureCoord.push_back(shared_textcoord[shared_faces[face].texcoords.z]);
+				Face f;
+				unsigned short face_relative = 0;
+				for (int j = 0; j < 3; j++)
+				{
+					int c = corners[triangle][j];
+					f.vertices[j] = components[c].x;
+					f.normals[j] = components[c].y;
+					f.texcoords[j] = components[c].z;
+					if (relative[c] & 1) face_relative |= 1 << (0 + j);
+					if (relative[c] & 2) face_relative |= 1 << (3 + j);
+					if (relative[c] & 4) face_relative |= 1 << (6 + j);
+				}
+				chunk.faces.push_back(f);
+				chunk.relative.push_back(face_relative);
 			}
-			else if (hasTextures)
+		}
+		else if (keyword_length > 0)
+		{
+			std::string keyword(keyword_end - keyword_length, keyword_end);
+			Event event;
+			event.face = static_cast<unsigned int>(chunk.faces.size());
+			if (keyword == "usemtl") event.type = Event::USEMTL;
+			else if (keyword == "mtllib") event.type = Event::MTLLIB;
+			else if (keyword == "g" || keyword == "o") event.type = Event::GROUP;
+			else event.type = Event::NONE;
+
+			if (event.type != Event::NONE)
 			{
-				mesh->textureCoord.emplace_back(0.f);
-				mesh->textureCoord.emplace_back(0.f);
-				mesh->textureCoord.emplace_back(0.f);
+				event.name = parseToken(p, line_end);
+				chunk.events.push_back(event);
 			}
-		}		
+		}
+
+		line = line_end + 1;
 	}
 }
 
-void OBJLoader::calculate_flat_normals()
+void OBJLoader::generateDataFromFaces()
 {
-	for (unsigned int i = 0; i < mesh->vertices.size(); i++)
+	hasTextures = !shared_textcoord.empty();
+	hasNormals = !shared_normals.empty();
+
+	// if some faces don't have normals, average the face normals around each position
+	std::vector<glm::vec3> position_normals;
+	bool missingNormals = !hasNormals;
+	for (unsigned int face = 0; face < shared_faces.size() && !missingNormals; face++)
+		missingNormals = glm::any(glm::lessThan(shared_faces[face].normals, glm::ivec3(0)));
+	if (missingNormals)
 	{
-		if ((i % 3) == 2) {
-			glm::vec3 normal = glm::normalize(glm::cross(
-				mesh->vertices[i] - mesh->vertices[i - 2],
-				mesh->vertices[i - 1] - mesh->vertices[i - 2]));
-			for (int n = 0; n < 3; n++)
-				mesh->normals.push_back(normal);
-		}
+		printf("normals not found\n");
+		calculate_avg_normals(position_normals);
 	}
-}
 
+	// weld the unique (position, normal, texcoord) triplets into an indexed mesh
+	std::unordered_map<glm::ivec3, unsigned int> welded;
+	welded.reserve(shared_faces.size() * 3);
+	mesh->indices.reserve(shared_faces.size() * 3);
 
-void OBJLoader::calculate_avg_normals(std::vector<glm::vec3> &shared_vertices, std::vector<glm::vec3> &normals, std::vector<unsigned int> &elements)
-{
-	std::vector<int> nb_seen;
-	std::vector<glm::vec3> temp_normals;
-	temp_normals.resize(shared_vertices.size(), glm::vec3(0.0, 0.0, 0.0));
-	nb_seen.resize(shared_vertices.size(), 0);
-	for (unsigned int i = 0; i < elements.size(); i += 3) {
-		unsigned int ia = elements[i];
-		unsigned int ib = elements[i + 1];
-		unsigned int ic = elements[i + 2];
-		glm::vec3 normal = glm::normalize(glm::cross(
-			glm::vec3(shared_vertices[ib]) - glm::vec3(shared_vertices[ia]),
-			glm::vec3(shared_vertices[ic]) - glm::vec3(shared_vertices[ia])));
-
-		int v[3];  v[0] = ia;  v[1] = ib;  v[2] = ic;
-		for (int j = 0; j < 3; j++) {
-			unsigned int cur_v = v[j];
-			nb_seen[cur_v]++;
-			if (nb_seen[cur_v] == 1) {
-				temp_normals[cur_v] = normal;
-			}
-			else {
-				// average
-				temp_normals[cur_v].x = temp_normals[cur_v].x * (1.0f - 1.0f / nb_seen[cur_v]) + normal.x * 1.0f / nb_seen[cur_v];
-				temp_normals[cur_v].y = temp_normals[cur_v].y * (1.0f - 1.0f / nb_seen[cur_v]) + normal.y * 1.0f / nb_seen[cur_v];
-				temp_normals[cur_v].z = temp_normals[cur_v].z * (1.0f - 1.0f / nb_seen[cur_v]) + normal.z * 1.0f / nb_seen[cur_v];
-				temp_normals[cur_v] = glm::normalize(temp_normals[cur_v]);
+	for (unsigned int face = 0; face < shared_faces.size(); face++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			const int v = shared_faces[face].vertices[i];
+			const int vn = shared_faces[face].normals[i];
+			const int vt = (hasTextures) ? shared_faces[face].texcoords[i] : -1;
+			// faces without normals use the averaged normal of the position
+			const glm::ivec3 key(v, (vn >= 0) ? vn : -1, vt);
+
+			auto it = welded.find(key);
+			if (it != welded.end())
+			{
+				mesh->indices.push_back(it->second);
+				continue;
 			}
+
+			unsigned int index = static_cast<unsigned int>(mesh->vertices.size());
+			welded[key] = index;
+			mesh->indices.push_back(index);
+
+			mesh->vertices.push_back(shared_vertices[v]);
+			mesh->normals.push_back((vn >= 0) ? shared_normals[vn] : position_normals[v]);
+			if (hasTextures)
+				mesh->textureCoord.push_back((vt >= 0) ? shared_textcoord[vt] : glm::vec2(0.f));
 		}
 	}
-	// add normals
-	for (unsigned int i = 0; i<elements.size(); i += 3)
+}
+
+void OBJLoader::calculate_avg_normals(std::vector<glm::vec3> &position_normals)
+{
+	// sum the area weighted face normals of every position
+	position_normals.assign(shared_vertices.size(), glm::vec3(0.0f));
+	for (unsigned int face = 0; face < shared_faces.size(); face++)
 	{
-		unsigned int ia = elements[i];
-		unsigned int ib = elements[i + 1];
-		unsigned int ic = elements[i + 2];
-		normals.push_back(temp_normals[ia]);
-		normals.push_back(temp_normals[ib]);
-		normals.push_back(temp_normals[ic]);
+		const glm::ivec3& v = shared_faces[face].vertices;
+		glm::vec3 normal = glm::cross(
+			shared_vertices[v.y] - shared_vertices[v.x],
+			shared_vertices[v.z] - shared_vertices[v.x]);
+		for (int j = 0; j < 3; j++)
+			position_normals[v[j]] += normal;
+	}
+	for (glm::vec3& normal : position_normals)
+	{
+		float length = glm::length(normal);
+		normal = (length > 0.0f) ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
 	}
-
 }
 
-void OBJLoader::read_usemtl(const char* buff, int& currentMaterialID)
+void OBJLoader::read_usemtl(const std::string& name, unsigned int face_position, int& currentMaterialID)
 {
-	char temp[1024];
-	sscanf(buff, "%s", temp);
-	// read the material
-	std::string str(temp);
-
 	//check if we have already defined a material
 	if (mesh->objects.back().material_id > 0)
 	{
 		// set where the current object ends
-		mesh->objects.back().end = 3 * static_cast<unsigned int>(shared_faces.size());
+		mesh->objects.back().end = 3 * face_position;
 		//create a new MeshObject
 		GeometricMesh::MeshObject mo;
 		mo.name = mesh->objects.back().name;
-		mo.material_id = mesh->findMaterialID(str);
-		mo.start = 3 * static_cast<unsigned int>(shared_faces.size());
+		mo.material_id = mesh->findMaterialID(name);
+		mo.start = 3 * face_position;
 		mesh->objects.push_back(mo);
 	}
 	else
 	{
-		mesh->objects.back().material_id = mesh->findMaterialID(str);
+		mesh->objects.back().material_id = mesh->findMaterialID(name);
 	}
 	currentMaterialID = mesh->objects.back().material_id;
 }
-void OBJLoader::read_mtllib(const char* buff, const char* filename)
+void OBJLoader::read_mtllib(const std::string& name)
 {
-	char temp[1024];
-	sscanf(buff, "%s", temp);
-
-	std::string str(temp);
-	std::string folder(filename);
-	folder = folderPath;
-	str = folder + str;
+	std::string str = folderPath + name;
+	materialFiles.push_back(str);
 	parseMTL(str.c_str());
 }
-void OBJLoader::add_new_group(const char* buff, int& currentMaterialID)
+void OBJLoader::add_new_group(const std::string& name, unsigned int face_position, int& currentMaterialID)
 {
-	char name[1024];
-	sscanf(buff, "%s", name);
-
 	// end the previous MeshObject
-	mesh->objects.back().end = 3 * static_cast<unsigned int>(shared_faces.size());
+	mesh->objects.back().end = 3 * face_position;
 
 	// create a new object
 	GeometricMesh::MeshObject mo;
-	mo.start = 3 * static_cast<unsigned int>(shared_faces.size());
+	mo.start = 3 * face_position;
 	mo.material_id = currentMaterialID;
 	mo.name = name;
 	mesh->objects.push_back(mo);
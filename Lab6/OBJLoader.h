@@ -50,7 +50,10 @@ struct OBJMaterial
 /* Loader for the Obj Format
 It supports triangles and quads (it breaks them into two triangles)
 It supports negative indices in the faces
+Large files are parsed in parallel, line aligned chunks
+Files larger than the memory can be streamed to a CookedMesh cache in blocks
 If there are no normals it creates them
+The unique position / normal / texcoord triplets are welded into an indexed mesh
 Returns a Mesh object for the GPU Rendering or a List of Triangles for Path Tracing
 -- Thread safe and possible the new version
 */
@@ -68,12 +71,16 @@ class OBJLoader
 	};
 	std::vector<Face> shared_faces;
 
-	// the element for calculating normals if they don't exists
-	std::vector<unsigned int> elements;
 	bool hasTextures;
 	bool hasNormals;
 
 	std::string folderPath;
+	std::vector<std::string> materialFiles;
+
+	unsigned int threadCount;
+	// duration of the parsing (without the mesh generation) and size of the last file
+	double lastParseSeconds;
+	size_t lastFileSize;
 
 	class GeometricMesh* mesh;
 
@@ -83,21 +90,44 @@ public:
 
 	class GeometricMesh * load(const char* filename);
 
+	// triangles welded and written at once by cookStreaming
+	static const unsigned int STREAMING_BLOCK_TRIANGLES = 1 << 16;
+
+	// cook the file straight to a CookedMesh cache without keeping the whole mesh in memory, for very large files
+	bool cookStreaming(const char* filename, const char* cache_filename, unsigned int block_triangles = STREAMING_BLOCK_TRIANGLES);
+
+	// the MTL files read by the last load
+	const std::vector<std::string>& getMaterialFiles() const { return materialFiles; }
+
+	// threads used for large files, 0 = one per hardware thread
+	void setThreadCount(unsigned int count) { threadCount = count; }
+
+	// load the file repeatedly with 1 and all threads and print the parsing throughput in MB/s
+	static void benchmark(const char* filename, int iterations);
+
 private:
-	void read_vertex(const char* buff);
-	void read_texcoord(const char* buff);
-	void read_normal(const char* buff);
-	void read_face(const char* buff);
-	void read_faceLimited(const char* buff);
-	glm::ivec3 read_face_component(const char* buff, int& offset);
-	void read_usemtl(const char* buff, int& currentMaterialID);
-	void read_mtllib(const char* buff, const char* filename);
-	void add_new_group(const char* buff, int& currentMaterialID);
+	// group / material statements, replayed in order after the parallel parsing
+	struct Event
+	{
+		enum TYPE { NONE, MTLLIB, USEMTL, GROUP } type;
+		// number of faces of the chunk before the statement
+		unsigned int face;
+		std::string name;
+	};
+	struct Chunk;
+	static void parseChunk(const char* begin, const char* end, Chunk& chunk);
+	// parse the range in line aligned chunks, one per thread
+	static void parseRange(const char* begin, const char* end, unsigned int thread_count, std::vector<Chunk>& chunks);
+	// replay the statements of the chunk and make its face indices absolute
+	void mergeChunk(const Chunk& chunk, const glm::ivec3& base, unsigned int face_base, int& currentMaterialID, std::vector<Face>& faces);
+
+	void read_usemtl(const std::string& name, unsigned int face_position, int& currentMaterialID);
+	void read_mtllib(const std::string& name);
+	void add_new_group(const std::string& name, unsigned int face_position, int& currentMaterialID);
 	void parseMTL(const char* filename);
 
 	void generateDataFromFaces();
 
-	void calculate_flat_normals();
-	void calculate_avg_normals(std::vector<glm::vec3> &shared_vertices, std::vector<glm::vec3> &normals, std::vector<unsigned int> &elements);
+	void calculate_avg_normals(std::vector<glm::vec3> &position_normals);
 };
 
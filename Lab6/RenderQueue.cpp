@@ -0,0 +1,144 @@
+#include "RenderQueue.h"
+#include "GeometryNode.h"
+#include <algorithm>
+
+// bit ranges of the sort key (msb -> lsb)
+#define KEY_PROGRAM_BITS 8
+#define KEY_VAO_BITS 16
+#define KEY_TEXTURE_BITS 16
+#define KEY_MATERIAL_BITS 24
+
+RenderQueue::RenderQueue()
+{
+
+}
+
+RenderQueue::~RenderQueue()
+{
+
+}
+
+void RenderQueue::Clear()
+{
+	items.clear();
+	model_matrices.clear();
+	normal_matrices.clear();
+	indirect_commands.clear();
+	indirect_batches.clear();
+}
+
+unsigned int RenderQueue::AddTransform(const glm::mat4& model_matrix, const glm::mat4& normal_matrix)
+{
+	model_matrices.push_back(model_matrix);
+	normal_matrices.push_back(normal_matrix);
+	return static_cast<unsigned int>(model_matrices.size()) - 1;
+}
+
+uint64_t RenderQueue::MakeKey(GLuint program, GLuint vao, GLuint texture, unsigned int material)
+{
+	uint64_t key = program & ((1u << KEY_PROGRAM_BITS) - 1);
+	key = (key << KEY_VAO_BITS) | (vao & ((1u << KEY_VAO_BITS) - 1));
+	key = (key << KEY_TEXTURE_BITS) | (texture & ((1u << KEY_TEXTURE_BITS) - 1));
+	key = (key << KEY_MATERIAL_BITS) | (material & ((1u << KEY_MATERIAL_BITS) - 1));
+	return key;
+}
+
+void RenderQueue::Submit(GeometryNode* node, unsigned int transform, GLuint program, GLuint textured_program, const unsigned char* visible_parts, unsigned int lod)
+{
+	lod = std::min(lod, node->m_lod_count - 1);
+	for (unsigned int j = 0; j < node->parts.size(); j++)
+	{
+		if (visible_parts != nullptr && visible_parts[j] == 0)
+			continue;
+		DrawItem item;
+		item.program = (node->parts[j].textureID != 0) ? textured_program : program;
+		item.key = MakeKey(item.program, node->m_vao, node->parts[j].textureID, node->parts[j].material_index);
+		item.node = node;
+		item.part = j;
+		item.transform = transform;
+		item.lod = lod;
+		items.push_back(item);
+	}
+}
+
+void RenderQueue::SubmitDepthOnly(GeometryNode* node, unsigned int transform, GLuint program, unsigned int lod)
+{
+	lod = std::min(lod, node->m_lod_count - 1);
+	for (unsigned int j = 0; j < node->parts.size(); j++)
+	{
+		DrawItem item;
+		item.program = program;
+		item.key = MakeKey(program, node->m_vao, 0, 0);
+		item.node = node;
+		item.part = j;
+		item.transform = transform;
+		item.lod = lod;
+		items.push_back(item);
+	}
+}
+
+void RenderQueue::Sort()
+{
+	// LSD radix sort on bytes, the passes where every key has the same byte are skipped
+	// (most of the key bits are zero in practice)
+	sorted_items.resize(items.size());
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		unsigned int histogram[257] = { 0 };
+		for (const DrawItem& item : items)
+			histogram[((item.key >> shift) & 0xFF) + 1]++;
+
+		bool single_bucket = false;
+		for (int b = 1; b < 257; b++)
+		{
+			if (histogram[b] == items.size())
+			{
+				single_bucket = true;
+				break;
+			}
+		}
+		if (single_bucket) continue;
+
+		// prefix sum gives the first slot of every bucket
+		for (int b = 1; b < 257; b++)
+			histogram[b] += histogram[b - 1];
+
+		for (const DrawItem& item : items)
+			sorted_items[histogram[(item.key >> shift) & 0xFF]++] = item;
+
+		items.swap(sorted_items);
+	}
+}
+
+void RenderQueue::BuildIndirectBatches(bool depth_only)
+{
+	indirect_commands.clear();
+	indirect_batches.clear();
+
+	for (const DrawItem& item : items)
+	{
+		const GeometryNode::Objects& part = item.node->parts[item.part];
+		const GeometryNode::Objects::Lod& lod = part.lods[item.lod];
+		GLuint texture = (depth_only) ? 0 : part.textureID;
+
+		if (indirect_batches.empty() || indirect_batches.back().program != item.program || indirect_batches.back().vao != item.node->m_vao || indirect_batches.back().texture != texture)
+		{
+			IndirectBatch batch;
+			batch.program = item.program;
+			batch.vao = item.node->m_vao;
+			batch.texture = texture;
+			batch.first_command = static_cast<unsigned int>(indirect_commands.size());
+			batch.command_count = 0;
+			indirect_batches.push_back(batch);
+		}
+
+		DrawElementsIndirectCommand command;
+		command.count = lod.count;
+		command.instanceCount = 1;
+		command.firstIndex = lod.start_offset;
+		command.baseVertex = item.node->m_base_vertex;
+		command.baseInstance = 0;
+		indirect_commands.push_back(command);
+		indirect_batches.back().command_count++;
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <vector>
+#include <cstdint>
+#include "GLEW\glew.h"
+#include "glm\glm.hpp"
+
+/* Queue of draw items for a single pass
+Every part of a submitted GeometryNode becomes a compact draw item with a 64-bit sort key
+packing program | vao | texture | material, so that after sorting the items that share GL state
+are adjacent and the pass can skip the redundant state changes.
+The key only decides the order, the executing pass still compares the actual GL names.
+*/
+class RenderQueue
+{
+public:
+	struct DrawItem
+	{
+		uint64_t key;
+		// the key only keeps the low bits of the program
+		GLuint program;
+		class GeometryNode* node;
+		unsigned int part;
+		// index of the model / normal matrix of the instance
+		unsigned int transform;
+		// level of detail of the part (see GeometryNode::Objects::lods)
+		unsigned int lod;
+	};
+
+	// layout of GL_DRAW_INDIRECT_BUFFER entries for glMultiDrawElementsIndirect
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		// must be zero without GL_ARB_base_instance
+		GLuint baseInstance;
+	};
+
+	// consecutive sorted items that can be submitted with a single multi draw call
+	struct IndirectBatch
+	{
+		GLuint program;
+		GLuint vao;
+		GLuint texture;
+		unsigned int first_command;
+		unsigned int command_count;
+	};
+
+	RenderQueue();
+	~RenderQueue();
+
+	// remove all the items, the storage is kept for the next frame
+	void Clear();
+
+	// store the matrices of an instance and return their index
+	unsigned int AddTransform(const glm::mat4& model_matrix, const glm::mat4& normal_matrix);
+
+	// add a draw item for every part of the node, or only for the parts with a non zero entry in visible_parts.
+	// The parts with a texture are drawn with textured_program. lod is clamped to the levels of the node
+	void Submit(class GeometryNode* node, unsigned int transform, GLuint program, GLuint textured_program, const unsigned char* visible_parts = nullptr, unsigned int lod = 0);
+	// add a draw item for every part of the node, ignoring textures and materials (depth only passes)
+	void SubmitDepthOnly(class GeometryNode* node, unsigned int transform, GLuint program, unsigned int lod = 0);
+
+	// radix sort the items by their key
+	void Sort();
+
+	// build one indirect command per sorted item and group them into batches sharing the program and the vao
+	// (and the texture, unless the pass is depth only). Command i belongs to item i.
+	void BuildIndirectBatches(bool depth_only);
+
+	const std::vector<DrawItem>& GetItems() const { return items; }
+	const glm::mat4& GetModelMatrix(unsigned int transform) const { return model_matrices[transform]; }
+	const glm::mat4& GetNormalMatrix(unsigned int transform) const { return normal_matrices[transform]; }
+	const std::vector<DrawElementsIndirectCommand>& GetIndirectCommands() const { return indirect_commands; }
+	const std::vector<IndirectBatch>& GetIndirectBatches() const { return indirect_batches; }
+
+	// build the sort key, every field is truncated to its bit range
+	static uint64_t MakeKey(GLuint program, GLuint vao, GLuint texture, unsigned int material);
+
+private:
+	std::vector<DrawItem> items;
+	// scratch buffer of the radix sort
+	std::vector<DrawItem> sorted_items;
+
+	std::vector<glm::mat4> model_matrices;
+	std::vector<glm::mat4> normal_matrices;
+
+	std::vector<DrawElementsIndirectCommand> indirect_commands;
+	std::vector<IndirectBatch> indirect_batches;
+};
+
+#endif
@@ -1,12 +1,42 @@
 #include "Renderer.h"
 #include "GeometryNode.h"
+#include "GeometryArena.h"
 #include "Tools.h"
 #include <algorithm>
 #include "ShaderProgram.h"
+#include "MaterialTable.h"
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "OBJLoader.h"
+#include "CookedMesh.h"
+#include "CookedTexture.h"
+#include "GeometricMesh.h"
+#include "AssetLoader.h"
+#include "TextureManager.h"
+#include <memory>
+#include <map>
+#include <chrono>
 #include <iostream>
+#include <climits>
+#include <cfloat>
+
+// source meshes larger than this are cooked in blocks instead of being loaded in memory
+#define STREAMING_COOK_MIN_BYTES (256ull * 1024 * 1024)
+
+// time spent on asset uploads per frame
+#define ASSET_UPLOAD_BUDGET_MS 4.0f
+
+// largest projected simplification error (in pixels) of the level of detail of an object,
+// the shadow casters can be coarser since the shadow map is filtered
+#define LOD_PIXEL_ERROR 1.0f
+#define SHADOW_LOD_PIXEL_ERROR 4.0f
+// margin of the current level of an object, so that it switches at different distances going closer and away
+#define LOD_HYSTERESIS 0.25f
+
+// frames averaged in the GPU timings of a shadow filter
+#define TIMING_REPORT_FRAMES 120
+
+static const char* shadow_filter_names[] = { "PCF 5x5", "hardware PCF", "rotated poisson", "VSM" };
 
 // RENDERER
 Renderer::Renderer()
@@ -18,6 +48,25 @@ Renderer::Renderer()
 	m_fbo = 0;
 	m_fbo_texture = 0;
 
+	m_multi_draw_indirect = false;
+	m_static_shadows_valid = false;
+	m_static_shadows_version = 0;
+	m_scene_tree_fit = false;
+	m_shadow_filter = SHADOW_FILTER_PCF5X5;
+	m_shaded_variant = 0;
+	for (int filter = 0; filter < SHADOW_FILTER_COUNT; filter++)
+	{
+		for (int section = 0; section < TIMER_SECTION_COUNT; section++)
+			m_shadow_filter_times[filter][section] = 0.0f;
+		m_shadow_filter_frames[filter] = 0;
+	}
+	m_draw_indirect_buffer = 0;
+	m_draw_data_buffer = 0;
+	m_draw_data_texture = 0;
+
+	m_assets_loaded = false;
+	m_assets_failed = 0;
+	m_textures_packed = false;
 
 	m_terrain = nullptr;
 	m_road = nullptr;
@@ -38,6 +87,7 @@ Renderer::Renderer()
 
 
 	InitializeArrays();
+	InitSceneTree();
 
 	
 
@@ -50,6 +100,8 @@ Renderer::Renderer()
 
 Renderer::~Renderer()
 {
+	// the jobs and uploads still in flight reference the nodes
+	AssetLoader::GetInstance().Shutdown();
 
 	glDeleteTextures(1, &m_fbo_texture);
 	glDeleteFramebuffers(1, &m_fbo);
@@ -57,6 +109,10 @@ Renderer::~Renderer()
 	glDeleteVertexArrays(1, &m_vao_fbo);
 	glDeleteBuffers(1, &m_vbo_fbo_vertices);
 
+	glDeleteBuffers(1, &m_draw_indirect_buffer);
+	glDeleteBuffers(1, &m_draw_data_buffer);
+	glDeleteTextures(1, &m_draw_data_texture);
+
 
 	delete m_terrain;
 	delete m_road;
@@ -70,6 +126,10 @@ Renderer::~Renderer()
 	delete m_pirate_lfoot;
 	delete m_pirate_rfoot;
 
+	// the nodes only reference the shared geometry buffers
+	GeometryArena::GetInstance().Clear();
+	MaterialTable::GetInstance().Clear();
+
 
 	
 }
@@ -100,7 +160,17 @@ bool Renderer::Init(int SCREEN_WIDTH, int SCREEN_HEIGHT)
 	// open the viewport
 	glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT); //we set up our viewport
 
+	// use multi draw indirect when available, the per draw data are indexed with gl_DrawIDARB
+	m_multi_draw_indirect = GLEW_ARB_draw_indirect && GLEW_ARB_multi_draw_indirect && GLEW_ARB_shader_draw_parameters;
+	printf("Multi draw indirect path: %s\n", (m_multi_draw_indirect) ? "enabled" : "not supported, using glDrawElementsBaseVertex");
+
+	// the textures are cooked with the full mip chain, compressed when the blocks can be sampled
+	TextureManager::GetInstance().SetCompression(GLEW_EXT_texture_compression_s3tc != 0);
+	printf("Texture compression: %s\n", (TextureManager::GetInstance().GetCompression()) ? "BC1 / BC3" : "not supported, using RGB / RGBA");
+
+	ShaderProgram::InitParallelCompile();
 	bool techniques_initialization = InitRenderingTechniques();
+	m_gpu_timer.Init(TIMER_SECTION_COUNT);
 	bool buffers_initialization = InitIntermediateShaderBuffers();
 	bool items_initialization = InitCommonItems();
 	bool lights_sources_initialization = InitLightSources();
@@ -148,41 +218,6 @@ void Renderer::Update(float dt)
 
 	m_continous_time += dt;
 
-	m_terrain_transformation_matrix = glm::scale(glm::mat4(1.f), glm::vec3(20, 1, 20));
-	m_terrain_transformation_matrix *= glm::translate(glm::mat4(1.f), glm::vec3(1, -2.5, 1));
-	m_terrain_transformation_normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(m_terrain_transformation_matrix))));
-
-	for (int i = 0; i < 30; i++) {
-
-	m_road_transformation_matrix[i] = glm::scale(glm::mat4(1.f), glm::vec3(2, 1, 2));
-	m_road_transformation_matrix[i] *= glm::translate(glm::mat4(1.f), glm::vec3(2* m_tile_positions[i].x+1, -2.49, 2*m_tile_positions[i].y+1));
-	m_road_transformation_normal_matrix[i] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(m_road_transformation_matrix[i]))));
-	}
-
-	if (m_treasure_chest_exists[0]) {
-		m_treasure_chest_transformation_matrix[0] = glm::translate(glm::mat4(1.f), m_treasure_chest_positions[0]);
-		m_treasure_chest_transformation_matrix[0] *= glm::scale(glm::mat4(1.f), glm::vec3(0.09));
-		m_treasure_chest_transformation_matrix[0] *= glm::translate(glm::mat4(1.f), glm::vec3(0.1760, -0.0226, 8.0619));
-		m_treasure_chest_transformation_normal_matrix[0] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(m_treasure_chest_transformation_matrix[0]))));
-	}
-
-	if(m_treasure_chest_exists[1]) {
-		m_treasure_chest_transformation_matrix[1] = glm::translate(glm::mat4(1.f), m_treasure_chest_positions[1]);
-		m_treasure_chest_transformation_matrix[1] *= glm::scale(glm::mat4(1.f), glm::vec3(0.09));
-		m_treasure_chest_transformation_matrix[1] *= glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(0, 1, 0));
-		m_treasure_chest_transformation_matrix[1] *= glm::translate(glm::mat4(1.f), glm::vec3(0.1760, -0.0226, 8.0619));
-		m_treasure_chest_transformation_normal_matrix[1] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(m_treasure_chest_transformation_matrix[1]))));
-	}
-
-	if (m_treasure_chest_exists[2]) {
-		m_treasure_chest_transformation_matrix[2] = glm::translate(glm::mat4(1.f), m_treasure_chest_positions[2]);
-		m_treasure_chest_transformation_matrix[2] *= glm::scale(glm::mat4(1.f), glm::vec3(0.09));
-		m_treasure_chest_transformation_matrix[2] *= glm::rotate(glm::mat4(1.f), glm::radians(-90.f), glm::vec3(0, 1, 0));
-		m_treasure_chest_transformation_matrix[2] *= glm::translate(glm::mat4(1.f), glm::vec3(0.1760, -0.0226, 8.0619));
-		m_treasure_chest_transformation_normal_matrix[2] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(m_treasure_chest_transformation_matrix[2]))));
-	}
-	
-
 	glm::mat4 standard_tower = glm::scale(glm::mat4(1.f), glm::vec3(0.4))
 							 * glm::translate(glm::mat4(1.f), glm::vec3(2.6035, 0.0626, 2.6373));
 
@@ -235,8 +270,20 @@ bool Renderer::InitCommonItems()
 
 	glBindVertexArray(0);
 
-	return true;
-
+	// buffers of the multi draw indirect path
+	if (m_multi_draw_indirect)
+	{
+		glGenBuffers(1, &m_draw_indirect_buffer);
+		glGenBuffers(1, &m_draw_data_buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, m_draw_data_buffer);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		glGenTextures(1, &m_draw_data_texture);
+		glBindTexture(GL_TEXTURE_BUFFER, m_draw_data_texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_draw_data_buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
 
 	return true;
 }
@@ -251,63 +298,106 @@ bool Renderer::InitRenderingTechniques()
 	std::string fragment_shader_path = "../Data/Shaders/basic_rendering.frag";
 	m_basic_geometry_rendering_program.LoadVertexShaderFromFile(vertex_shader_path.c_str());
 	m_basic_geometry_rendering_program.LoadFragmentShaderFromFile(fragment_shader_path.c_str());
-	initialized = m_basic_geometry_rendering_program.CreateProgram();
-	m_basic_geometry_rendering_program.LoadUniform("uniform_projection_matrix");
-	m_basic_geometry_rendering_program.LoadUniform("uniform_view_matrix");
-	m_basic_geometry_rendering_program.LoadUniform("uniform_model_matrix");
-	m_basic_geometry_rendering_program.LoadUniform("uniform_texture");
-	m_basic_geometry_rendering_program.LoadUniform("uniform_color");
+	m_basic_geometry_rendering_program.BeginCreateProgram();
+	m_basic_geometry_rendering_program.LoadUniform(BASIC_PROJECTION_MATRIX, "uniform_projection_matrix");
+	m_basic_geometry_rendering_program.LoadUniform(BASIC_VIEW_MATRIX, "uniform_view_matrix");
+	m_basic_geometry_rendering_program.LoadUniform(BASIC_MODEL_MATRIX, "uniform_model_matrix");
+	m_basic_geometry_rendering_program.LoadUniform(BASIC_TEXTURE, "uniform_texture");
+	m_basic_geometry_rendering_program.LoadUniform(BASIC_TEXTURE_LAYER, "uniform_texture_layer");
+	m_basic_geometry_rendering_program.LoadUniform(BASIC_COLOR, "uniform_color");
 
 
 
 	//Geometry Rendering with Illumination + Shadows
+	// one source, the variants are compiled with the features of PROGRAM_VARIANT defined
 	vertex_shader_path = "../Data/Shaders/basic_shadowed_rendering.vert";
 	fragment_shader_path = "../Data/Shaders/basic_shadowed_rendering.frag";
-	m_shadowed_geometry_rendering_program.LoadVertexShaderFromFile(vertex_shader_path.c_str());
-	m_shadowed_geometry_rendering_program.LoadFragmentShaderFromFile(fragment_shader_path.c_str());
-	initialized = m_shadowed_geometry_rendering_program.CreateProgram();
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_projection_matrix");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_view_matrix");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_model_matrix");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_normal_matrix");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_diffuse");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_specular");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_shininess");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_has_texture");
-	m_shadowed_geometry_rendering_program.LoadUniform("diffuse_texture");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_camera_position");
+	m_shadowed_geometry_rendering_programs.LoadShadersFromFile(vertex_shader_path.c_str(), fragment_shader_path.c_str());
+	m_shadowed_geometry_rendering_programs.AddFeature("INSTANCED");
+	m_shadowed_geometry_rendering_programs.AddFeature("SHADOWS");
+	m_shadowed_geometry_rendering_programs.AddFeature("TEXTURED");
+	m_shadowed_geometry_rendering_programs.AddFeature("PCF_MODE", 2);
+
+	// the variants share the uniform handles
+	ShaderPermutations& shadowed_programs = m_shadowed_geometry_rendering_programs;
+	shadowed_programs.LoadUniform(SHADOWED_PROJECTION_MATRIX, "uniform_projection_matrix");
+	shadowed_programs.LoadUniform(SHADOWED_VIEW_MATRIX, "uniform_view_matrix");
+	shadowed_programs.LoadUniform(SHADOWED_MODEL_MATRIX, "uniform_model_matrix");
+	shadowed_programs.LoadUniform(SHADOWED_NORMAL_MATRIX, "uniform_normal_matrix");
+	shadowed_programs.LoadUniform(SHADOWED_MATERIAL_INDEX, "uniform_material_index");
+	shadowed_programs.BindUniformBlock("MaterialTable", MaterialTable::BINDING);
+	shadowed_programs.LoadUniform(SHADOWED_DIFFUSE_TEXTURE, "diffuse_texture");
+	shadowed_programs.LoadUniform(SHADOWED_CAMERA_POSITION, "uniform_camera_position");
 	// Light Source Uniforms
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_light_projection_matrix");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_light_view_matrix");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_light_position");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_light_direction");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_light_color");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_light_umbra");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_light_penumbra");
-	m_shadowed_geometry_rendering_program.LoadUniform("uniform_cast_shadows");
-	m_shadowed_geometry_rendering_program.LoadUniform("shadowmap_texture");
+	shadowed_programs.LoadUniform(SHADOWED_LIGHT_PROJECTION_MATRIX, "uniform_light_projection_matrix");
+	shadowed_programs.LoadUniform(SHADOWED_LIGHT_VIEW_MATRIX, "uniform_light_view_matrix");
+	shadowed_programs.LoadUniform(SHADOWED_LIGHT_POSITION, "uniform_light_position");
+	shadowed_programs.LoadUniform(SHADOWED_LIGHT_DIRECTION, "uniform_light_direction");
+	shadowed_programs.LoadUniform(SHADOWED_LIGHT_COLOR, "uniform_light_color");
+	shadowed_programs.LoadUniform(SHADOWED_LIGHT_UMBRA, "uniform_light_umbra");
+	shadowed_programs.LoadUniform(SHADOWED_LIGHT_PENUMBRA, "uniform_light_penumbra");
+	shadowed_programs.LoadUniform(SHADOWED_SHADOWMAP_TEXTURE, "shadowmap_texture");
+	shadowed_programs.LoadUniform(SHADOWED_SHADOWMAP_COMPARE_TEXTURE, "shadowmap_compare_texture");
+	shadowed_programs.LoadUniform(SHADOWED_SHADOWMAP_MOMENTS_TEXTURE, "shadowmap_moments_texture");
+	// Multi Draw Indirect Uniforms
+	shadowed_programs.LoadUniform(SHADOWED_DRAW_DATA, "uniform_draw_data");
+	shadowed_programs.LoadUniform(SHADOWED_DRAW_OFFSET, "uniform_draw_offset");
+
+	// issue all the variants that the settings can select, switching the filter or the shadows must not stall a frame.
+	// The PCF 5x5 ones are waited for below, the others finish in the background (see GetShadedVariant)
+	unsigned int instanced = (m_multi_draw_indirect) ? VARIANT_INSTANCED : 0;
+	for (unsigned int textured = 0; textured <= VARIANT_TEXTURED; textured += VARIANT_TEXTURED)
+	{
+		shadowed_programs.Begin(instanced | textured);
+		for (unsigned int filter = 0; filter < SHADOW_FILTER_COUNT; filter++)
+			shadowed_programs.Begin(instanced | textured | VARIANT_SHADOWS | (filter << VARIANT_PCF_MODE_SHIFT));
+	}
 
 	// Post Processing Program
 	vertex_shader_path = "../Data/Shaders/postproc.vert";
 	fragment_shader_path = "../Data/Shaders/postproc.frag";
 	m_postprocess_program.LoadVertexShaderFromFile(vertex_shader_path.c_str());
 	m_postprocess_program.LoadFragmentShaderFromFile(fragment_shader_path.c_str());
-	initialized = initialized && m_postprocess_program.CreateProgram();
-	m_postprocess_program.LoadUniform("uniform_texture");
-	m_postprocess_program.LoadUniform("uniform_time");
-	m_postprocess_program.LoadUniform("uniform_depth");
-	m_postprocess_program.LoadUniform("uniform_projection_inverse_matrix");
+	m_postprocess_program.BeginCreateProgram();
+	m_postprocess_program.LoadUniform(POSTPROC_TEXTURE, "uniform_texture");
+	m_postprocess_program.LoadUniform(POSTPROC_TIME, "uniform_time");
+	m_postprocess_program.LoadUniform(POSTPROC_DEPTH, "uniform_depth");
+	m_postprocess_program.LoadUniform(POSTPROC_PROJECTION_INVERSE_MATRIX, "uniform_projection_inverse_matrix");
+
+	// Shadow moments prefilter Program, a full screen pass at the resolution of the shadow map
+	vertex_shader_path = "../Data/Shaders/postproc.vert";
+	fragment_shader_path = "../Data/Shaders/shadow_moments.frag";
+	m_shadow_moments_program.LoadVertexShaderFromFile(vertex_shader_path.c_str());
+	m_shadow_moments_program.LoadFragmentShaderFromFile(fragment_shader_path.c_str());
+	m_shadow_moments_program.BeginCreateProgram();
+	m_shadow_moments_program.LoadUniform(SHADOW_MOMENTS_TEXTURE, "uniform_texture");
+	m_shadow_moments_program.LoadUniform(SHADOW_MOMENTS_FROM_DEPTH, "uniform_from_depth");
+	m_shadow_moments_program.LoadUniform(SHADOW_MOMENTS_DIRECTION, "uniform_direction");
+	m_shadow_moments_program.LoadUniform(SHADOW_MOMENTS_NEAR, "uniform_near");
+	m_shadow_moments_program.LoadUniform(SHADOW_MOMENTS_FAR, "uniform_far");
 
 	// Shadow mapping Program
 	vertex_shader_path = "../Data/Shaders/shadow_map_rendering.vert";
 	fragment_shader_path = "../Data/Shaders/shadow_map_rendering.frag";
-	m_spot_light_shadow_map_program.LoadVertexShaderFromFile(vertex_shader_path.c_str());
-	m_spot_light_shadow_map_program.LoadFragmentShaderFromFile(fragment_shader_path.c_str());
-	initialized = initialized && m_spot_light_shadow_map_program.CreateProgram();
-	m_spot_light_shadow_map_program.LoadUniform("uniform_projection_matrix");
-	m_spot_light_shadow_map_program.LoadUniform("uniform_view_matrix");
-	m_spot_light_shadow_map_program.LoadUniform("uniform_model_matrix");
-
+	m_spot_light_shadow_map_programs.LoadShadersFromFile(vertex_shader_path.c_str(), fragment_shader_path.c_str());
+	m_spot_light_shadow_map_programs.AddFeature("INSTANCED");
+	m_spot_light_shadow_map_programs.LoadUniform(SHADOW_MAP_PROJECTION_MATRIX, "uniform_projection_matrix");
+	m_spot_light_shadow_map_programs.LoadUniform(SHADOW_MAP_VIEW_MATRIX, "uniform_view_matrix");
+	m_spot_light_shadow_map_programs.LoadUniform(SHADOW_MAP_MODEL_MATRIX, "uniform_model_matrix");
+	m_spot_light_shadow_map_programs.LoadUniform(SHADOW_MAP_DRAW_DATA, "uniform_draw_data");
+	m_spot_light_shadow_map_programs.LoadUniform(SHADOW_MAP_DRAW_OFFSET, "uniform_draw_offset");
+	m_spot_light_shadow_map_programs.Begin(instanced);
+
+	// everything is issued, now wait for the programs of the first frame
+	initialized = initialized && m_basic_geometry_rendering_program.FinishProgram();
+	initialized = initialized && m_postprocess_program.FinishProgram();
+	initialized = initialized && m_shadow_moments_program.FinishProgram();
+	initialized = initialized && m_spot_light_shadow_map_programs.Create(instanced);
+	for (unsigned int textured = 0; textured <= VARIANT_TEXTURED; textured += VARIANT_TEXTURED)
+	{
+		initialized = initialized && shadowed_programs.Create(instanced | textured);
+		initialized = initialized && shadowed_programs.Create(instanced | textured | VARIANT_SHADOWS | (SHADOW_FILTER_PCF5X5 << VARIANT_PCF_MODE_SHIFT));
+	}
 
 	return initialized;
 }
@@ -316,9 +406,10 @@ bool Renderer::ReloadShaders()
 {
 	bool reloaded = true;
 	// rendering techniques
-	reloaded = reloaded && m_shadowed_geometry_rendering_program.ReloadProgram();
+	reloaded = reloaded && m_shadowed_geometry_rendering_programs.ReloadPrograms();
 	reloaded = reloaded && m_postprocess_program.ReloadProgram();
-	reloaded = reloaded && m_spot_light_shadow_map_program.ReloadProgram();
+	reloaded = reloaded && m_shadow_moments_program.ReloadProgram();
+	reloaded = reloaded && m_spot_light_shadow_map_programs.ReloadPrograms();
 
 	return reloaded;
 }
@@ -389,123 +480,178 @@ bool Renderer::InitLightSources()
 
 bool Renderer::InitGeometricMeshes()
 {
-	bool initialized = true;
-	OBJLoader loader;
-	// load geometric object 1
-	auto mesh = loader.load("../Data/Terrain/terrain.obj");
+	// the meshes are cooked / parsed and their textures cooked on the AssetLoader workers
+	m_assets_load_start = std::chrono::steady_clock::now();
+	m_assets_loaded = false;
+	m_assets_failed = 0;
+	m_textures_packed = false;
+
+	m_terrain = LoadGeometryNode("../Data/Terrain/terrain.obj");
+	m_road = LoadGeometryNode("../Data/Terrain/road.obj");
+	m_treasure_chest = LoadGeometryNode("../Data/Treasure/treasure_chest.obj");
+	m_green_plane = LoadGeometryNode("../Data/Various/plane_green.obj");
+	m_red_plane = LoadGeometryNode("../Data/Various/plane_red.obj");
+	m_tower = LoadGeometryNode("../Data/MedievalTower/tower.obj");
+	m_cannonball = LoadGeometryNode("../Data/Various/cannonball.obj");
+	m_pirate_body = LoadGeometryNode("../Data/Pirate/pirate_body.obj");
+	m_pirate_rarm = LoadGeometryNode("../Data/Pirate/pirate_arm.obj");
+	m_pirate_rfoot = LoadGeometryNode("../Data/Pirate/pirate_right_foot.obj");
+	m_pirate_lfoot = LoadGeometryNode("../Data/Pirate/pirate_left_foot.obj");
 
-	if (mesh != nullptr)
-	{
-		m_terrain = new GeometryNode();
-		m_terrain->Init(mesh);
-	}
-	else
-		initialized = false;
-	delete mesh;
+	return true;
+}
 
-	mesh = loader.load("../Data/Terrain/road.obj");
-	if (mesh != nullptr)
+// open the cooked cache of a mesh, cooking it first if it is missing or stale.
+// If the cache can not be written the parsed mesh is returned instead. Runs on the AssetLoader workers
+static bool cookGeometry(const char* filename, CookedMesh& cooked, std::shared_ptr<GeometricMesh>& mesh)
+{
+	std::string cache_filename = CookedMesh::GetCacheFilename(filename);
+	if (cooked.Open(cache_filename.c_str()))
 	{
-		m_road = new GeometryNode();
-		m_road->Init(mesh);
+		printf("Loaded cooked mesh %s\n", cache_filename.c_str());
+		return true;
 	}
-	else
-		initialized = false;
-	delete mesh;
 
-	mesh = loader.load("../Data/Treasure/treasure_chest.obj");
-
-	if (mesh != nullptr)
+	OBJLoader loader;
+	int64_t modification_time;
+	uint64_t source_size;
+	if (Tools::GetFileInfo(filename, modification_time, source_size) && source_size >= STREAMING_COOK_MIN_BYTES)
 	{
-		m_treasure_chest = new GeometryNode;
-		m_treasure_chest->Init(mesh);
+		// too large to go through a GeometricMesh, there is no fallback without the cache
+		if (loader.cookStreaming(filename, cache_filename.c_str()) && cooked.Open(cache_filename.c_str()))
+			return true;
+		printf("Could not cook %s\n", cache_filename.c_str());
+		return false;
 	}
-	else
-		initialized = false;
-	delete mesh;
-
 
-	mesh = loader.load("../Data/Various/plane_green.obj");
+	mesh.reset(loader.load(filename));
+	if (!mesh)
+		return false;
 
-	if (mesh != nullptr)
+	std::vector<std::string> dependencies(1, filename);
+	dependencies.insert(dependencies.end(), loader.getMaterialFiles().begin(), loader.getMaterialFiles().end());
+	if (CookedMesh::Cook(cache_filename.c_str(), mesh.get(), dependencies) && cooked.Open(cache_filename.c_str()))
 	{
-		m_green_plane = new GeometryNode();
-		m_green_plane->Init(mesh);
+		mesh.reset();
+		return true;
 	}
-	else
-		initialized = false;
-	delete mesh;
-
-	mesh = loader.load("../Data/Various/plane_red.obj");
 
-	if (mesh != nullptr)
-	{
-		m_red_plane = new GeometryNode();
-		m_red_plane->Init(mesh);
-	}
-	else
-		initialized = false;
-	delete mesh;
+	// no cache (e.g. read only data folder), upload the parsed mesh
+	printf("Could not cook %s\n", cache_filename.c_str());
+	return true;
+}
 
-	mesh = loader.load("../Data/MedievalTower/tower.obj");
+GeometryNode* Renderer::LoadGeometryNode(const char* filename)
+{
+	GeometryNode* node = new GeometryNode();
+	m_loading_nodes.push_back(node);
 
-	if (mesh != nullptr)
+	std::string source(filename);
+	AssetLoader::GetInstance().SubmitJob([node, source]()
 	{
-		m_tower = new GeometryNode();
-		m_tower->Init(mesh);
-	}
-	else
-		initialized = false;
-	delete mesh;
+		AssetLoader& loader = AssetLoader::GetInstance();
+		std::shared_ptr<CookedMesh> cooked = std::make_shared<CookedMesh>();
+		std::shared_ptr<GeometricMesh> mesh;
+		if (!cookGeometry(source.c_str(), *cooked, mesh))
+		{
+			loader.SubmitUpload([node]() { node->SetLoadFailed(); });
+			return;
+		}
 
-	mesh = loader.load("../Data/Various/cannonball.obj");
+		// cook the textures of the parts here, they are packed and uploaded once all the meshes are loaded (see PackTextures)
+		std::vector<std::string> textures;
+		if (cooked->IsOpen())
+		{
+			for (unsigned int i = 0; i < cooked->GetHeader().part_count; i++)
+				textures.push_back(cooked->GetMaterials()[cooked->GetParts()[i].material].texture);
+		}
+		else
+		{
+			for (const GeometricMesh::MeshObject& object : mesh->objects)
+				textures.push_back(mesh->materials[object.material_id].texture);
+		}
+		std::sort(textures.begin(), textures.end());
+		textures.erase(std::unique(textures.begin(), textures.end()), textures.end());
+		for (const std::string& texture : textures)
+		{
+			CookedTexture cooked_texture;
+			if (!texture.empty()) cooked_texture.Load(texture.c_str(), TextureManager::GetInstance().GetCompression());
+		}
 
-	if (mesh != nullptr)
-	{
-		m_cannonball = new GeometryNode();
-		m_cannonball->Init(mesh);
-	}
-	else
-		initialized = false;
-	delete mesh;
+		// the cooked streams are uploaded straight from the mapping, which is closed with the last reference
+		loader.SubmitUpload([node, cooked, mesh]()
+		{
+			if (cooked->IsOpen()) node->Init(*cooked);
+			else node->Init(mesh.get());
+		});
+	});
+	return node;
+}
 
-	mesh = loader.load("../Data/Pirate/pirate_body.obj");
-	if (mesh != nullptr)
-	{
-		m_pirate_body = new GeometryNode();
-		m_pirate_body->Init(mesh);
-	}
-	else
-		initialized = false;
+void Renderer::UpdateAssetLoading()
+{
+	AssetLoader& loader = AssetLoader::GetInstance();
+	loader.ProcessUploads(ASSET_UPLOAD_BUDGET_MS);
+	if (m_assets_loaded || !loader.IsIdle())
+		return;
 
-	mesh = loader.load("../Data/Pirate/pirate_arm.obj");
-	if (mesh != nullptr)
+	// all the meshes are loaded, their textures are packed next
+	if (!m_textures_packed)
 	{
-		m_pirate_rarm = new GeometryNode();
-		m_pirate_rarm->Init(mesh);
+		m_textures_packed = true;
+		PackTextures();
+		return;
 	}
-	else
-		initialized = false;
 
-	mesh = loader.load("../Data/Pirate/pirate_right_foot.obj");
-	if (mesh != nullptr)
-	{
-		m_pirate_rfoot = new GeometryNode();
-		m_pirate_rfoot->Init(mesh);
-	}
-	else
-		initialized = false;
+	m_assets_loaded = true;
+	// the bounds of the nodes are known now
+	RebuildSceneTree();
+	for (GeometryNode* node : m_loading_nodes)
+		if (!node->IsReady()) m_assets_failed++;
+	m_loading_nodes.clear();
+
+	float elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_assets_load_start).count();
+	printf("Loaded the geometric meshes in %.1f ms (%u failed)\n", elapsed, m_assets_failed);
+	GeometryArena::GetInstance().PrintStatistics();
+	TextureManager::GetInstance().PrintStatistics();
+}
 
-	mesh = loader.load("../Data/Pirate/pirate_left_foot.obj");
-	if (mesh != nullptr)
+void Renderer::PackTextures()
+{
+	// the parts that use every texture
+	std::shared_ptr<std::map<std::string, std::vector<std::pair<GeometryNode*, unsigned int>>>> users = std::make_shared<std::map<std::string, std::vector<std::pair<GeometryNode*, unsigned int>>>>();
+	for (GeometryNode* node : m_loading_nodes)
+		for (unsigned int i = 0; i < node->parts.size(); i++)
+			if (!node->parts[i].texture_filename.empty())
+				(*users)[node->parts[i].texture_filename].push_back(std::make_pair(node, i));
+
+	std::vector<std::string> filenames;
+	for (const auto& entry : *users)
+		filenames.push_back(entry.first);
+	AssetLoader::GetInstance().SubmitJob([filenames, users]()
 	{
-		m_pirate_lfoot = new GeometryNode();
-		m_pirate_lfoot->Init(mesh);
-	}
-	else
-		initialized = false;
+		TextureManager::GetInstance().RequestTextureArraysAsync(filenames, true, [users](const std::string& filename, TextureHandle handle, int layer)
+		{
+			for (const std::pair<GeometryNode*, unsigned int>& user : (*users)[filename])
+			{
+				GeometryNode::Objects& part = user.first->parts[user.second];
+				part.texture = handle;
+				part.textureID = handle.GetID();
+				part.texture_layer = layer;
+				MaterialTable::GetInstance().SetTextureLayer(part.material_index, layer);
+			}
+		});
+	});
+}
 
-	return initialized;
+bool Renderer::AssetsLoaded() const
+{
+	return m_assets_loaded;
+}
+
+unsigned int Renderer::GetFailedAssetCount() const
+{
+	return m_assets_failed;
 }
 
 void Renderer::SetRenderingMode(RENDERING_MODE mode)
@@ -513,12 +659,43 @@ void Renderer::SetRenderingMode(RENDERING_MODE mode)
 	m_rendering_mode = mode;
 }
 
+void Renderer::SetShadowFilter(SHADOW_FILTER filter)
+{
+	m_shadow_filter = filter;
+	printf("Shadow filter: %s\n", shadow_filter_names[filter]);
+}
+
+void Renderer::CycleShadowFilter()
+{
+	SetShadowFilter(static_cast<SHADOW_FILTER>((m_shadow_filter + 1) % SHADOW_FILTER_COUNT));
+}
+
 void Renderer::Render()
 {
+	UpdateAssetLoading();
+	MaterialTable::GetInstance().Update();
+	UpdateGpuTimings();
+	m_shadowed_geometry_rendering_programs.Update();
+	m_gpu_timer.BeginFrame(m_shadow_filter);
+
+	QueryVisibleObjects();
+
+	m_gpu_timer.Begin(TIMER_SHADOW_MAP);
 	RenderShadowMaps();
+	m_gpu_timer.End(TIMER_SHADOW_MAP);
+
+	// the variance shadow maps sample the blurred moments of the shadow map
+	if (m_shadow_filter == SHADOW_FILTER_VSM && m_spotlight_node.GetCastShadowsStatus())
+	{
+		m_gpu_timer.Begin(TIMER_SHADOW_PREFILTER);
+		PrefilterShadowMoments();
+		m_gpu_timer.End(TIMER_SHADOW_PREFILTER);
+	}
 
 	// Draw the geometry
+	m_gpu_timer.Begin(TIMER_GEOMETRY);
 	RenderGeometry();
+	m_gpu_timer.End(TIMER_GEOMETRY);
 
 	RenderToOutFB();
 
@@ -537,73 +714,276 @@ void Renderer::RenderShadowMaps()
 	{
 		int m_depth_texture_resolution = m_spotlight_node.GetShadowMapResolution();
 
-		// bind the framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, m_spotlight_node.GetShadowMapFBO());
 		glViewport(0, 0, m_depth_texture_resolution, m_depth_texture_resolution);
-		GLenum drawbuffers[1] = { GL_COLOR_ATTACHMENT0 };
-		glDrawBuffers(1, drawbuffers);
-
-		// clear depth buffer
-		glClear(GL_DEPTH_BUFFER_BIT);
 		glEnable(GL_DEPTH_TEST);
 
 		// Bind the shadow mapping program
-		m_spot_light_shadow_map_program.Bind();
+		ShaderProgram& program = m_spot_light_shadow_map_programs.Get((m_multi_draw_indirect) ? VARIANT_INSTANCED : 0);
+		program.Bind();
 
 		// pass the projection and view matrix to the uniforms
-		glUniformMatrix4fv(m_spot_light_shadow_map_program["uniform_projection_matrix"], 1, GL_FALSE, glm::value_ptr(m_spotlight_node.GetProjectionMatrix()));
-		glUniformMatrix4fv(m_spot_light_shadow_map_program["uniform_view_matrix"], 1, GL_FALSE, glm::value_ptr(m_spotlight_node.GetViewMatrix()));
+		glUniformMatrix4fv(program[SHADOW_MAP_PROJECTION_MATRIX], 1, GL_FALSE, glm::value_ptr(m_spotlight_node.GetProjectionMatrix()));
+		glUniformMatrix4fv(program[SHADOW_MAP_VIEW_MATRIX], 1, GL_FALSE, glm::value_ptr(m_spotlight_node.GetViewMatrix()));
 
-		//Terrain
-		DrawGeometryNodeToShadowMap(m_terrain, m_terrain_transformation_matrix, m_terrain_transformation_normal_matrix);
+		// only the casters in the cone of the light
+		m_light_frustum = Culling::ExtractFrustum(m_spotlight_node.GetProjectionMatrix() * m_spotlight_node.GetViewMatrix());
+		QuerySceneObjects(m_light_frustum, m_shadow_query);
 
-		//Road tiles
-		for (int i = 0; i < m_road_transformation_matrix.size(); i++) {
-			DrawGeometryNodeToShadowMap(m_road, m_road_transformation_matrix[i], m_road_transformation_normal_matrix[i]);
+		// redraw the static casters if they or the light changed, every frame while the nodes are loading
+		if (!m_static_shadows_valid || m_static_shadows_version != m_spotlight_node.GetShadowMapVersion())
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, m_spotlight_node.GetStaticShadowMapFBO());
+			GLenum drawbuffers[1] = { GL_COLOR_ATTACHMENT0 };
+			glDrawBuffers(1, drawbuffers);
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+			m_shadow_map_queue.Clear();
+			SubmitStaticShadowCasters();
+			m_shadow_map_queue.Sort();
+			if (m_multi_draw_indirect)
+				DrawShadowMapQueueIndirect();
+			else
+				DrawShadowMapQueue();
+
+			// kept once its casters were placed with the fit proxies
+			m_static_shadows_valid = m_scene_tree_fit;
+			m_static_shadows_version = m_spotlight_node.GetShadowMapVersion();
 		}
 
-		//Treasure chests
-		for (int i = 0; i < m_treasure_chest_transformation_matrix.size(); i++) {
-			DrawGeometryNodeToShadowMap(m_treasure_chest, m_treasure_chest_transformation_matrix[i], m_treasure_chest_transformation_normal_matrix[i]);
-		}
+		// start from a copy of the static depth and draw the moving casters over it
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, m_spotlight_node.GetStaticShadowMapFBO());
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_spotlight_node.GetShadowMapFBO());
+		glBlitFramebuffer(0, 0, m_depth_texture_resolution, m_depth_texture_resolution, 0, 0, m_depth_texture_resolution, m_depth_texture_resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_spotlight_node.GetShadowMapFBO());
+		GLenum drawbuffers[1] = { GL_COLOR_ATTACHMENT0 };
+		glDrawBuffers(1, drawbuffers);
 
-		//Cannonballs
+		m_shadow_map_queue.Clear();
+		SubmitDynamicShadowCasters();
+		m_shadow_map_queue.Sort();
+		if (m_multi_draw_indirect)
+			DrawShadowMapQueueIndirect();
+		else
+			DrawShadowMapQueue();
 
-		for (int i = 0; i < m_cannonball_transformation_matrix.size(); i++) {
-			if (m_cannonball_render[i])
-				DrawGeometryNodeToShadowMap(m_cannonball, m_cannonball_transformation_matrix[i], m_cannonball_transformation_normal_matrix[i]);
-		}
+		glBindVertexArray(0);
+
+		// Unbind shadow mapping program
+		program.Unbind();
 
-		//Towers
-		for (std::vector<glm::vec2>::iterator pos_it = m_placed_towers.begin(); pos_it != m_placed_towers.end(); ++pos_it) {
 
-			glm::mat4 model_matrix = glm::translate(glm::mat4(1.f), glm::vec3((*pos_it).x + 2, -2.47, (*pos_it).y + 2)) *glm::scale(glm::mat4(1.f), glm::vec3(0.4))
-				* glm::translate(glm::mat4(1.f), glm::vec3(0.0101, 0.0626, 0.0758));
+		glDisable(GL_DEPTH_TEST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+}
 
-			DrawGeometryNodeToShadowMap(m_tower, model_matrix, m_tower_transformation_normal_matrix);
+void Renderer::SubmitStaticShadowCasters()
+{
+	// the static layer is kept while the camera moves, so it has every caster of the light frustum
+	// (m_shadow_query holds every object until the proxies are fit, see QuerySceneObjects)
+	for (uint32_t object : m_shadow_query)
+	{
+		int type = static_cast<int>(object >> 24);
+		if (type != SCENE_CANNONBALL && type != SCENE_PIRATE)
+			SubmitSceneObjectToShadowMap(object, true);
+	}
+}
+
+void Renderer::SubmitDynamicShadowCasters()
+{
+	// a moving caster is drawn only if its shadow can fall on a visible receiver
+	glm::vec3 receiver_min, receiver_max;
+	glm::mat4 light_view_projection = m_spotlight_node.GetProjectionMatrix() * m_spotlight_node.GetViewMatrix();
+	bool cull_receivers = m_assets_loaded && GetShadowReceiverBounds(light_view_projection, receiver_min, receiver_max);
+
+	for (uint32_t object : m_shadow_query)
+	{
+		int type = static_cast<int>(object >> 24);
+		if (type != SCENE_CANNONBALL && type != SCENE_PIRATE)
+			continue;
+		if (cull_receivers)
+		{
+			glm::vec3 bounds_min, bounds_max, caster_min, caster_max;
+			GetSceneObjectBounds(static_cast<SCENE_OBJECT>(type), static_cast<int>(object & 0xFFFFFF), bounds_min, bounds_max);
+			if (Culling::ProjectAABB(light_view_projection, bounds_min, bounds_max, caster_min, caster_max) &&
+				!Culling::TestShadowReach(caster_min, caster_max, receiver_min, receiver_max))
+				continue;
 		}
+		SubmitSceneObjectToShadowMap(object, false);
+	}
+}
 
-		//Pirates
-		for (int i = 0; i < m_pirate_body_transformation_matrix.size(); i++) {
-			if (m_pirate_render[i]) {
-				DrawGeometryNodeToShadowMap(m_pirate_body, m_pirate_body_transformation_matrix[i], m_pirate_body_transformation_normal_matrix[i]);
-				DrawGeometryNodeToShadowMap(m_pirate_rarm, m_pirate_rarm_transformation_matrix[i], m_pirate_rarm_transformation_normal_matrix[i]);
-				DrawGeometryNodeToShadowMap(m_pirate_lfoot, m_pirate_lfoot_transformation_matrix[i], m_pirate_lfoot_transformation_normal_matrix[i]);
-				DrawGeometryNodeToShadowMap(m_pirate_rfoot, m_pirate_rfoot_transformation_matrix[i], m_pirate_rfoot_transformation_normal_matrix[i]);
+bool Renderer::GetShadowReceiverBounds(const glm::mat4& light_view_projection, glm::vec3& ndc_min, glm::vec3& ndc_max) const
+{
+	// world space bounds of the visible objects, only the visible parts of the terrain since it spans the whole map
+	glm::vec3 receiver_min(FLT_MAX), receiver_max(-FLT_MAX);
+	for (uint32_t object : m_scene_query)
+	{
+		int type = static_cast<int>(object >> 24);
+		int index = static_cast<int>(object & 0xFFFFFF);
+		glm::vec3 bounds_min, bounds_max;
+		if (type == SCENE_TERRAIN)
+		{
+			for (const GeometryNode::Objects& part : m_terrain->parts)
+			{
+				if (!Culling::TestAABB(m_camera_frustum, m_terrain_transformation_matrix, part.bounds_min, part.bounds_max))
+					continue;
+				Culling::TransformAABB(m_terrain_transformation_matrix, part.bounds_min, part.bounds_max, bounds_min, bounds_max);
+				receiver_min = glm::min(receiver_min, bounds_min);
+				receiver_max = glm::max(receiver_max, bounds_max);
 			}
+			continue;
 		}
+		if (type == SCENE_CANNONBALL && !m_cannonball_render[index])
+			continue;
+		if (type == SCENE_PIRATE && !m_pirate_render[index])
+			continue;
+		GetSceneObjectBounds(static_cast<SCENE_OBJECT>(type), index, bounds_min, bounds_max);
+		receiver_min = glm::min(receiver_min, bounds_min);
+		receiver_max = glm::max(receiver_max, bounds_max);
+	}
 
-		glBindVertexArray(0);
+	// nothing visible receives a shadow
+	if (receiver_min.x > receiver_max.x)
+	{
+		ndc_min = glm::vec3(FLT_MAX);
+		ndc_max = glm::vec3(-FLT_MAX);
+		return true;
+	}
+	return Culling::ProjectAABB(light_view_projection, receiver_min, receiver_max, ndc_min, ndc_max);
+}
 
-		// Unbind shadow mapping program
-		m_spot_light_shadow_map_program.Unbind();
+void Renderer::SubmitSceneObjectToShadowMap(uint32_t object, bool full_detail)
+{
+	int index = static_cast<int>(object & 0xFFFFFF);
+	switch (object >> 24)
+	{
+	case SCENE_TERRAIN:
+		SubmitGeometryNodeToShadowMap(m_terrain, m_terrain_transformation_matrix, m_terrain_transformation_normal_matrix, full_detail);
+		break;
+	case SCENE_ROAD:
+		SubmitGeometryNodeToShadowMap(m_road, m_road_transformation_matrix[index], m_road_transformation_normal_matrix[index], full_detail);
+		break;
+	case SCENE_TREASURE_CHEST:
+		SubmitGeometryNodeToShadowMap(m_treasure_chest, m_treasure_chest_transformation_matrix[index], m_treasure_chest_transformation_normal_matrix[index], full_detail);
+		break;
+	case SCENE_TOWER:
+	{
+		const glm::vec2& position = m_placed_towers[index];
+		glm::mat4 model_matrix = glm::translate(glm::mat4(1.f), glm::vec3(position.x + 2, -2.47, position.y + 2)) *glm::scale(glm::mat4(1.f), glm::vec3(0.4))
+			* glm::translate(glm::mat4(1.f), glm::vec3(0.0101, 0.0626, 0.0758));
+		SubmitGeometryNodeToShadowMap(m_tower, model_matrix, m_tower_transformation_normal_matrix, full_detail);
+		break;
+	}
+	case SCENE_CANNONBALL:
+		if (m_cannonball_render[index])
+			SubmitGeometryNodeToShadowMap(m_cannonball, m_cannonball_transformation_matrix[index], m_cannonball_transformation_normal_matrix[index], full_detail);
+		break;
+	case SCENE_PIRATE:
+		if (m_pirate_render[index]) {
+			SubmitGeometryNodeToShadowMap(m_pirate_body, m_pirate_body_transformation_matrix[index], m_pirate_body_transformation_normal_matrix[index], full_detail);
+			SubmitGeometryNodeToShadowMap(m_pirate_rarm, m_pirate_rarm_transformation_matrix[index], m_pirate_rarm_transformation_normal_matrix[index], full_detail);
+			SubmitGeometryNodeToShadowMap(m_pirate_lfoot, m_pirate_lfoot_transformation_matrix[index], m_pirate_lfoot_transformation_normal_matrix[index], full_detail);
+			SubmitGeometryNodeToShadowMap(m_pirate_rfoot, m_pirate_rfoot_transformation_matrix[index], m_pirate_rfoot_transformation_normal_matrix[index], full_detail);
+		}
+		break;
+	}
+}
 
 
-		glDisable(GL_DEPTH_TEST);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+unsigned int Renderer::GetShadedVariant()
+{
+	unsigned int variant = (m_multi_draw_indirect) ? VARIANT_INSTANCED : 0;
+	if (m_spotlight_node.GetCastShadowsStatus())
+	{
+		variant |= VARIANT_SHADOWS | (m_shadow_filter << VARIANT_PCF_MODE_SHIFT);
+		// the PCF 5x5 variants are ready since the start, they stand in while the others compile
+		if (!m_shadowed_geometry_rendering_programs.IsReady(variant) || !m_shadowed_geometry_rendering_programs.IsReady(variant | VARIANT_TEXTURED))
+			variant &= ~(3u << VARIANT_PCF_MODE_SHIFT);
 	}
+	return variant;
+}
+
+void Renderer::SetShadedFrameUniforms(ShaderProgram& program)
+{
+	program.Bind();
+
+	// pass the camera properties
+	glUniformMatrix4fv(program[SHADOWED_PROJECTION_MATRIX], 1, GL_FALSE, glm::value_ptr(m_projection_matrix));
+	glUniformMatrix4fv(program[SHADOWED_VIEW_MATRIX], 1, GL_FALSE, glm::value_ptr(m_view_matrix));
+	glUniform3f(program[SHADOWED_CAMERA_POSITION], m_camera_position.x, m_camera_position.y, m_camera_position.z);
+
+	// pass the light source parameters
+	glm::vec3 light_position = m_spotlight_node.GetPosition();
+	glm::vec3 light_direction = m_spotlight_node.GetDirection();
+	glm::vec3 light_color = m_spotlight_node.GetColor();
+	glUniformMatrix4fv(program[SHADOWED_LIGHT_PROJECTION_MATRIX], 1, GL_FALSE, glm::value_ptr(m_spotlight_node.GetProjectionMatrix()));
+	glUniformMatrix4fv(program[SHADOWED_LIGHT_VIEW_MATRIX], 1, GL_FALSE, glm::value_ptr(m_spotlight_node.GetViewMatrix()));
+	glUniform3f(program[SHADOWED_LIGHT_POSITION], light_position.x, light_position.y, light_position.z);
+	glUniform3f(program[SHADOWED_LIGHT_DIRECTION], light_direction.x, light_direction.y, light_direction.z);
+	glUniform3f(program[SHADOWED_LIGHT_COLOR], light_color.x, light_color.y, light_color.z);
+	glUniform1f(program[SHADOWED_LIGHT_UMBRA], m_spotlight_node.GetUmbra());
+	glUniform1f(program[SHADOWED_LIGHT_PENUMBRA], m_spotlight_node.GetPenumbra());
+
+	// shadow map on unit 1, through the comparison sampler on unit 3, moments on unit 4
+	glUniform1i(program[SHADOWED_SHADOWMAP_TEXTURE], 1);
+	glUniform1i(program[SHADOWED_SHADOWMAP_COMPARE_TEXTURE], 3);
+	glUniform1i(program[SHADOWED_SHADOWMAP_MOMENTS_TEXTURE], 4);
+	// diffuse texture array on unit 0, per draw data on unit 2
+	glUniform1i(program[SHADOWED_DIFFUSE_TEXTURE], 0);
+	glUniform1i(program[SHADOWED_DRAW_DATA], 2);
 }
 
+void Renderer::PrefilterShadowMoments()
+{
+	int resolution = m_spotlight_node.GetShadowMapResolution();
+	glViewport(0, 0, resolution, resolution);
+	glDisable(GL_DEPTH_TEST);
+
+	m_shadow_moments_program.Bind();
+	glBindVertexArray(m_vao_fbo);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(m_shadow_moments_program[SHADOW_MOMENTS_TEXTURE], 0);
+	glUniform1f(m_shadow_moments_program[SHADOW_MOMENTS_NEAR], m_spotlight_node.GetNearClippingRange());
+	glUniform1f(m_shadow_moments_program[SHADOW_MOMENTS_FAR], m_spotlight_node.GetFarClippingRange());
+
+	// separable blur, horizontal from the depth buffer to the moments [0] and vertical from [0] to [1]
+	for (int pass = 0; pass < 2; pass++)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, m_spotlight_node.GetShadowMomentsFBO(pass));
+		GLenum drawbuffers[1] = { GL_COLOR_ATTACHMENT0 };
+		glDrawBuffers(1, drawbuffers);
+		glBindTexture(GL_TEXTURE_2D, (pass == 0) ? m_spotlight_node.GetShadowMapDepthTexture() : m_spotlight_node.GetShadowMomentsTexture(0));
+		glUniform1i(m_shadow_moments_program[SHADOW_MOMENTS_FROM_DEPTH], (pass == 0) ? 1 : 0);
+		glUniform2f(m_shadow_moments_program[SHADOW_MOMENTS_DIRECTION], (pass == 0) ? 1.0f / resolution : 0.0f, (pass == 0) ? 0.0f : 1.0f / resolution);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindVertexArray(0);
+	m_shadow_moments_program.Unbind();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Renderer::UpdateGpuTimings()
+{
+	unsigned int filter;
+	while (m_gpu_timer.Resolve(filter, m_resolved_times))
+	{
+		for (int section = 0; section < TIMER_SECTION_COUNT; section++)
+			m_shadow_filter_times[filter][section] += m_resolved_times[section];
+		if (++m_shadow_filter_frames[filter] < TIMING_REPORT_FRAMES)
+			continue;
+
+		float frames = static_cast<float>(m_shadow_filter_frames[filter]);
+		printf("Shadow filter %s: shadow map %.3f ms, prefilter %.3f ms, geometry %.3f ms (GPU, average of %u frames)\n", shadow_filter_names[filter],
+			m_shadow_filter_times[filter][TIMER_SHADOW_MAP] / frames, m_shadow_filter_times[filter][TIMER_SHADOW_PREFILTER] / frames,
+			m_shadow_filter_times[filter][TIMER_GEOMETRY] / frames, m_shadow_filter_frames[filter]);
+		for (int section = 0; section < TIMER_SECTION_COUNT; section++)
+			m_shadow_filter_times[filter][section] = 0.0f;
+		m_shadow_filter_frames[filter] = 0;
+	}
+}
 
 void Renderer::RenderGeometry()
 {
@@ -631,82 +1011,43 @@ void Renderer::RenderGeometry()
 		break;
 	};
 
-	// Bind the shader program
-	m_shadowed_geometry_rendering_program.Bind();
-
-	// pass the camera properties
-	glUniformMatrix4fv(m_shadowed_geometry_rendering_program["uniform_projection_matrix"], 1, GL_FALSE, glm::value_ptr(m_projection_matrix));
-	glUniformMatrix4fv(m_shadowed_geometry_rendering_program["uniform_view_matrix"], 1, GL_FALSE, glm::value_ptr(m_view_matrix));
-	glUniform3f(m_shadowed_geometry_rendering_program["uniform_camera_position"], m_camera_position.x, m_camera_position.y, m_camera_position.z);
+	// the textured and untextured variant of the settings, the draws switch between them.
+	// Chosen once for the frame, a variant that becomes ready during it has no uniforms set yet
+	m_shaded_variant = GetShadedVariant();
+	SetShadedFrameUniforms(m_shadowed_geometry_rendering_programs.Get(m_shaded_variant));
+	SetShadedFrameUniforms(m_shadowed_geometry_rendering_programs.Get(m_shaded_variant | VARIANT_TEXTURED));
 
-	// pass the light source parameters
-	glm::vec3 light_position = m_spotlight_node.GetPosition();
-	glm::vec3 light_direction = m_spotlight_node.GetDirection();
-	glm::vec3 light_color = m_spotlight_node.GetColor();
-	glUniformMatrix4fv(m_shadowed_geometry_rendering_program["uniform_light_projection_matrix"], 1, GL_FALSE, glm::value_ptr(m_spotlight_node.GetProjectionMatrix()));
-	glUniformMatrix4fv(m_shadowed_geometry_rendering_program["uniform_light_view_matrix"], 1, GL_FALSE, glm::value_ptr(m_spotlight_node.GetViewMatrix()));
-	glUniform3f(m_shadowed_geometry_rendering_program["uniform_light_position"], light_position.x, light_position.y, light_position.z);
-	glUniform3f(m_shadowed_geometry_rendering_program["uniform_light_direction"], light_direction.x, light_direction.y, light_direction.z);
-	glUniform3f(m_shadowed_geometry_rendering_program["uniform_light_color"], light_color.x, light_color.y, light_color.z);
-	glUniform1f(m_shadowed_geometry_rendering_program["uniform_light_umbra"], m_spotlight_node.GetUmbra());
-	glUniform1f(m_shadowed_geometry_rendering_program["uniform_light_penumbra"], m_spotlight_node.GetPenumbra());
-	glUniform1i(m_shadowed_geometry_rendering_program["uniform_cast_shadows"], (m_spotlight_node.GetCastShadowsStatus()) ? 1 : 0);
-
-	// Set the sampler2D uniform to use texture unit 1
-	glUniform1i(m_shadowed_geometry_rendering_program["shadowmap_texture"], 1);
 	// Bind the shadow map texture to texture unit 1
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, (m_spotlight_node.GetCastShadowsStatus()) ? m_spotlight_node.GetShadowMapDepthTexture() : 0);
-
-	// Enable Texture Unit 0
-	glUniform1i(m_shadowed_geometry_rendering_program["diffuse_texture"], 0);
+	// the same texture through the comparison sampler on unit 3 (unit 2 has the draw data)
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, (m_spotlight_node.GetCastShadowsStatus()) ? m_spotlight_node.GetShadowMapDepthTexture() : 0);
+	glBindSampler(3, m_spotlight_node.GetShadowCompareSampler());
+	// the blurred moments on unit 4
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D, (m_spotlight_node.GetCastShadowsStatus()) ? m_spotlight_node.GetShadowMomentsTexture(1) : 0);
 	glActiveTexture(GL_TEXTURE0);
 
-	//Terrain
-	DrawGeometryNode(m_terrain, m_terrain_transformation_matrix, m_terrain_transformation_normal_matrix);
-
-	//Road tiles
-	for (int i = 0; i < m_road_transformation_matrix.size(); i++) {
-		DrawGeometryNode(m_road, m_road_transformation_matrix[i], m_road_transformation_normal_matrix[i]);
-	}
-
-	//Treasure chests
-	for (int i = 0; i < m_treasure_chest_transformation_matrix.size(); i++) {
-		DrawGeometryNode(m_treasure_chest, m_treasure_chest_transformation_matrix[i], m_treasure_chest_transformation_normal_matrix[i]);
-	}
-
-	//Cannonballs
-	for (int i = 0; i < m_cannonball_positions.size();i++) {
-		if (m_cannonball_render[i])
-			DrawGeometryNode(m_cannonball, m_cannonball_transformation_matrix[i], m_cannonball_transformation_normal_matrix[i]);
-	}
-
-	//Towers
-	for (std::vector<glm::vec2>::iterator pos_it  = m_placed_towers.begin(); pos_it != m_placed_towers.end(); ++pos_it) {
-
-		glm::mat4 model_matrix = glm::translate(glm::mat4(1.f), glm::vec3((*pos_it).x + 1, -2.47, (*pos_it).y + 1)) *glm::scale(glm::mat4(1.f), glm::vec3(0.4))
-			* glm::translate(glm::mat4(1.f), glm::vec3(2.6035, 0.0626, 2.6373));
-
-		glm::mat4 normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model_matrix))));
-
-		DrawGeometryNode(m_tower, model_matrix, normal_matrix);
-	}
+	m_geometry_queue.Clear();
+	m_cull_candidates.clear();
 
-	//Pirates
+	// the objects in the camera frustum (see QueryVisibleObjects)
+	for (uint32_t object : m_scene_query)
+		SubmitSceneObject(object);
 
-	for (int i = 0; i < m_pirate_body_transformation_matrix.size();i++) {
-		if (m_pirate_render[i]) {
-			DrawGeometryNode(m_pirate_body, m_pirate_body_transformation_matrix[i], m_pirate_body_transformation_normal_matrix[i]);
-			DrawGeometryNode(m_pirate_rarm, m_pirate_rarm_transformation_matrix[i], m_pirate_rarm_transformation_normal_matrix[i]);
-			DrawGeometryNode(m_pirate_lfoot, m_pirate_lfoot_transformation_matrix[i], m_pirate_lfoot_transformation_normal_matrix[i]);
-			DrawGeometryNode(m_pirate_rfoot, m_pirate_rfoot_transformation_matrix[i], m_pirate_rfoot_transformation_normal_matrix[i]);
-		}
-	}
+	CullGeometryCandidates();
+	m_geometry_queue.Sort();
+	if (m_multi_draw_indirect)
+		DrawGeometryQueueIndirect();
+	else
+		DrawGeometryQueue();
 
 	// unbind the vao
 	glBindVertexArray(0);
+	glBindSampler(3, 0);
 	// unbind the shader program
-	m_shadowed_geometry_rendering_program.Unbind();
+	glUseProgram(0);
 
 
 	
@@ -717,10 +1058,10 @@ void Renderer::RenderGeometry()
 	// blend using the alpha value of the fragment shader
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	glUniformMatrix4fv(m_basic_geometry_rendering_program["uniform_projection_matrix"], 1, GL_FALSE, glm::value_ptr(m_projection_matrix));
-	glUniformMatrix4fv(m_basic_geometry_rendering_program["uniform_view_matrix"], 1, GL_FALSE, glm::value_ptr(m_view_matrix));
+	glUniformMatrix4fv(m_basic_geometry_rendering_program[BASIC_PROJECTION_MATRIX], 1, GL_FALSE, glm::value_ptr(m_projection_matrix));
+	glUniformMatrix4fv(m_basic_geometry_rendering_program[BASIC_VIEW_MATRIX], 1, GL_FALSE, glm::value_ptr(m_view_matrix));
 
-	glUniform1i(m_basic_geometry_rendering_program["uniform_texture"], 0);
+	glUniform1i(m_basic_geometry_rendering_program[BASIC_TEXTURE], 0);
 	glActiveTexture(GL_TEXTURE0);
 
 	switch (selection) {
@@ -728,12 +1069,13 @@ void Renderer::RenderGeometry()
 		color = glm::vec3(0.f, 0.f, 0.f);
 
 		glBindVertexArray(m_red_plane->m_vao);
-		glUniformMatrix4fv(m_basic_geometry_rendering_program["uniform_model_matrix"], 1, GL_FALSE, glm::value_ptr(m_red_plane_transformation_matrix));
-		glUniform3f(m_basic_geometry_rendering_program["uniform_color"], color.r, color.g, color.b);
+		glUniformMatrix4fv(m_basic_geometry_rendering_program[BASIC_MODEL_MATRIX], 1, GL_FALSE, glm::value_ptr(m_red_plane_transformation_matrix * m_red_plane->m_dequantization_matrix));
+		glUniform3f(m_basic_geometry_rendering_program[BASIC_COLOR], color.r, color.g, color.b);
 		for (int j = 0; j < m_red_plane->parts.size(); j++)
 		{
-			glBindTexture(GL_TEXTURE_2D, m_red_plane->parts[j].textureID);
-			glDrawArrays(GL_TRIANGLES, m_red_plane->parts[j].start_offset, m_red_plane->parts[j].count);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, m_red_plane->parts[j].textureID);
+			glUniform1f(m_basic_geometry_rendering_program[BASIC_TEXTURE_LAYER], static_cast<float>(m_red_plane->parts[j].texture_layer));
+			glDrawElementsBaseVertex(GL_TRIANGLES, m_red_plane->parts[j].lods[0].count, GL_UNSIGNED_INT, (const void*)(m_red_plane->parts[j].lods[0].start_offset * sizeof(GLuint)), m_red_plane->m_base_vertex);
 		}
 		break;
 
@@ -743,12 +1085,13 @@ void Renderer::RenderGeometry()
 		color = glm::vec3(0.f, 0.f, 0.f);
 
 		glBindVertexArray(m_green_plane->m_vao);
-		glUniformMatrix4fv(m_basic_geometry_rendering_program["uniform_model_matrix"], 1, GL_FALSE, glm::value_ptr(m_green_plane_transformation_matrix));
-		glUniform3f(m_basic_geometry_rendering_program["uniform_color"], color.r, color.g, color.b);
+		glUniformMatrix4fv(m_basic_geometry_rendering_program[BASIC_MODEL_MATRIX], 1, GL_FALSE, glm::value_ptr(m_green_plane_transformation_matrix * m_green_plane->m_dequantization_matrix));
+		glUniform3f(m_basic_geometry_rendering_program[BASIC_COLOR], color.r, color.g, color.b);
 		for (int j = 0; j < m_green_plane->parts.size(); j++)
 		{
-			glBindTexture(GL_TEXTURE_2D, m_green_plane->parts[j].textureID);
-			glDrawArrays(GL_TRIANGLES, m_green_plane->parts[j].start_offset, m_green_plane->parts[j].count);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, m_green_plane->parts[j].textureID);
+			glUniform1f(m_basic_geometry_rendering_program[BASIC_TEXTURE_LAYER], static_cast<float>(m_green_plane->parts[j].texture_layer));
+			glDrawElementsBaseVertex(GL_TRIANGLES, m_green_plane->parts[j].lods[0].count, GL_UNSIGNED_INT, (const void*)(m_green_plane->parts[j].lods[0].start_offset * sizeof(GLuint)), m_green_plane->m_base_vertex);
 		}
 		break;
 
@@ -757,12 +1100,13 @@ void Renderer::RenderGeometry()
 		color = glm::vec3(1.f, 1.f, (float)204 / 255);
 
 		glBindVertexArray(m_green_plane->m_vao);
-		glUniformMatrix4fv(m_basic_geometry_rendering_program["uniform_model_matrix"], 1, GL_FALSE, glm::value_ptr(m_green_plane_transformation_matrix));
-		glUniform3f(m_basic_geometry_rendering_program["uniform_color"], color.r, color.g, color.b);
+		glUniformMatrix4fv(m_basic_geometry_rendering_program[BASIC_MODEL_MATRIX], 1, GL_FALSE, glm::value_ptr(m_green_plane_transformation_matrix * m_green_plane->m_dequantization_matrix));
+		glUniform3f(m_basic_geometry_rendering_program[BASIC_COLOR], color.r, color.g, color.b);
 		for (int j = 0; j < m_green_plane->parts.size(); j++)
 		{
-			glBindTexture(GL_TEXTURE_2D, m_green_plane->parts[j].textureID);
-			glDrawArrays(GL_TRIANGLES, m_green_plane->parts[j].start_offset, m_green_plane->parts[j].count);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, m_green_plane->parts[j].textureID);
+			glUniform1f(m_basic_geometry_rendering_program[BASIC_TEXTURE_LAYER], static_cast<float>(m_green_plane->parts[j].texture_layer));
+			glDrawElementsBaseVertex(GL_TRIANGLES, m_green_plane->parts[j].lods[0].count, GL_UNSIGNED_INT, (const void*)(m_green_plane->parts[j].lods[0].start_offset * sizeof(GLuint)), m_green_plane->m_base_vertex);
 		}
 		break;
 	}
@@ -784,37 +1128,436 @@ void Renderer::RenderGeometry()
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void Renderer::DrawGeometryNode(GeometryNode* node, glm::mat4 model_matrix, glm::mat4 normal_matrix)
+void Renderer::QuerySceneObjects(const Culling::Frustum& frustum, std::vector<uint32_t>& objects) const
+{
+	objects.clear();
+	// every object until the proxies are fit, their boxes are only the origins of the objects before
+	if (m_scene_tree_fit)
+		m_scene_tree.QueryFrustum(frustum, objects);
+	else
+	{
+		for (int type = 0; type < SCENE_OBJECT_COUNT; type++)
+			for (int i = 0; i < m_scene_proxies[type].size(); i++)
+				objects.push_back(GetSceneObject(type, i));
+	}
+}
+
+void Renderer::QueryVisibleObjects()
+{
+	m_camera_frustum = Culling::ExtractFrustum(m_projection_matrix * m_view_matrix);
+	QuerySceneObjects(m_camera_frustum, m_scene_query);
+}
+
+void Renderer::InitSceneTree()
+{
+	m_scene_tree.Clear();
+	m_scene_lods.clear();
+	for (std::vector<int>& proxies : m_scene_proxies)
+		proxies.clear();
+
+	InsertSceneObject(SCENE_TERRAIN, 0);
+	for (int i = 0; i < m_road_transformation_matrix.size(); i++)
+		InsertSceneObject(SCENE_ROAD, i);
+	for (int i = 0; i < m_treasure_chest_transformation_matrix.size(); i++)
+		InsertSceneObject(SCENE_TREASURE_CHEST, i);
+	for (int i = 0; i < m_placed_towers.size(); i++)
+	{
+		InsertSceneObject(SCENE_TOWER, i);
+		InsertSceneObject(SCENE_CANNONBALL, i);
+	}
+	for (int i = 0; i < m_pirate_body_transformation_matrix.size(); i++)
+		InsertSceneObject(SCENE_PIRATE, i);
+}
+
+void Renderer::InsertSceneObject(SCENE_OBJECT type, int index)
+{
+	glm::vec3 bounds_min, bounds_max;
+	GetSceneObjectBounds(type, index, bounds_min, bounds_max);
+
+	std::vector<int>& proxies = m_scene_proxies[type];
+	int proxy = m_scene_tree.Insert(bounds_min, bounds_max, GetSceneObject(type, index));
+	proxies.insert(proxies.begin() + index, proxy);
+	if (proxy >= static_cast<int>(m_scene_lods.size()))
+		m_scene_lods.resize(proxy + 1);
+	m_scene_lods[proxy] = 0;
+	for (int i = index + 1; i < proxies.size(); i++)
+		m_scene_tree.SetUserData(proxies[i], GetSceneObject(type, i));
+}
+
+void Renderer::RemoveSceneObject(SCENE_OBJECT type, int index)
+{
+	std::vector<int>& proxies = m_scene_proxies[type];
+	m_scene_tree.Remove(proxies[index]);
+	proxies.erase(proxies.begin() + index);
+	for (int i = index; i < proxies.size(); i++)
+		m_scene_tree.SetUserData(proxies[i], GetSceneObject(type, i));
+}
+
+void Renderer::MoveSceneObject(SCENE_OBJECT type, int index)
+{
+	glm::vec3 bounds_min, bounds_max;
+	GetSceneObjectBounds(type, index, bounds_min, bounds_max);
+	m_scene_tree.Move(m_scene_proxies[type][index], bounds_min, bounds_max);
+}
+
+void Renderer::RebuildSceneTree()
+{
+	for (int type = 0; type < SCENE_OBJECT_COUNT; type++)
+		for (int i = 0; i < m_scene_proxies[type].size(); i++)
+			MoveSceneObject(static_cast<SCENE_OBJECT>(type), i);
+	m_scene_tree.Rebuild();
+	m_scene_tree_fit = true;
+	printf("Scene tree: %u objects, height %d\n", m_scene_tree.GetProxyCount(), m_scene_tree.GetHeight());
+}
+
+bool Renderer::GetSceneObjectBounds(SCENE_OBJECT type, int index, glm::vec3& bounds_min, glm::vec3& bounds_max) const
+{
+	// the nodes of the object and their model matrices
+	GeometryNode* nodes[4];
+	glm::mat4 matrices[4];
+	int count = 1;
+	switch (type)
+	{
+	case SCENE_TERRAIN:
+		nodes[0] = m_terrain;
+		matrices[0] = m_terrain_transformation_matrix;
+		break;
+	case SCENE_ROAD:
+		nodes[0] = m_road;
+		matrices[0] = m_road_transformation_matrix[index];
+		break;
+	case SCENE_TREASURE_CHEST:
+		nodes[0] = m_treasure_chest;
+		matrices[0] = m_treasure_chest_transformation_matrix[index];
+		break;
+	case SCENE_TOWER:
+		nodes[0] = m_tower;
+		matrices[0] = GetTowerTransformationMatrix(m_placed_towers[index]);
+		break;
+	case SCENE_CANNONBALL:
+		nodes[0] = m_cannonball;
+		matrices[0] = m_cannonball_transformation_matrix[index];
+		break;
+	case SCENE_PIRATE:
+		count = 4;
+		nodes[0] = m_pirate_body;
+		matrices[0] = m_pirate_body_transformation_matrix[index];
+		nodes[1] = m_pirate_rarm;
+		matrices[1] = m_pirate_rarm_transformation_matrix[index];
+		nodes[2] = m_pirate_lfoot;
+		matrices[2] = m_pirate_lfoot_transformation_matrix[index];
+		nodes[3] = m_pirate_rfoot;
+		matrices[3] = m_pirate_rfoot_transformation_matrix[index];
+		break;
+	default:
+		return false;
+	}
+
+	bool ready = true;
+	for (int i = 0; i < count; i++)
+	{
+		glm::vec3 node_min, node_max;
+		if (nodes[i] != nullptr && nodes[i]->IsReady())
+			Culling::TransformAABB(matrices[i], nodes[i]->m_bounds_min, nodes[i]->m_bounds_max, node_min, node_max);
+		else
+		{
+			node_min = node_max = glm::vec3(matrices[i][3]);
+			ready = false;
+		}
+		bounds_min = (i == 0) ? node_min : glm::min(bounds_min, node_min);
+		bounds_max = (i == 0) ? node_max : glm::max(bounds_max, node_max);
+	}
+	return ready;
+}
+
+void Renderer::SubmitSceneObject(uint32_t object)
+{
+	int type = static_cast<int>(object >> 24);
+	int index = static_cast<int>(object & 0xFFFFFF);
+	unsigned char& lod = m_scene_lods[m_scene_proxies[type][index]];
+	switch (type)
+	{
+	case SCENE_TERRAIN:
+		lod = SelectLod(m_terrain, m_terrain_transformation_matrix, LOD_PIXEL_ERROR, lod);
+		SubmitGeometryNode(m_terrain, m_terrain_transformation_matrix, m_terrain_transformation_normal_matrix, lod);
+		break;
+	case SCENE_ROAD:
+		lod = SelectLod(m_road, m_road_transformation_matrix[index], LOD_PIXEL_ERROR, lod);
+		SubmitGeometryNode(m_road, m_road_transformation_matrix[index], m_road_transformation_normal_matrix[index], lod);
+		break;
+	case SCENE_TREASURE_CHEST:
+		lod = SelectLod(m_treasure_chest, m_treasure_chest_transformation_matrix[index], LOD_PIXEL_ERROR, lod);
+		SubmitGeometryNode(m_treasure_chest, m_treasure_chest_transformation_matrix[index], m_treasure_chest_transformation_normal_matrix[index], lod);
+		break;
+	case SCENE_TOWER:
+	{
+		glm::mat4 model_matrix = GetTowerTransformationMatrix(m_placed_towers[index]);
+		glm::mat4 normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model_matrix))));
+		lod = SelectLod(m_tower, model_matrix, LOD_PIXEL_ERROR, lod);
+		SubmitGeometryNode(m_tower, model_matrix, normal_matrix, lod);
+		break;
+	}
+	case SCENE_CANNONBALL:
+		if (m_cannonball_render[index])
+		{
+			lod = SelectLod(m_cannonball, m_cannonball_transformation_matrix[index], LOD_PIXEL_ERROR, lod);
+			SubmitGeometryNode(m_cannonball, m_cannonball_transformation_matrix[index], m_cannonball_transformation_normal_matrix[index], lod);
+		}
+		break;
+	case SCENE_PIRATE:
+		if (m_pirate_render[index]) {
+			// the limbs follow the level of the body, so that the parts of a pirate always match
+			lod = SelectLod(m_pirate_body, m_pirate_body_transformation_matrix[index], LOD_PIXEL_ERROR, lod);
+			SubmitGeometryNode(m_pirate_body, m_pirate_body_transformation_matrix[index], m_pirate_body_transformation_normal_matrix[index], lod);
+			SubmitGeometryNode(m_pirate_rarm, m_pirate_rarm_transformation_matrix[index], m_pirate_rarm_transformation_normal_matrix[index], lod);
+			SubmitGeometryNode(m_pirate_lfoot, m_pirate_lfoot_transformation_matrix[index], m_pirate_lfoot_transformation_normal_matrix[index], lod);
+			SubmitGeometryNode(m_pirate_rfoot, m_pirate_rfoot_transformation_matrix[index], m_pirate_rfoot_transformation_normal_matrix[index], lod);
+		}
+		break;
+	}
+}
+
+glm::mat4 Renderer::GetTowerTransformationMatrix(const glm::vec2& position) const
+{
+	return glm::translate(glm::mat4(1.f), glm::vec3(position.x + 1, -2.47, position.y + 1)) *glm::scale(glm::mat4(1.f), glm::vec3(0.4))
+		* glm::translate(glm::mat4(1.f), glm::vec3(2.6035, 0.0626, 2.6373));
+}
+
+unsigned int Renderer::SelectLod(const GeometryNode* node, const glm::mat4& model_matrix, float pixel_error, int current_level) const
 {
-	glBindVertexArray(node->m_vao);
-	glUniformMatrix4fv(m_shadowed_geometry_rendering_program["uniform_model_matrix"], 1, GL_FALSE, glm::value_ptr(model_matrix));
-	glUniformMatrix4fv(m_shadowed_geometry_rendering_program["uniform_normal_matrix"], 1, GL_FALSE, glm::value_ptr(normal_matrix));
-	for (int j = 0; j < node->parts.size(); j++)
+	if (!node->IsReady() || node->m_lod_count <= 1 || node->m_bounding_sphere.w <= 0.0f)
+		return 0;
+
+	// pixels per world unit at the closest point of the bounding sphere
+	glm::vec4 sphere = Culling::TransformSphere(model_matrix, node->m_bounding_sphere);
+	float distance = glm::distance(glm::vec3(sphere), m_camera_position) - sphere.w;
+	if (distance <= 0.0f)
+		return 0;
+	float pixels_per_unit = m_projection_matrix[1][1] * 0.5f * m_screen_height / distance;
+	// the errors are in model units
+	float scale = sphere.w / node->m_bounding_sphere.w;
+
+	unsigned int level = 0;
+	for (unsigned int candidate = 1; candidate < node->m_lod_count; candidate++)
 	{
-		glm::vec3 diffuseColor = node->parts[j].diffuseColor;
-		glm::vec3 specularColor = node->parts[j].specularColor;
-		float shininess = node->parts[j].shininess;
-		glUniform3f(m_shadowed_geometry_rendering_program["uniform_diffuse"], diffuseColor.r, diffuseColor.g, diffuseColor.b);
-		glUniform3f(m_shadowed_geometry_rendering_program["uniform_specular"], specularColor.r, specularColor.g, specularColor.b);
-		glUniform1f(m_shadowed_geometry_rendering_program["uniform_shininess"], shininess);
-		glUniform1f(m_shadowed_geometry_rendering_program["uniform_has_texture"], (node->parts[j].textureID > 0) ? 1.0f : 0.0f);
-		glBindTexture(GL_TEXTURE_2D, node->parts[j].textureID);
-
-		glDrawArrays(GL_TRIANGLES, node->parts[j].start_offset, node->parts[j].count);
+		float limit = pixel_error;
+		if (current_level >= 0)
+			limit *= (static_cast<int>(candidate) <= current_level) ? 1.0f + LOD_HYSTERESIS : 1.0f - LOD_HYSTERESIS;
+		if (node->m_lod_errors[candidate] * scale * pixels_per_unit > limit)
+			break;
+		level = candidate;
 	}
+	return level;
 }
 
+void Renderer::SubmitGeometryNode(GeometryNode* node, const glm::mat4& model_matrix, const glm::mat4& normal_matrix, unsigned int lod)
+{
+	if (!node->IsReady()) return;
+	CullCandidate candidate;
+	candidate.node = node;
+	candidate.model_matrix = model_matrix;
+	candidate.normal_matrix = normal_matrix;
+	candidate.lod = lod;
+	m_cull_candidates.push_back(candidate);
+}
 
-void Renderer::DrawGeometryNodeToShadowMap(GeometryNode* node, glm::mat4 model_matrix, glm::mat4 normal_matrix)
+void Renderer::CullGeometryCandidates()
 {
-	glBindVertexArray(node->m_vao);
-	glUniformMatrix4fv(m_spot_light_shadow_map_program["uniform_model_matrix"], 1, GL_FALSE, glm::value_ptr(model_matrix));
-	for (int j = 0; j < node->parts.size(); j++)
+	// whole nodes first, the tree found the objects through their fat bounds
+	m_cull_spheres.clear();
+	for (const CullCandidate& candidate : m_cull_candidates)
+		m_cull_spheres.push_back(Culling::TransformSphere(candidate.model_matrix, candidate.node->m_bounding_sphere));
+	m_cull_visible.resize(m_cull_candidates.size());
+	Culling::TestSpheres(m_camera_frustum, m_cull_spheres.data(), m_cull_spheres.size(), m_cull_visible.data());
+
+	GLuint program = m_shadowed_geometry_rendering_programs.Get(m_shaded_variant).GetProgram();
+	GLuint textured_program = m_shadowed_geometry_rendering_programs.Get(m_shaded_variant | VARIANT_TEXTURED).GetProgram();
+	for (size_t i = 0; i < m_cull_candidates.size(); i++)
 	{
-		glDrawArrays(GL_TRIANGLES, node->parts[j].start_offset, node->parts[j].count);
+		if (m_cull_visible[i] == 0) continue;
+		const CullCandidate& candidate = m_cull_candidates[i];
+		GeometryNode* node = candidate.node;
+
+		// then the parts of the nodes that are split in many (e.g. the terrain)
+		const unsigned char* visible_parts = nullptr;
+		if (node->parts.size() > 1)
+		{
+			m_cull_spheres.clear();
+			for (const GeometryNode::Objects& part : node->parts)
+				m_cull_spheres.push_back(Culling::TransformSphere(candidate.model_matrix, part.bounding_sphere));
+			m_part_visible.resize(node->parts.size());
+			Culling::TestSpheres(m_camera_frustum, m_cull_spheres.data(), m_cull_spheres.size(), m_part_visible.data());
+			visible_parts = m_part_visible.data();
+		}
+
+		// the dequantization of the vertex positions is folded into the model matrix
+		unsigned int transform = m_geometry_queue.AddTransform(candidate.model_matrix * node->m_dequantization_matrix, candidate.normal_matrix);
+		m_geometry_queue.Submit(node, transform, program, textured_program, visible_parts, candidate.lod);
+	}
+}
+
+void Renderer::SubmitGeometryNodeToShadowMap(GeometryNode* node, const glm::mat4& model_matrix, const glm::mat4& normal_matrix, bool full_detail)
+{
+	if (!node->IsReady()) return;
+	unsigned int transform = m_shadow_map_queue.AddTransform(model_matrix * node->m_dequantization_matrix, normal_matrix);
+	// the casters are only seen through the shadows they cast, a coarser level is enough
+	unsigned int lod = (full_detail) ? 0 : SelectLod(node, model_matrix, SHADOW_LOD_PIXEL_ERROR, -1);
+	m_shadow_map_queue.SubmitDepthOnly(node, transform, m_spot_light_shadow_map_programs.Get((m_multi_draw_indirect) ? VARIANT_INSTANCED : 0).GetProgram(), lod);
+}
+
+void Renderer::DrawGeometryQueue()
+{
+	GLuint current_program = 0;
+	ShaderProgram* program = nullptr;
+	GLuint current_vao = 0;
+	GLuint current_texture = 0;
+	unsigned int current_material = UINT_MAX;
+	unsigned int current_transform = UINT_MAX;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	for (const RenderQueue::DrawItem& item : m_geometry_queue.GetItems())
+	{
+		const GeometryNode::Objects& part = item.node->parts[item.part];
+
+		if (item.program != current_program)
+		{
+			// the uniforms of the draw are per program, set them again
+			program = m_shadowed_geometry_rendering_programs.Find(item.program);
+			program->Bind();
+			current_program = item.program;
+			current_material = UINT_MAX;
+			current_transform = UINT_MAX;
+		}
+		if (item.node->m_vao != current_vao)
+		{
+			glBindVertexArray(item.node->m_vao);
+			current_vao = item.node->m_vao;
+		}
+		if (item.transform != current_transform)
+		{
+			glUniformMatrix4fv((*program)[SHADOWED_MODEL_MATRIX], 1, GL_FALSE, glm::value_ptr(m_geometry_queue.GetModelMatrix(item.transform)));
+			glUniformMatrix4fv((*program)[SHADOWED_NORMAL_MATRIX], 1, GL_FALSE, glm::value_ptr(m_geometry_queue.GetNormalMatrix(item.transform)));
+			current_transform = item.transform;
+		}
+		if (part.material_index != current_material)
+		{
+			// the material itself is in the MaterialTable
+			glUniform1i((*program)[SHADOWED_MATERIAL_INDEX], part.material_index);
+			current_material = part.material_index;
+		}
+		if (part.textureID != current_texture)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, part.textureID);
+			current_texture = part.textureID;
+		}
+
+		const GeometryNode::Objects::Lod& lod = part.lods[item.lod];
+		glDrawElementsBaseVertex(GL_TRIANGLES, lod.count, GL_UNSIGNED_INT, (const void*)(lod.start_offset * sizeof(GLuint)), item.node->m_base_vertex);
 	}
 }
 
+void Renderer::DrawShadowMapQueue()
+{
+	ShaderProgram& program = m_spot_light_shadow_map_programs.Get(0);
+	GLuint current_vao = 0;
+	unsigned int current_transform = UINT_MAX;
+
+	for (const RenderQueue::DrawItem& item : m_shadow_map_queue.GetItems())
+	{
+		const GeometryNode::Objects& part = item.node->parts[item.part];
+
+		if (item.node->m_vao != current_vao)
+		{
+			glBindVertexArray(item.node->m_vao);
+			current_vao = item.node->m_vao;
+		}
+		if (item.transform != current_transform)
+		{
+			glUniformMatrix4fv(program[SHADOW_MAP_MODEL_MATRIX], 1, GL_FALSE, glm::value_ptr(m_shadow_map_queue.GetModelMatrix(item.transform)));
+			current_transform = item.transform;
+		}
+
+		const GeometryNode::Objects::Lod& lod = part.lods[item.lod];
+		glDrawElementsBaseVertex(GL_TRIANGLES, lod.count, GL_UNSIGNED_INT, (const void*)(lod.start_offset * sizeof(GLuint)), item.node->m_base_vertex);
+	}
+}
+
+void Renderer::UploadIndirectDrawData(const RenderQueue& queue)
+{
+	// orphan and refill the command and per draw data buffers
+	const std::vector<RenderQueue::DrawElementsIndirectCommand>& commands = queue.GetIndirectCommands();
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_draw_indirect_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(RenderQueue::DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, m_draw_data_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, m_draw_data.size() * sizeof(glm::vec4), m_draw_data.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	// the per draw data are read from texture unit 2
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_BUFFER, m_draw_data_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void Renderer::DrawGeometryQueueIndirect()
+{
+	m_geometry_queue.BuildIndirectBatches(false);
+
+	// model matrix, the 3 columns of the normal matrix that rotate the normals, material index
+	m_draw_data.clear();
+	for (const RenderQueue::DrawItem& item : m_geometry_queue.GetItems())
+	{
+		const GeometryNode::Objects& part = item.node->parts[item.part];
+		const glm::mat4& model_matrix = m_geometry_queue.GetModelMatrix(item.transform);
+		const glm::mat4& normal_matrix = m_geometry_queue.GetNormalMatrix(item.transform);
+		for (int c = 0; c < 4; c++) m_draw_data.push_back(model_matrix[c]);
+		for (int c = 0; c < 3; c++) m_draw_data.push_back(normal_matrix[c]);
+		m_draw_data.push_back(glm::vec4(static_cast<float>(part.material_index), 0.0f, 0.0f, 0.0f));
+	}
+	UploadIndirectDrawData(m_geometry_queue);
+
+	GLuint current_program = 0;
+	ShaderProgram* program = nullptr;
+	for (const RenderQueue::IndirectBatch& batch : m_geometry_queue.GetIndirectBatches())
+	{
+		if (batch.program != current_program)
+		{
+			program = m_shadowed_geometry_rendering_programs.Find(batch.program);
+			program->Bind();
+			current_program = batch.program;
+		}
+		glBindVertexArray(batch.vao);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, batch.texture);
+		glUniform1i((*program)[SHADOWED_DRAW_OFFSET], batch.first_command);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(batch.first_command * sizeof(RenderQueue::DrawElementsIndirectCommand)), batch.command_count, 0);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void Renderer::DrawShadowMapQueueIndirect()
+{
+	m_shadow_map_queue.BuildIndirectBatches(true);
+
+	// model matrix
+	m_draw_data.clear();
+	for (const RenderQueue::DrawItem& item : m_shadow_map_queue.GetItems())
+	{
+		const glm::mat4& model_matrix = m_shadow_map_queue.GetModelMatrix(item.transform);
+		for (int c = 0; c < 4; c++) m_draw_data.push_back(model_matrix[c]);
+	}
+	UploadIndirectDrawData(m_shadow_map_queue);
+
+	ShaderProgram& program = m_spot_light_shadow_map_programs.Get(VARIANT_INSTANCED);
+	glUniform1i(program[SHADOW_MAP_DRAW_DATA], 2);
+	for (const RenderQueue::IndirectBatch& batch : m_shadow_map_queue.GetIndirectBatches())
+	{
+		glBindVertexArray(batch.vao);
+		glUniform1i(program[SHADOW_MAP_DRAW_OFFSET], batch.first_command);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(batch.first_command * sizeof(RenderQueue::DrawElementsIndirectCommand)), batch.command_count, 0);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
 
 void Renderer::RenderToOutFB()
 {
@@ -836,15 +1579,15 @@ void Renderer::RenderToOutFB()
 	// Bind the intermediate color image to texture unit 0
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_fbo_texture);
-	glUniform1i(m_postprocess_program["uniform_texture"], 0);
+	glUniform1i(m_postprocess_program[POSTPROC_TEXTURE], 0);
 	// Bind the intermediate depth buffer to texture unit 1
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, m_fbo_depth_texture);
-	glUniform1i(m_postprocess_program["uniform_depth"], 1);
+	glUniform1i(m_postprocess_program[POSTPROC_DEPTH], 1);
 
-	glUniform1f(m_postprocess_program["uniform_time"], m_continous_time);
+	glUniform1f(m_postprocess_program[POSTPROC_TIME], m_continous_time);
 	glm::mat4 projection_inverse_matrix = glm::inverse(m_projection_matrix);
-	glUniformMatrix4fv(m_postprocess_program["uniform_projection_inverse_matrix"], 1, GL_FALSE, glm::value_ptr(projection_inverse_matrix));
+	glUniformMatrix4fv(m_postprocess_program[POSTPROC_PROJECTION_INVERSE_MATRIX], 1, GL_FALSE, glm::value_ptr(projection_inverse_matrix));
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
@@ -933,6 +1676,13 @@ void Renderer::placeTower() {
 				m_cannonball_transformation_matrix.push_back(glm::mat4(1.f));
 				m_cannonball_transformation_normal_matrix.push_back(glm::mat4(1.f));
 
+				// static changes are rare, the hierarchy is rebuilt instead of keeping the incremental insertion
+				int last = static_cast<int>(m_placed_towers.size()) - 1;
+				InsertSceneObject(SCENE_TOWER, last);
+				InsertSceneObject(SCENE_CANNONBALL, last);
+				m_scene_tree.Rebuild();
+				InvalidateStaticShadows();
+
 				currentAction(TILE::GREEN);
 				available_towers--;
 			}
@@ -962,6 +1712,11 @@ void Renderer::removeTower() {
 			m_cannonball_transformation_matrix.erase(m_cannonball_transformation_matrix.begin() + index);
 			m_cannonball_transformation_normal_matrix.erase(m_cannonball_transformation_normal_matrix.begin() + index);
 
+			RemoveSceneObject(SCENE_TOWER, index);
+			RemoveSceneObject(SCENE_CANNONBALL, index);
+			m_scene_tree.Rebuild();
+			InvalidateStaticShadows();
+
 			currentAction(TILE::GREEN);
 			removals_remaining--;
 			available_towers++;
@@ -1073,6 +1828,36 @@ void Renderer::InitializeArrays() {
 	m_treasure_chest_exists.push_back(true);
 	m_treasure_chest_exists.push_back(true);
 	m_treasure_chest_exists.push_back(true);
+
+	// the static objects are placed once, before their scene proxies are created
+	InitStaticTransformations();
+}
+
+void Renderer::InitStaticTransformations()
+{
+	m_terrain_transformation_matrix = glm::scale(glm::mat4(1.f), glm::vec3(20, 1, 20));
+	m_terrain_transformation_matrix *= glm::translate(glm::mat4(1.f), glm::vec3(1, -2.5, 1));
+	m_terrain_transformation_normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(m_terrain_transformation_matrix))));
+
+	for (int i = 0; i < m_road_transformation_matrix.size(); i++) {
+		m_road_transformation_matrix[i] = glm::scale(glm::mat4(1.f), glm::vec3(2, 1, 2));
+		m_road_transformation_matrix[i] *= glm::translate(glm::mat4(1.f), glm::vec3(2 * m_tile_positions[i].x + 1, -2.49, 2 * m_tile_positions[i].y + 1));
+		m_road_transformation_normal_matrix[i] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(m_road_transformation_matrix[i]))));
+	}
+
+	// the chests face the end of the road, an emptied chest is erased from the arrays
+	float chest_angles[3] = { 0.f, 90.f, -90.f };
+	for (int i = 0; i < m_treasure_chest_transformation_matrix.size(); i++) {
+		m_treasure_chest_transformation_matrix[i] = glm::translate(glm::mat4(1.f), m_treasure_chest_positions[i]);
+		m_treasure_chest_transformation_matrix[i] *= glm::scale(glm::mat4(1.f), glm::vec3(0.09));
+		m_treasure_chest_transformation_matrix[i] *= glm::rotate(glm::mat4(1.f), glm::radians(chest_angles[i]), glm::vec3(0, 1, 0));
+		m_treasure_chest_transformation_matrix[i] *= glm::translate(glm::mat4(1.f), glm::vec3(0.1760, -0.0226, 8.0619));
+		m_treasure_chest_transformation_normal_matrix[i] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(m_treasure_chest_transformation_matrix[i]))));
+	}
+
+	// the proxies and the cached static shadows were made with the previous matrices
+	m_scene_tree_fit = false;
+	InvalidateStaticShadows();
 }
 
 //#define reallyRandom
@@ -1117,7 +1902,7 @@ void Renderer::addPirateWave(int life) {
 #endif
 		m_pirate_lives.push_back(5 + life);
 
-		
+		InsertSceneObject(SCENE_PIRATE, static_cast<int>(m_pirate_body_transformation_matrix.size()) - 1);
 	}
 
 	m_pirate_render = std::vector<bool>(m_pirate_spawntimes.size());
@@ -1151,7 +1936,7 @@ void Renderer::removePirate(int index) {
 	m_pirate_lives.erase(m_pirate_lives.begin() + index);
 	m_pirate_render.erase(m_pirate_render.begin() + index);
 
-	
+	RemoveSceneObject(SCENE_PIRATE, index);
 }
 
 void Renderer::movePirates(int pirateCount) {
@@ -1562,6 +2347,12 @@ void Renderer::movePirates(int pirateCount) {
 		}
 	}
 
+	// refit the proxies of the walking pirates
+	for (int index = 0; index < m_scene_proxies[SCENE_PIRATE].size(); index++) {
+		if (m_pirate_render[index])
+			MoveSceneObject(SCENE_PIRATE, index);
+	}
+
 }
 
 
@@ -1619,6 +2410,7 @@ void Renderer::updateCannonballs() {
 				m_cannonball_transformation_matrix[i] = glm::translate(glm::mat4(1.f), m_cannonball_positions[i]);
 				m_cannonball_transformation_matrix[i] *= glm::scale(glm::mat4(1.f), glm::vec3(0.1));
 				m_cannonball_transformation_normal_matrix[i] = glm::mat4(glm::transpose(glm::inverse(m_cannonball_transformation_matrix[i])));
+				MoveSceneObject(SCENE_CANNONBALL, i);
 			}
 		}
 	}
@@ -1649,6 +2441,9 @@ void Renderer::updateChest(int i) {
 		m_treasure_chest_positions.erase(m_treasure_chest_positions.begin() + i);
 		m_treasure_chest_coins.erase(m_treasure_chest_coins.begin() + i);
 		m_treasure_chest_exists[i] = false;
+
+		RemoveSceneObject(SCENE_TREASURE_CHEST, i);
+		InvalidateStaticShadows();
 	}
 
 }
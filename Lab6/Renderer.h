@@ -5,8 +5,14 @@
 #include "glm\glm.hpp"
 #include <vector>
 #include "ShaderProgram.h"
+#include "ShaderPermutations.h"
 #include "SpotlightNode.h"
+#include "RenderQueue.h"
+#include "Culling.h"
+#include "BoundingVolumeTree.h"
+#include "GpuTimer.h"
 #include <unordered_set>
+#include <chrono>
 
 class Renderer
 {
@@ -26,6 +32,20 @@ public:
 		RED,
 	};
 
+	// filtering of the shadow map lookups (the PCF_MODE variants of basic_shadowed_rendering.frag)
+	enum SHADOW_FILTER
+	{
+		// 25 manual compares
+		SHADOW_FILTER_PCF5X5,
+		// one sampler2DShadow lookup, bilinear PCF of 4 texels
+		SHADOW_FILTER_HARDWARE_PCF,
+		// 8 hardware PCF lookups on a per pixel rotated poisson disk
+		SHADOW_FILTER_POISSON,
+		// variance shadow maps, one lookup in the blurred depth moments
+		SHADOW_FILTER_VSM,
+		SHADOW_FILTER_COUNT,
+	};
+
 protected:
 	int												m_screen_width, m_screen_height;
 	glm::mat4										m_view_matrix;
@@ -69,6 +89,62 @@ protected:
 
 	GLuint m_vao_fbo, m_vbo_fbo_vertices;
 
+	// Multi Draw Indirect
+	bool m_multi_draw_indirect;
+	GLuint m_draw_indirect_buffer;
+	// per draw data, read in the shaders through a texture buffer
+	GLuint m_draw_data_buffer;
+	GLuint m_draw_data_texture;
+	std::vector<glm::vec4> m_draw_data;
+
+	// Asset Loading
+	// the nodes are pending until the AssetLoader has uploaded them
+	std::vector<class GeometryNode*>				m_loading_nodes;
+	std::chrono::steady_clock::time_point			m_assets_load_start;
+	bool											m_assets_loaded;
+	// the nodes that were not uploaded, counted once every asset is loaded
+	unsigned int									m_assets_failed;
+	bool											m_textures_packed;
+
+	// View Frustum Culling
+	// the nodes submitted to the geometry pass, tested in batches before they reach the queue
+	struct CullCandidate
+	{
+		class GeometryNode* node;
+		glm::mat4 model_matrix;
+		glm::mat4 normal_matrix;
+		unsigned int lod;
+	};
+	std::vector<CullCandidate>						m_cull_candidates;
+	std::vector<glm::vec4>							m_cull_spheres;
+	std::vector<unsigned char>						m_cull_visible;
+	std::vector<unsigned char>						m_part_visible;
+	Culling::Frustum								m_camera_frustum;
+
+	// Scene Hierarchy
+	// every object of the scene has a proxy in the tree, with its type and index as user data,
+	// the geometry pass submits only the objects the tree finds in the camera frustum
+	enum SCENE_OBJECT
+	{
+		SCENE_TERRAIN,
+		SCENE_ROAD,
+		SCENE_TREASURE_CHEST,
+		SCENE_TOWER,
+		SCENE_CANNONBALL,
+		SCENE_PIRATE,
+		SCENE_OBJECT_COUNT,
+	};
+	BoundingVolumeTree								m_scene_tree;
+	// proxies of the objects of every type, by index
+	std::vector<int>								m_scene_proxies[SCENE_OBJECT_COUNT];
+	// the proxies are fit to the loaded nodes at the current static matrices
+	bool											m_scene_tree_fit;
+	std::vector<uint32_t>							m_scene_query;
+	// the casters in the frustum of the light, the dynamic ones are also tested against the receivers in the camera frustum
+	Culling::Frustum								m_light_frustum;
+	std::vector<uint32_t>							m_shadow_query;
+	// level of detail drawn last frame, by proxy, so that an object near a switch distance doesn't flicker between levels
+	std::vector<unsigned char>						m_scene_lods;
 	
 	float m_continous_time;
 
@@ -77,6 +153,25 @@ protected:
 
 	// Lights
 	SpotLightNode m_spotlight_node;
+	// the static shadow map of the light holds the casters that don't move (terrain, road, chests, towers),
+	// it is redrawn only when one of them is added / removed or the light changes
+	bool m_static_shadows_valid;
+	unsigned int m_static_shadows_version;
+	SHADOW_FILTER m_shadow_filter;
+
+	// GPU Timings
+	// the passes the shadow filter changes, averaged per filter and reported every few frames
+	enum GPU_TIMER_SECTION
+	{
+		TIMER_SHADOW_MAP,
+		TIMER_SHADOW_PREFILTER,
+		TIMER_GEOMETRY,
+		TIMER_SECTION_COUNT,
+	};
+	GpuTimer m_gpu_timer;
+	float m_shadow_filter_times[SHADOW_FILTER_COUNT][TIMER_SECTION_COUNT];
+	unsigned int m_shadow_filter_frames[SHADOW_FILTER_COUNT];
+	std::vector<float> m_resolved_times;
 
 	// Meshes
 	class GeometryNode*								m_terrain;
@@ -130,15 +225,155 @@ protected:
 	bool InitCommonItems();
 	bool InitLightSources();
 	bool InitGeometricMeshes();
+	// start loading a mesh through its cooked cache on the AssetLoader, the returned node is pending
+	class GeometryNode* LoadGeometryNode(const char* filename);
+	// drain the GL uploads of the AssetLoader within the frame budget
+	void UpdateAssetLoading();
+	// pack the textures of the loaded nodes in texture arrays, so that parts of different meshes share the binding
+	void PackTextures();
+
+	// model matrices of the terrain, road and chests, they don't move after start up
+	void InitStaticTransformations();
+	// proxies of the objects that exist at start up
+	void InitSceneTree();
+	// keep the proxies in step with the arrays of the objects, the indices after an inserted / removed object shift
+	void InsertSceneObject(SCENE_OBJECT type, int index);
+	void RemoveSceneObject(SCENE_OBJECT type, int index);
+	void MoveSceneObject(SCENE_OBJECT type, int index);
+	// refit every proxy to the bounds of the loaded nodes and rebuild the hierarchy
+	void RebuildSceneTree();
+	// world space bounds of an object, false while its nodes are loading (the bounds are then its origin)
+	bool GetSceneObjectBounds(SCENE_OBJECT type, int index, glm::vec3& bounds_min, glm::vec3& bounds_max) const;
+	static uint32_t GetSceneObject(int type, int index) { return (static_cast<uint32_t>(type) << 24) | static_cast<uint32_t>(index); }
+	// the objects whose proxies intersect the frustum, every object while the nodes are loading (the proxies are not fitted yet)
+	void QuerySceneObjects(const Culling::Frustum& frustum, std::vector<uint32_t>& objects) const;
+	// the objects in the camera frustum, queried before the shadow pass which culls against them
+	void QueryVisibleObjects();
+	// submit the nodes of an object (the user data of its proxy) to the geometry pass
+	void SubmitSceneObject(uint32_t object);
+	void SubmitSceneObjectToShadowMap(uint32_t object, bool full_detail);
+	// bounds of the visible receivers (see m_scene_query) in the post projective space of the light,
+	// false if the shadows can't be culled by them (e.g. a receiver reaches behind the light)
+	bool GetShadowReceiverBounds(const glm::mat4& light_view_projection, glm::vec3& ndc_min, glm::vec3& ndc_max) const;
+	glm::mat4 GetTowerTransformationMatrix(const glm::vec2& position) const;
+	// coarsest level of the node whose error projects to at most pixel_error pixels on the screen,
+	// the levels up to current_level keep a margin (hysteresis), a negative current_level has none
+	unsigned int SelectLod(const class GeometryNode* node, const glm::mat4& model_matrix, float pixel_error, int current_level) const;
+
+	// add the node to the candidates of the geometry pass / the queue of the shadow map pass
+	void SubmitGeometryNode(class GeometryNode* node, const glm::mat4& model_matrix, const glm::mat4& normal_matrix, unsigned int lod = 0);
+	// test the bounding spheres of the candidates and then of the parts of the visible multi part nodes
+	// against the camera frustum, and queue the visible parts
+	void CullGeometryCandidates();
+	// the cached static casters are drawn at full detail, the level of detail is selected from the camera
+	void SubmitGeometryNodeToShadowMap(class GeometryNode* node, const glm::mat4& model_matrix, const glm::mat4& normal_matrix, bool full_detail = false);
+	// fill the shadow map queue with the casters of one of the layers (from m_shadow_query)
+	void SubmitStaticShadowCasters();
+	void SubmitDynamicShadowCasters();
+	void InvalidateStaticShadows() { m_static_shadows_valid = false; }
+	// blur the linear depth moments of the shadow map for the variance shadow maps
+	void PrefilterShadowMoments();
+	// accumulate the timings of the completed frames
+	void UpdateGpuTimings();
+
+	// execute the sorted queues, changing only the state that differs from the previous item
+	void DrawGeometryQueue();
+	void DrawShadowMapQueue();
+	// same as above with one glMultiDrawElementsIndirect per batch
+	void DrawGeometryQueueIndirect();
+	void DrawShadowMapQueueIndirect();
+	void UploadIndirectDrawData(const RenderQueue& queue);
+
+	// key of the program variants of the passes (see ShaderPermutations), the features are added in this order
+	enum PROGRAM_VARIANT
+	{
+		// the per draw data come from the texture buffer of the multi draw indirect path
+		VARIANT_INSTANCED = 1 << 0,
+		VARIANT_SHADOWS = 1 << 1,
+		VARIANT_TEXTURED = 1 << 2,
+		// the SHADOW_FILTER of the variants with shadows (2 bits)
+		VARIANT_PCF_MODE_SHIFT = 3,
+	};
+	// the variant of the shadowed geometry rendering program for the current settings, without VARIANT_TEXTURED
+	unsigned int GetShadedVariant();
+	// the one of the current frame
+	unsigned int m_shaded_variant;
+	// set the uniforms that are the same for all the draws of the pass
+	void SetShadedFrameUniforms(ShaderProgram& program);
+
+	// Render Queues
+	RenderQueue									m_geometry_queue;
+	RenderQueue									m_shadow_map_queue;
+
+	// uniform handles of the shadowed geometry rendering program
+	enum SHADOWED_UNIFORM
+	{
+		SHADOWED_PROJECTION_MATRIX,
+		SHADOWED_VIEW_MATRIX,
+		SHADOWED_MODEL_MATRIX,
+		SHADOWED_NORMAL_MATRIX,
+		SHADOWED_MATERIAL_INDEX,
+		SHADOWED_DIFFUSE_TEXTURE,
+		SHADOWED_CAMERA_POSITION,
+		SHADOWED_LIGHT_PROJECTION_MATRIX,
+		SHADOWED_LIGHT_VIEW_MATRIX,
+		SHADOWED_LIGHT_POSITION,
+		SHADOWED_LIGHT_DIRECTION,
+		SHADOWED_LIGHT_COLOR,
+		SHADOWED_LIGHT_UMBRA,
+		SHADOWED_LIGHT_PENUMBRA,
+		SHADOWED_SHADOWMAP_TEXTURE,
+		SHADOWED_SHADOWMAP_COMPARE_TEXTURE,
+		SHADOWED_SHADOWMAP_MOMENTS_TEXTURE,
+		SHADOWED_DRAW_DATA,
+		SHADOWED_DRAW_OFFSET,
+	};
+
+	// uniform handles of the basic geometry rendering program
+	enum BASIC_UNIFORM
+	{
+		BASIC_PROJECTION_MATRIX,
+		BASIC_VIEW_MATRIX,
+		BASIC_MODEL_MATRIX,
+		BASIC_TEXTURE,
+		BASIC_TEXTURE_LAYER,
+		BASIC_COLOR,
+	};
 
-	void DrawGeometryNode(class GeometryNode* node, glm::mat4 model_matrix, glm::mat4 normal_matrix);
+	// uniform handles of the post processing program
+	enum POSTPROC_UNIFORM
+	{
+		POSTPROC_TEXTURE,
+		POSTPROC_TIME,
+		POSTPROC_DEPTH,
+		POSTPROC_PROJECTION_INVERSE_MATRIX,
+	};
 
-	void DrawGeometryNodeToShadowMap(class GeometryNode* node, glm::mat4 model_matrix, glm::mat4 normal_matrix);
+	// uniform handles of the shadow moments prefilter program
+	enum SHADOW_MOMENTS_UNIFORM
+	{
+		SHADOW_MOMENTS_TEXTURE,
+		SHADOW_MOMENTS_FROM_DEPTH,
+		SHADOW_MOMENTS_DIRECTION,
+		SHADOW_MOMENTS_NEAR,
+		SHADOW_MOMENTS_FAR,
+	};
+
+	// uniform handles of the shadow mapping program
+	enum SHADOW_MAP_UNIFORM
+	{
+		SHADOW_MAP_PROJECTION_MATRIX,
+		SHADOW_MAP_VIEW_MATRIX,
+		SHADOW_MAP_MODEL_MATRIX,
+		SHADOW_MAP_DRAW_DATA,
+		SHADOW_MAP_DRAW_OFFSET,
+	};
 
-	ShaderProgram								m_shadowed_geometry_rendering_program;
+	ShaderPermutations							m_shadowed_geometry_rendering_programs;
 	ShaderProgram								m_basic_geometry_rendering_program;
 	ShaderProgram								m_postprocess_program;
-	ShaderProgram								m_spot_light_shadow_map_program;
+	ShaderPermutations							m_spot_light_shadow_map_programs;
+	ShaderProgram								m_shadow_moments_program;
 
 	ShaderProgram								m_particle_rendering_program;
 
@@ -151,6 +386,10 @@ public:
 	bool										ReloadShaders();
 	void										Render();
 	void										InitializeArrays();
+	// every asset requested by Init is uploaded (or failed)
+	bool										AssetsLoaded() const;
+	// number of meshes that failed to load, valid once AssetsLoaded
+	unsigned int								GetFailedAssetCount() const;
 
 	// Passes
 	void										RenderShadowMaps();
@@ -159,6 +398,9 @@ public:
 	
 	// Set functions
 	void										SetRenderingMode(RENDERING_MODE mode);
+	void										SetShadowFilter(SHADOW_FILTER filter);
+	// switch to the next shadow filter
+	void										CycleShadowFilter();
 
 	// Camera Function
 	void										CameraMoveForward(bool enable);
@@ -0,0 +1,115 @@
+#include "ShaderPermutations.h"
+
+ShaderPermutations::ShaderPermutations()
+{
+	key_bits = 0;
+}
+
+ShaderPermutations::~ShaderPermutations()
+{
+
+}
+
+void ShaderPermutations::LoadShadersFromFile(const char* vertex_filename, const char* fragment_filename)
+{
+	vertexShaderFilename = vertex_filename;
+	fragmentShaderFilename = fragment_filename;
+}
+
+unsigned int ShaderPermutations::AddFeature(const std::string& name, unsigned int bits)
+{
+	Feature feature;
+	feature.name = name;
+	feature.shift = key_bits;
+	feature.mask = (1u << bits) - 1;
+	features.push_back(feature);
+	key_bits += bits;
+	return feature.shift;
+}
+
+bool ShaderPermutations::Create(unsigned int key)
+{
+	Begin(key);
+	ShaderProgram& program = *variants[key];
+	return program.GetStatus() == ShaderProgram::STATUS_READY || program.FinishProgram();
+}
+
+void ShaderPermutations::Begin(unsigned int key)
+{
+	if (variants.find(key) != variants.end())
+		return;
+
+	ShaderProgram* program = new ShaderProgram();
+	program->LoadVertexShaderFromFile(vertexShaderFilename.c_str());
+	program->LoadFragmentShaderFromFile(fragmentShaderFilename.c_str());
+	for (const Feature& feature : features)
+		program->AddDefine(feature.name, (key >> feature.shift) & feature.mask);
+	variants[key] = std::unique_ptr<ShaderProgram>(program);
+
+	// the handles are remapped when the program is linked
+	program->BeginCreateProgram();
+	for (const std::pair<int, std::string>& uniform : uniforms)
+		program->LoadUniform(uniform.first, uniform.second);
+	for (const std::pair<std::string, GLuint>& block : uniform_blocks)
+		program->BindUniformBlock(block.first, block.second);
+}
+
+bool ShaderPermutations::IsReady(unsigned int key)
+{
+	auto it = variants.find(key);
+	return it != variants.end() && it->second->IsReady();
+}
+
+void ShaderPermutations::Update()
+{
+	for (auto& variant : variants)
+	{
+		if (variant.second->GetStatus() != ShaderProgram::STATUS_COMPILING)
+			continue;
+		if (ShaderProgram::IsParallelCompileSupported())
+			variant.second->IsReady();
+		else
+		{
+			variant.second->IsReady(true);
+			return;
+		}
+	}
+}
+
+ShaderProgram& ShaderPermutations::Get(unsigned int key)
+{
+	Create(key);
+	return *variants[key];
+}
+
+ShaderProgram* ShaderPermutations::Find(GLuint program)
+{
+	for (auto& variant : variants)
+	{
+		if (variant.second->GetProgram() == program)
+			return variant.second.get();
+	}
+	return nullptr;
+}
+
+void ShaderPermutations::LoadUniform(int handle, const std::string& uniform)
+{
+	uniforms.push_back(std::make_pair(handle, uniform));
+	for (auto& variant : variants)
+		variant.second->LoadUniform(handle, uniform);
+}
+
+void ShaderPermutations::BindUniformBlock(const std::string& block, GLuint binding)
+{
+	uniform_blocks.push_back(std::make_pair(block, binding));
+	for (auto& variant : variants)
+		variant.second->BindUniformBlock(block, binding);
+}
+
+bool ShaderPermutations::ReloadPrograms()
+{
+	bool reloaded = true;
+	for (auto& variant : variants)
+		reloaded = variant.second->ReloadProgram() && reloaded;
+	return reloaded;
+}
@@ -0,0 +1,66 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "ShaderProgram.h"
+
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+/* Variants of a program compiled from the same shaders with different #defines
+The key of a variant packs the values of the features, in the order they were added and from the lsb.
+Every feature is defined in the shaders of every variant ("#define NAME value"), so the shaders
+select their code with #if NAME and the variants do not carry the branches of the others.
+The variants are compiled on first use (or ahead with Create / Begin) and share the uniform handles.
+*/
+class ShaderPermutations
+{
+	struct Feature
+	{
+		std::string name;
+		unsigned int shift;
+		unsigned int mask;
+	};
+
+	std::string vertexShaderFilename;
+	std::string fragmentShaderFilename;
+	std::vector<Feature> features;
+	unsigned int key_bits;
+
+	std::unordered_map<unsigned int, std::unique_ptr<ShaderProgram>> variants;
+	// uniforms and uniform blocks bound in every variant
+	std::vector<std::pair<int, std::string>> uniforms;
+	std::vector<std::pair<std::string, GLuint>> uniform_blocks;
+
+public:
+	ShaderPermutations();
+	~ShaderPermutations();
+
+	// Load Vertex and Fragment shader of all the variants
+	void LoadShadersFromFile(const char* vertex_filename, const char* fragment_filename);
+	// Add a feature with values [0, 2^bits), returns the shift of its value in the key
+	unsigned int AddFeature(const std::string& name, unsigned int bits = 1);
+
+	// Compile the variant of the key if it does not exist yet
+	bool Create(unsigned int key);
+	// Issue the compile of the variant without waiting for it, see Update
+	void Begin(unsigned int key);
+	// true if the variant exists and is linked, never waits
+	bool IsReady(unsigned int key);
+	// complete the variants that the driver finished, without the parallel compile one variant is waited for per call
+	void Update();
+	// The variant of the key, waits for it or compiles it if needed
+	ShaderProgram& Get(unsigned int key);
+	// The variant with the given GL name, nullptr if it is not one of them
+	ShaderProgram* Find(GLuint program);
+
+	// Bind the uniform to the given handle in every variant (present and future)
+	void LoadUniform(int handle, const std::string& uniform);
+	// Assign the uniform block to a uniform buffer binding point in every variant
+	void BindUniformBlock(const std::string& block, GLuint binding);
+
+	// Delete and reload the shaders of the compiled variants
+	bool ReloadPrograms();
+};
+
+#endif
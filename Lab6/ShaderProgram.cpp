@@ -2,9 +2,58 @@
 #include "Tools.h"
 #include "SDL2\SDL.h"
 
+// GL_KHR_parallel_shader_compile (same values as the ARB extension, not in our GLEW)
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (GLAPIENTRY * PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+bool ShaderProgram::parallel_compile = false;
+
+// header of the program binary files
+#define PROGRAM_BINARY_MAGIC 0x4E494247 // "GBIN"
+#define PROGRAM_BINARY_VERSION 1
+
+struct ProgramBinaryHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_hash;
+	// hash of the vendor, renderer and version strings, the binaries only load on the driver that made them
+	uint64_t driver_hash;
+	uint32_t format;
+	uint32_t size;
+};
+
+static bool programBinarySupported()
+{
+	if (!GLEW_ARB_get_program_binary)
+		return false;
+	GLint format_count = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	return format_count > 0;
+}
+
+static uint64_t driverHash()
+{
+	uint64_t hash = Tools::HashFNV1a(nullptr, 0);
+	GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (GLenum name : names)
+	{
+		const char* string = reinterpret_cast<const char*>(glGetString(name));
+		if (string != NULL)
+			hash = Tools::HashFNV1a(string, strlen(string) + 1, hash);
+	}
+	return hash;
+}
+
 ShaderProgram::ShaderProgram()
 {
 	program = 0;
+	status = STATUS_EMPTY;
+	from_binary = false;
+	source_hash = 0;
 
 	vertexShaderFilename = NULL;
 	fragmentShaderFilename = NULL;
@@ -16,9 +65,29 @@ ShaderProgram::~ShaderProgram()
 {
 	delete[] vertexShaderFilename;
 	delete[] fragmentShaderFilename;
+	releaseShaders();
 	glDeleteProgram(program);
 }
 
+void ShaderProgram::InitParallelCompile()
+{
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_shader_compiler_threads = nullptr;
+	if (SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile"))
+		max_shader_compiler_threads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR"));
+	else if (GLEW_ARB_parallel_shader_compile)
+		max_shader_compiler_threads = glMaxShaderCompilerThreadsARB;
+
+	parallel_compile = max_shader_compiler_threads != nullptr;
+	if (parallel_compile)
+	{
+		// as many threads as the driver wants to use
+		max_shader_compiler_threads(0xFFFFFFFF);
+		GLint threads = 0;
+		glGetIntegerv(GL_MAX_SHADER_COMPILER_THREADS_KHR, &threads);
+		printf("Parallel shader compile: %d threads\n", threads);
+	}
+}
+
 int ShaderProgram::LoadVertexShaderFromFile(const char* filename)
 {
 	// copy vertex shader file path
@@ -36,41 +105,240 @@ int ShaderProgram::LoadFragmentShaderFromFile(const char* filename)
 	return 0;
 }
 
+void ShaderProgram::AddDefine(const std::string& name, int value)
+{
+	defines += "#define " + name + " " + std::to_string(value) + "\n";
+}
+
 bool ShaderProgram::CreateProgramShader()
 {
+	return beginProgramShader() && finishProgramShader();
+}
+
+bool ShaderProgram::beginProgramShader()
+{
+	releaseShaders();
+	status = STATUS_FAILED;
+	if (!LoadShaderSource(vertexShaderFilename, vertex_source)) return false;
+	if (!LoadShaderSource(fragmentShaderFilename, fragment_source)) return false;
+	source_hash = Tools::HashFNV1a(vertex_source.data(), vertex_source.size());
+	source_hash = Tools::HashFNV1a(fragment_source.data(), fragment_source.size() + 1, source_hash);
+
 	glDeleteProgram(program);
 	program = glCreateProgram();
-	// load the VS Shader
-	if ((vs = GenerateShader(vertexShaderFilename, GL_VERTEX_SHADER)) == 0) return false;
-	glAttachShader(program, vs);
-	//glDeleteShader(vs);
+	status = STATUS_COMPILING;
 
+	// the binary of the last run, if nothing changed
+	from_binary = LoadProgramBinary(source_hash);
+	if (!from_binary)
+		compileAndLink();
+	return true;
+}
 
-	// load the FS shader
-	if ((fs = GenerateShader(fragmentShaderFilename, GL_FRAGMENT_SHADER)) == 0) return false;
+void ShaderProgram::compileAndLink()
+{
+	// no status queries here, they would wait for the driver
+	vs = GenerateShader(vertex_source, GL_VERTEX_SHADER);
+	glAttachShader(program, vs);
+	fs = GenerateShader(fragment_source, GL_FRAGMENT_SHADER);
 	glAttachShader(program, fs);
-	//glDeleteShader(fs);
 
 	// link them
-	GLint link_ok = GL_FALSE;
-	GLint validate_ok = GL_FALSE;
+	if (programBinarySupported())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(program);
-	glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
-	if (!link_ok) {
-		printf("glLinkProgram:");
-		PrintLog(program);
+}
+
+bool ShaderProgram::finishProgramShader()
+{
+	if (status != STATUS_COMPILING)
+		return status == STATUS_READY;
+
+	GLint link_ok = GL_FALSE;
+	if (from_binary)
+	{
+		glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+		if (link_ok)
+		{
+			ReflectUniforms();
+			releaseShaders();
+			status = STATUS_READY;
+			return true;
+		}
+		// the driver may still reject it (e.g. after an update that kept the version string)
+		from_binary = false;
+		glDeleteProgram(program);
+		program = glCreateProgram();
+		compileAndLink();
+	}
+
+	GLint compile_ok = GL_FALSE;
+	glGetShaderiv(vs, GL_COMPILE_STATUS, &compile_ok);
+	if (!compile_ok) {
+		printf("%s:", vertexShaderFilename);
+		PrintLog(vs);
+	}
+	if (compile_ok) {
+		glGetShaderiv(fs, GL_COMPILE_STATUS, &compile_ok);
+		if (!compile_ok) {
+			printf("%s:", fragmentShaderFilename);
+			PrintLog(fs);
+		}
+	}
+	if (compile_ok) {
+		glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+		if (!link_ok) {
+			printf("glLinkProgram:");
+			PrintLog(program);
+		}
+	}
+#ifdef _DEBUG
+	// the validation depends on the current GL state and stalls, only in debug builds
+	if (link_ok) {
+		GLint validate_ok = GL_FALSE;
+		glValidateProgram(program);
+		glGetProgramiv(program, GL_VALIDATE_STATUS, &validate_ok);
+		if (!validate_ok) {
+			printf("glValidateProgram:");
+			PrintLog(program);
+			link_ok = GL_FALSE;
+		}
+	}
+#endif
+	if (!link_ok)
+	{
+		releaseShaders();
+		status = STATUS_FAILED;
 		return false;
 	}
-	glValidateProgram(program);
-	glGetProgramiv(program, GL_VALIDATE_STATUS, &validate_ok);
-	if (!validate_ok) {
-		printf("glValidateProgram:");
-		PrintLog(program);
+
+	ReflectUniforms();
+	SaveProgramBinary(source_hash);
+	releaseShaders();
+	status = STATUS_READY;
+	return true;
+}
+
+void ShaderProgram::releaseShaders()
+{
+	// the linked program keeps working without them
+	if (vs != 0) { if (program != 0) glDetachShader(program, vs); glDeleteShader(vs); }
+	if (fs != 0) { if (program != 0) glDetachShader(program, fs); glDeleteShader(fs); }
+	vs = 0;
+	fs = 0;
+	vertex_source.clear();
+	vertex_source.shrink_to_fit();
+	fragment_source.clear();
+	fragment_source.shrink_to_fit();
+}
+
+bool ShaderProgram::BeginCreateProgram()
+{
+	return beginProgramShader();
+}
+
+bool ShaderProgram::FinishProgram()
+{
+	if (finishProgramShader())
+		return true;
+	// if fail, show text message and redo
+	SDL_assert_release(CreateProgramShader());
+	return true;
+}
+
+bool ShaderProgram::IsReady(bool wait)
+{
+	if (status == STATUS_COMPILING)
+	{
+		GLint completed = GL_TRUE;
+		if (parallel_compile && !wait)
+			glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+		if (completed)
+			finishProgramShader();
+	}
+	return status == STATUS_READY;
+}
+
+std::string ShaderProgram::GetBinaryFilename() const
+{
+	// the shaders and the defines select the file, the header the contents that it must match
+	uint64_t key = Tools::HashFNV1a(vertexShaderFilename, strlen(vertexShaderFilename) + 1);
+	key = Tools::HashFNV1a(fragmentShaderFilename, strlen(fragmentShaderFilename) + 1, key);
+	key = Tools::HashFNV1a(defines.data(), defines.size(), key);
+	char name[32];
+	snprintf(name, sizeof(name), ".%016llx.glbin", static_cast<unsigned long long>(key));
+	return std::string(fragmentShaderFilename) + name;
+}
+
+bool ShaderProgram::LoadProgramBinary(uint64_t source_hash)
+{
+	if (!programBinarySupported())
+		return false;
+
+	FILE* input = fopen(GetBinaryFilename().c_str(), "rb");
+	if (input == NULL)
 		return false;
+
+	ProgramBinaryHeader header;
+	std::vector<unsigned char> binary;
+	bool loaded = fread(&header, sizeof(ProgramBinaryHeader), 1, input) == 1;
+	loaded = loaded && header.magic == PROGRAM_BINARY_MAGIC && header.version == PROGRAM_BINARY_VERSION;
+	loaded = loaded && header.source_hash == source_hash && header.driver_hash == driverHash();
+	if (loaded)
+	{
+		binary.resize(header.size);
+		loaded = header.size > 0 && fread(binary.data(), 1, header.size, input) == header.size;
 	}
+	fclose(input);
+	if (!loaded)
+		return false;
+
+	// the link status is checked once the program is needed
+	glProgramBinary(program, header.format, binary.data(), header.size);
 	return true;
 }
 
+void ShaderProgram::SaveProgramBinary(uint64_t source_hash)
+{
+	if (!programBinarySupported())
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	ProgramBinaryHeader header;
+	memset(&header, 0, sizeof(ProgramBinaryHeader));
+	std::vector<unsigned char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, NULL, &format, binary.data());
+	header.magic = PROGRAM_BINARY_MAGIC;
+	header.version = PROGRAM_BINARY_VERSION;
+	header.source_hash = source_hash;
+	header.driver_hash = driverHash();
+	header.format = format;
+	header.size = static_cast<uint32_t>(length);
+
+	// write to a temporary file first so that a failed write never leaves a broken cache
+	std::string binary_filename = GetBinaryFilename();
+	std::string temporary_filename = binary_filename + ".tmp";
+	FILE* output = fopen(temporary_filename.c_str(), "wb");
+	bool written = output != NULL && fwrite(&header, sizeof(ProgramBinaryHeader), 1, output) == 1;
+	written = written && fwrite(binary.data(), 1, binary.size(), output) == binary.size();
+	if (output != NULL) written = (fclose(output) == 0) && written;
+	if (written)
+	{
+		remove(binary_filename.c_str());
+		written = rename(temporary_filename.c_str(), binary_filename.c_str()) == 0;
+	}
+	if (!written)
+	{
+		remove(temporary_filename.c_str());
+		printf("ShaderProgram: could not write %s\n", binary_filename.c_str());
+	}
+}
+
 bool ShaderProgram::CreateProgram()
 {
 	// if fail, show text message and redo
@@ -78,19 +346,80 @@ bool ShaderProgram::CreateProgram()
 	return true;
 }
 
-void ShaderProgram::LoadUniform(std::string uniform)
+void ShaderProgram::LoadUniform(int handle, const std::string& uniform)
 {
-	uniforms[uniform] = glGetUniformLocation(program, uniform.c_str());
+	if (handle >= static_cast<int>(uniform_locations.size()))
+	{
+		uniform_locations.resize(handle + 1, -1);
+		uniform_names.resize(handle + 1);
+	}
+	uniform_names[handle] = uniform;
+	uniform_locations[handle] = GetIndex(uniform);
+}
+
+int ShaderProgram::LoadUniform(const std::string& uniform)
+{
+	int handle = static_cast<int>(uniform_locations.size());
+	LoadUniform(handle, uniform);
+	return handle;
+}
+
+void ShaderProgram::BindUniformBlock(const std::string& block, GLuint binding)
+{
+	uniform_blocks.push_back(std::make_pair(block, binding));
+	if (status == STATUS_READY)
+	{
+		GLuint index = glGetUniformBlockIndex(program, block.c_str());
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, index, binding);
+	}
 }
 
 bool ShaderProgram::ReloadProgram()
 {
+	// the handles are remapped by ReflectUniforms once the program is linked
 	SDL_assert_release(CreateProgramShader());
-	for (auto& it : uniforms)
+	return true;
+}
+
+void ShaderProgram::ReflectUniforms()
+{
+	active_uniforms.clear();
+
+	GLint count = 0;
+	GLint max_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+	std::vector<GLchar> name(max_length + 1);
+	for (GLint i = 0; i < count; i++)
 	{
-		it.second = glGetUniformLocation(program, it.first.c_str());
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(program, i, max_length + 1, &length, &size, &type, name.data());
+
+		std::string str(name.data(), length);
+		GLint location = glGetUniformLocation(program, str.c_str());
+		active_uniforms[str] = location;
+
+		// arrays are reported as "name[0]", make them reachable by their plain name too
+		size_t bracket = str.find('[');
+		if (bracket != std::string::npos)
+			active_uniforms[str.substr(0, bracket)] = location;
+	}
+
+	// rebuild the dense table for the handles that are already bound
+	for (size_t i = 0; i < uniform_names.size(); i++)
+		uniform_locations[i] = GetIndex(uniform_names[i]);
+
+	// the block bindings are state of the program, a cached binary does not keep them
+	for (const std::pair<std::string, GLuint>& block : uniform_blocks)
+	{
+		GLuint index = glGetUniformBlockIndex(program, block.first.c_str());
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, index, block.second);
 	}
-	return true;
 }
 
 void ShaderProgram::Bind()
@@ -127,41 +456,47 @@ void ShaderProgram::PrintLog(GLuint object)
 	delete[] log;
 }
 
-GLuint ShaderProgram::GenerateShader(const char* filename, GLenum shaderType)
+bool ShaderProgram::LoadShaderSource(const char* filename, std::string& source)
 {
-	const char* source = Tools::LoadWholeStringFile(filename);
-	if (source == NULL) {
+	const char* file = Tools::LoadWholeStringFile(filename);
+	if (file == NULL) {
 		printf("Error opening %s: ", filename);
-		delete[] source;
-		return 0;
+		return false;
+	}
+	source = file;
+	delete[] file;
+
+	// the defines go right after the #version line, #line keeps the line numbers of the logs
+	if (!defines.empty())
+	{
+		size_t version = source.find("#version");
+		size_t line_end = (version != std::string::npos) ? source.find('\n', version) : std::string::npos;
+		if (line_end != std::string::npos)
+			source.insert(line_end + 1, defines + "#line 2\n");
+		else
+			source.insert(0, defines + "#line 1\n");
 	}
-	
+	return true;
+}
+
+GLuint ShaderProgram::GenerateShader(const std::string& source, GLenum shaderType)
+{
 	GLuint res = glCreateShader(shaderType);
 
-	glShaderSource(res, 1, &source, NULL);
-	delete[] source;
+	const char* source_string = source.c_str();
+	glShaderSource(res, 1, &source_string, NULL);
 
 	glCompileShader(res);
-	GLint compile_ok = GL_FALSE;
-	glGetShaderiv(res, GL_COMPILE_STATUS, &compile_ok);
-	if (compile_ok == GL_FALSE) {
-		printf("%s:", filename);
-		PrintLog(res);
-		glDeleteShader(res);
-		return 0;
-	}
-
 	return res;
 }
 
-GLint ShaderProgram::operator[](const std::string key)
+GLint ShaderProgram::operator[](const std::string& key) const
 {
-	auto it = uniforms.find(key);
-	return (it != uniforms.end()) ? it->second : -1;
+	return GetIndex(key);
 }
 
-GLint ShaderProgram::GetIndex(const std::string key)
+GLint ShaderProgram::GetIndex(const std::string& key) const
 {
-	auto it = uniforms.find(key);
-	return (it != uniforms.end()) ? it->second : -1;
+	auto it = active_uniforms.find(key);
+	return (it != active_uniforms.end()) ? it->second : -1;
 }
@@ -1,11 +1,18 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <cstdint>
 #include "GLEW\glew.h"
 
 #ifndef SHADER_PROGRAM_H
 #define SHADER_PROGRAM_H
 
+/* Program of a vertex and a fragment shader
+The linked binary is kept next to the fragment shader (*.glbin, one file per shaders + defines) and loaded
+instead of compiling when the sources and the driver are the same as when it was saved.
+BeginCreateProgram only issues the compile and link, the status is queried by FinishProgram / IsReady, so that
+the driver can work on many programs at once (on its own threads with GL_KHR_parallel_shader_compile).
+*/
 class ShaderProgram
 {	
 	// filepaths of the shaders
@@ -15,20 +22,59 @@ class ShaderProgram
 	// program and shaders
 	GLuint program;
 	GLuint vs, fs;
+	// sources with the defines, kept until the program is ready
+	std::string vertex_source;
+	std::string fragment_source;
+	uint64_t source_hash;
+	// the program was created from the cached binary
+	bool from_binary;
 
-	// hash map with uniform indices
-	std::unordered_map<std::string, GLint> uniforms;
+	static bool parallel_compile;
+
+	// uniforms reflected from the linked program (name -> location)
+	std::unordered_map<std::string, GLint> active_uniforms;
+	// dense table of uniform locations, indexed by handle
+	std::vector<GLint> uniform_locations;
+	// name bound to every handle, used to remap the table after a relink
+	std::vector<std::string> uniform_names;
+	// uniform blocks and their binding points, set again after a relink
+	std::vector<std::pair<std::string, GLuint>> uniform_blocks;
+	// #define lines injected after the #version of both shaders
+	std::string defines;
 
 public:
+	enum STATUS
+	{
+		STATUS_EMPTY,
+		// issued, the driver may still be compiling
+		STATUS_COMPILING,
+		STATUS_READY,
+		STATUS_FAILED,
+	};
+
 	ShaderProgram();
 	~ShaderProgram();
 
+	// let the driver compile on its threads if it supports it (once, after the context is created)
+	static void InitParallelCompile();
+	static bool IsParallelCompileSupported() { return parallel_compile; }
+
 	// Load Vertex and Fragment shader
 	int LoadVertexShaderFromFile(const char* filename);
 	int LoadFragmentShaderFromFile(const char* filename);
+	// Define a macro in both shaders (before CreateProgram)
+	void AddDefine(const std::string& name, int value = 1);
 	
 	// Create the program using the provided vertex and fragment shader
 	bool CreateProgram();
+	// Issue the compile and link of the program without waiting for them
+	bool BeginCreateProgram();
+	// Wait for the program issued by BeginCreateProgram
+	bool FinishProgram();
+	// true once the program is linked, without waiting for the driver unless wait is set
+	// (a failed program prints its log and stays not ready)
+	bool IsReady(bool wait = false);
+	STATUS GetStatus() const { return status; }
 
 	// Delete and reload shaders
 	bool ReloadProgram();
@@ -37,21 +83,45 @@ public:
 	void Bind();
 	// Unbind the program
 	void Unbind();
-	// Load the index of the uniform
-	void LoadUniform(const std::string uniform);
+	// The GL name of the program
+	GLuint GetProgram() const { return program; }
+	// Bind the uniform to the given handle
+	void LoadUniform(int handle, const std::string& uniform);
+	// Bind the uniform to the next free handle and return it
+	int LoadUniform(const std::string& uniform);
+	// Assign the uniform block to a uniform buffer binding point
+	void BindUniformBlock(const std::string& block, GLuint binding);
 
-	// Access the index of the uniform
-	GLint operator[](const std::string key);
-	GLint GetIndex(const std::string key);
+	// Access the index of the uniform through its handle (hot path)
+	GLint operator[](int handle) const { return uniform_locations[handle]; }
+
+	// Access the index of the uniform by name (looks up the reflected table)
+	GLint operator[](const std::string& key) const;
+	GLint GetIndex(const std::string& key) const;
 
 private:
+	STATUS status;
+
 	// Create the shader
 	bool CreateProgramShader();
+	bool beginProgramShader();
+	void compileAndLink();
+	// check the compile and link status, waits for the driver
+	bool finishProgramShader();
+	void releaseShaders();
 
-	// Load the shader from the disk
-	GLuint GenerateShader(const char* filename, GLenum shaderType);
+	// Load the source of a shader from the disk, with the defines
+	bool LoadShaderSource(const char* filename, std::string& source);
+	// Issue the compile of the shader
+	GLuint GenerateShader(const std::string& source, GLenum shaderType);
+	// program binary cache, keyed by the hash of the sources and of the driver
+	std::string GetBinaryFilename() const;
+	bool LoadProgramBinary(uint64_t source_hash);
+	void SaveProgramBinary(uint64_t source_hash);
 	// print the log when something goes wrong
 	void PrintLog(GLuint object);
+	// query the active uniforms of the linked program and remap the handles
+	void ReflectUniforms();
 };
 
 #endif
@@ -2,6 +2,54 @@
 #include "glm\gtc\matrix_transform.hpp"
 #include "Tools.h"
 
+// create (or resize) a depth texture and the framebuffer it is attached to
+static bool initDepthTarget(GLuint& texture, GLuint& fbo, int resolution)
+{
+	if (texture == 0)
+		glGenTextures(1, &texture);
+	// Depth buffer
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, resolution, resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (fbo == 0)
+		glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+
+	GLenum status = Tools::CheckFramebufferStatus(fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return status == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// create (or resize) a two channel float texture for the shadow moments and its framebuffer
+static bool initMomentsTarget(GLuint& texture, GLuint& fbo, int resolution)
+{
+	if (texture == 0)
+		glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, resolution, resolution, 0, GL_RG, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (fbo == 0)
+		glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
+
+	GLenum status = Tools::CheckFramebufferStatus(fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return status == GL_FRAMEBUFFER_COMPLETE;
+}
+
 // Spot Light
 SpotLightNode::SpotLightNode()
 {
@@ -19,45 +67,60 @@ SpotLightNode::SpotLightNode()
 	m_shadow_map_bias = 0.001f;
 	m_shadow_map_texture = 0;
 	m_shadow_map_fbo = 0;
+	m_static_shadow_map_texture = 0;
+	m_static_shadow_map_fbo = 0;
+	m_shadow_map_version = 0;
+	m_shadow_compare_sampler = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		m_shadow_moments_texture[i] = 0;
+		m_shadow_moments_fbo[i] = 0;
+	}
 }
 
 SpotLightNode::~SpotLightNode()
 {
 	glDeleteFramebuffers(1, &m_shadow_map_fbo);
 	glDeleteTextures(1, &m_shadow_map_texture);
+	glDeleteFramebuffers(1, &m_static_shadow_map_fbo);
+	glDeleteTextures(1, &m_static_shadow_map_texture);
+	glDeleteSamplers(1, &m_shadow_compare_sampler);
+	glDeleteFramebuffers(2, m_shadow_moments_fbo);
+	glDeleteTextures(2, m_shadow_moments_texture);
 }
 
 
 void SpotLightNode::CastShadow(bool cast)
 {
 	m_cast_shadow = cast;
+	m_shadow_map_version++;
 	
 	if (cast)
 	{
-		if(m_shadow_map_texture == 0)
-			glGenTextures(1, &m_shadow_map_texture);
-		// Depth buffer
-		glBindTexture(GL_TEXTURE_2D, m_shadow_map_texture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, m_shadow_map_resolution, m_shadow_map_resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		if(m_shadow_map_fbo == 0)
-			glGenFramebuffers(1, &m_shadow_map_fbo);
-		glBindFramebuffer(GL_FRAMEBUFFER, m_shadow_map_fbo);
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_shadow_map_texture, 0);
-
-		GLenum status = Tools::CheckFramebufferStatus(m_shadow_map_fbo);
-		if (status != GL_FRAMEBUFFER_COMPLETE)
+		if (!initDepthTarget(m_shadow_map_texture, m_shadow_map_fbo, m_shadow_map_resolution) ||
+			!initDepthTarget(m_static_shadow_map_texture, m_static_shadow_map_fbo, m_shadow_map_resolution))
 		{
 			printf("Error in Spotlight shadow generation.\n");
 			return;
 		}
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		for (int i = 0; i < 2; i++)
+		{
+			if (!initMomentsTarget(m_shadow_moments_texture[i], m_shadow_moments_fbo[i], m_shadow_map_resolution))
+			{
+				printf("Error in Spotlight shadow moments generation.\n");
+				return;
+			}
+		}
+
+		// the lookups return the bilinear weighted result of the 4 nearest depth comparisons
+		if (m_shadow_compare_sampler == 0)
+			glGenSamplers(1, &m_shadow_compare_sampler);
+		glSamplerParameteri(m_shadow_compare_sampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glSamplerParameteri(m_shadow_compare_sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glSamplerParameteri(m_shadow_compare_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glSamplerParameteri(m_shadow_compare_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(m_shadow_compare_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glSamplerParameteri(m_shadow_compare_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	}
 }
 
@@ -72,6 +135,7 @@ void SpotLightNode::SetPosition(glm::vec3 pos)
 	m_light_direction = glm::normalize(m_light_target - m_light_position);
 	m_view_matrix = glm::lookAt(m_light_position, m_light_target, glm::vec3(0, 1, 0));
 	m_view_inverse_matrix = glm::inverse(m_view_matrix);
+	m_shadow_map_version++;
 }
 
 void SpotLightNode::SetTarget(glm::vec3 target)
@@ -80,6 +144,7 @@ void SpotLightNode::SetTarget(glm::vec3 target)
 	m_light_direction = glm::normalize(m_light_target - m_light_position);
 	m_view_matrix = glm::lookAt(m_light_position, m_light_target, glm::vec3(0, 1, 0));
 	m_view_inverse_matrix = glm::inverse(m_view_matrix);
+	m_shadow_map_version++;
 }
 
 void SpotLightNode::SetConeSize(float umbra, float penumbra)
@@ -87,12 +152,13 @@ void SpotLightNode::SetConeSize(float umbra, float penumbra)
 	m_umbra = umbra;
 	m_penumbra = penumbra;
 
-	float near_clipping_range = 0.1f;
-	float far_clipping_range = 1500.f;
+	m_near_clipping_range = 0.1f;
+	m_far_clipping_range = 1500.f;
 
-	float h = near_clipping_range * glm::tan(glm::radians(m_penumbra * 0.5f));
-	m_projection_matrix = glm::frustum(-h, h, -h, h, near_clipping_range, far_clipping_range);
+	float h = m_near_clipping_range * glm::tan(glm::radians(m_penumbra * 0.5f));
+	m_projection_matrix = glm::frustum(-h, h, -h, h, m_near_clipping_range, m_far_clipping_range);
 	m_projection_inverse_matrix = glm::inverse(m_projection_matrix);
+	m_shadow_map_version++;
 }
 
 glm::vec3 SpotLightNode::GetPosition()
@@ -140,6 +206,46 @@ int SpotLightNode::GetShadowMapResolution()
 	return m_shadow_map_resolution;;
 }
 
+GLuint SpotLightNode::GetShadowCompareSampler()
+{
+	return m_shadow_compare_sampler;
+}
+
+GLuint SpotLightNode::GetShadowMomentsTexture(int index)
+{
+	return m_shadow_moments_texture[index];
+}
+
+GLuint SpotLightNode::GetShadowMomentsFBO(int index)
+{
+	return m_shadow_moments_fbo[index];
+}
+
+float SpotLightNode::GetNearClippingRange()
+{
+	return m_near_clipping_range;
+}
+
+float SpotLightNode::GetFarClippingRange()
+{
+	return m_far_clipping_range;
+}
+
+GLuint SpotLightNode::GetStaticShadowMapFBO()
+{
+	return m_static_shadow_map_fbo;
+}
+
+GLuint SpotLightNode::GetStaticShadowMapDepthTexture()
+{
+	return m_static_shadow_map_texture;
+}
+
+unsigned int SpotLightNode::GetShadowMapVersion()
+{
+	return m_shadow_map_version;
+}
+
 glm::mat4 SpotLightNode::GetProjectionMatrix()
 {
 	return m_projection_matrix;
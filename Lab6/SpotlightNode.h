@@ -23,6 +23,20 @@ class SpotLightNode
 	float m_shadow_map_bias;
 	GLuint m_shadow_map_texture;
 	GLuint m_shadow_map_fbo;
+	// depth of the casters that never move, kept between frames and copied into the shadow map
+	GLuint m_static_shadow_map_texture;
+	GLuint m_static_shadow_map_fbo;
+	// changes whenever the view or projection of the light does, the static shadow map is then stale
+	unsigned int m_shadow_map_version;
+	// depth comparison state of the shadow map for the sampler2DShadow lookups (hardware PCF),
+	// the texture itself keeps the plain nearest filtering of the manual filters
+	GLuint m_shadow_compare_sampler;
+	// linear depth moments (mean, mean of squares) of the shadow map, blurred from [0] to [1] (variance shadow maps)
+	GLuint m_shadow_moments_texture[2];
+	GLuint m_shadow_moments_fbo[2];
+
+	float m_near_clipping_range;
+	float m_far_clipping_range;
 
 	glm::mat4 m_projection_matrix;
 	glm::mat4 m_projection_inverse_matrix;
@@ -49,6 +63,14 @@ public:
 	GLuint GetShadowMapFBO();
 	GLuint GetShadowMapDepthTexture();
 	int GetShadowMapResolution();
+	GLuint GetShadowCompareSampler();
+	GLuint GetShadowMomentsTexture(int index);
+	GLuint GetShadowMomentsFBO(int index);
+	float GetNearClippingRange();
+	float GetFarClippingRange();
+	GLuint GetStaticShadowMapFBO();
+	GLuint GetStaticShadowMapDepthTexture();
+	unsigned int GetShadowMapVersion();
 
 	glm::mat4 GetProjectionMatrix();
 	glm::mat4 GetViewMatrix();
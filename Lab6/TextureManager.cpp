@@ -1,102 +1,368 @@
 #include "TextureManager.h"
 #include <algorithm>
-#include "SDL2/SDL_image.h"
+#include "Tools.h"
+#include "AssetLoader.h"
+#include "CookedTexture.h"
+#include <memory>
+#include <map>
+#include <tuple>
+#include <cstring>
+
+// Texture Handle
+TextureHandle::TextureHandle()
+{
+	key = 0;
+	id = 0;
+}
+
+TextureHandle::TextureHandle(uint64_t key, GLuint id)
+{
+	this->key = key;
+	this->id = id;
+}
+
+TextureHandle::TextureHandle(const TextureHandle& other)
+{
+	key = other.key;
+	id = other.id;
+	if (id != 0) TextureManager::GetInstance().addReference(key, id);
+}
+
+TextureHandle& TextureHandle::operator=(const TextureHandle& other)
+{
+	if (other.id != 0) TextureManager::GetInstance().addReference(other.key, other.id);
+	Reset();
+	key = other.key;
+	id = other.id;
+	return *this;
+}
+
+TextureHandle::~TextureHandle()
+{
+	Reset();
+}
+
+void TextureHandle::Reset()
+{
+	if (id != 0) TextureManager::GetInstance().releaseReference(key, id);
+	key = 0;
+	id = 0;
+}
 
 // Texture
 TextureManager::TextureManager()
 {
-
+	totalBytes = 0;
+	budget = DEFAULT_BUDGET;
+	requestCounter = 0;
+	compression = false;
 }
 
 TextureManager::~TextureManager()
 {
 	// delete textures
-	for (int i = 0; i < textures.size(); i++)
-		glDeleteTextures(1, &textures[i].textureID);
-	textures.clear();
+	Clear();
 }
 
 void TextureManager::Clear()
 {
-	std::for_each(textures.begin(), textures.end(), [](TextureContainer container) { glDeleteTextures(1, &container.textureID); });
+	std::for_each(textures.begin(), textures.end(), [](const std::pair<const uint64_t, TextureContainer>& entry) { glDeleteTextures(1, &entry.second.textureID); });
 	textures.clear();
+	totalBytes = 0;
 }
 
-int TextureManager::findTexture(const char* filename, bool hasMipmaps)
+uint64_t TextureManager::findTexture(const char* filename, bool hasMipmaps, GLenum target, bool& found)
 {
-	for (int i = 0; i < textures.size(); i++)
+	unsigned char options = ((hasMipmaps) ? 1 : 0) | ((target == GL_TEXTURE_2D_ARRAY) ? 2 : 0);
+	uint64_t key = Tools::HashFNV1a(&options, sizeof(options), Tools::HashFNV1a(filename, strlen(filename)));
+
+	// on the (unlikely) collision of two hashes try the next key
+	for (auto it = textures.find(key); it != textures.end(); it = textures.find(++key))
 	{
-		if (textures[i].filename.compare(filename) == 0 && textures[i].hasMipmaps == hasMipmaps)
+		if (it->second.filename.compare(filename) == 0 && it->second.hasMipmaps == hasMipmaps && it->second.target == target)
 		{
-			return i;
+			found = true;
+			return key;
 		}
 	}
-	return -1;
+	found = false;
+	return key;
 }
 
-GLuint TextureManager::RequestTexture(const char* filename, bool hasMipmaps)
+void TextureManager::addReference(uint64_t key, GLuint id)
 {
-	// first check if we can find it in the manager
-	int index = findTexture(filename, hasMipmaps);
+	auto it = textures.find(key);
+	if (it != textures.end() && it->second.textureID == id)
+		it->second.references++;
+}
 
-	if (index != -1)
-		return textures[index].textureID;
+void TextureManager::releaseReference(uint64_t key, GLuint id)
+{
+	// the texture may be gone after a Clear
+	auto it = textures.find(key);
+	if (it == textures.end() || it->second.textureID != id || it->second.references == 0)
+		return;
+	it->second.references--;
+	if (it->second.references == 0 && totalBytes > budget)
+		evict();
+}
 
-	// load the texture
-	SDL_Surface* surf = IMG_Load(filename);
-	if (surf == 0)
+void TextureManager::evict()
+{
+	while (totalBytes > budget)
+	{
+		auto oldest = textures.end();
+		for (auto it = textures.begin(); it != textures.end(); ++it)
+			if (it->second.references == 0 && (oldest == textures.end() || it->second.lastUsed < oldest->second.lastUsed))
+				oldest = it;
+		// everything left is in use
+		if (oldest == textures.end())
+			break;
+
+		printf("TextureManager: evicting %s (%zu KB)\n", oldest->second.filename.c_str(), oldest->second.bytes / 1024);
+		glDeleteTextures(1, &oldest->second.textureID);
+		totalBytes -= oldest->second.bytes;
+		textures.erase(oldest);
+	}
+}
+
+void TextureManager::SetBudget(size_t bytes)
+{
+	budget = bytes;
+	evict();
+}
+
+void TextureManager::PrintStatistics() const
+{
+	unsigned int referenced = 0;
+	for (const auto& entry : textures)
+		if (entry.second.references > 0) referenced++;
+	printf("TextureManager: %zu textures (%u referenced), %.1f / %.1f MB\n",
+		textures.size(), referenced, totalBytes / (1024.0 * 1024.0), budget / (1024.0 * 1024.0));
+}
+
+void TextureManager::SetCompression(bool enabled)
+{
+	compression = enabled;
+}
+
+void TextureManager::RequestTextureArraysAsync(const std::vector<std::string>& filenames, bool hasMipmaps, std::function<void(const std::string&, TextureHandle, int)> done)
+{
+	// open (or cook) the textures on the calling worker and group the compatible ones
+	AssetLoader& loader = AssetLoader::GetInstance();
+	std::map<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>, std::vector<std::pair<std::string, std::shared_ptr<CookedTexture>>>> groups;
+	for (const std::string& filename : filenames)
+	{
+		std::shared_ptr<CookedTexture> cooked = std::make_shared<CookedTexture>();
+		if (!cooked->Load(filename.c_str(), compression))
+		{
+			loader.SubmitUpload([done, filename]() { done(filename, TextureHandle(), -1); });
+			continue;
+		}
+		const CookedTexture::Header& header = cooked->GetHeader();
+		groups[std::make_tuple(header.width, header.height, header.format, header.level_count)].push_back(std::make_pair(filename, cooked));
+	}
+
+	for (const auto& group : groups)
 	{
-		printf("Could not Load texture %s\n", filename);
-		printf("SDL load Error %s\n", SDL_GetError());
-		return 0; // error
+		for (size_t first = 0; first < group.second.size(); first += MAX_ARRAY_LAYERS)
+		{
+			std::vector<std::string> names;
+			std::vector<std::shared_ptr<CookedTexture>> layers;
+			for (size_t i = first; i < std::min(first + MAX_ARRAY_LAYERS, group.second.size()); i++)
+			{
+				names.push_back(group.second[i].first);
+				layers.push_back(group.second[i].second);
+			}
+			requestArrayAsync(names, layers, hasMipmaps, [done, names](TextureHandle handle)
+			{
+				for (size_t layer = 0; layer < names.size(); layer++)
+					done(names[layer], handle, (handle.IsValid()) ? static_cast<int>(layer) : -1);
+			});
+		}
 	}
+}
+
+void TextureManager::requestArrayAsync(const std::vector<std::string>& filenames, const std::vector<std::shared_ptr<CookedTexture>>& layers, bool hasMipmaps, std::function<void(TextureHandle)> done)
+{
+	std::string name;
+	for (const std::string& filename : filenames)
+		name += (name.empty()) ? filename : "|" + filename;
+
+	// every layer holds the same levels
+	const CookedTexture::Level* levels = layers[0]->GetLevels();
+	const unsigned int level_count = (hasMipmaps) ? layers[0]->GetHeader().level_count : 1;
+	const uint64_t begin = levels[0].offset;
+	const size_t layer_size = static_cast<size_t>(levels[level_count - 1].offset + levels[level_count - 1].size - begin);
+
+	// on the GL thread: map a pixel buffer for the levels of all the layers
+	AssetLoader::GetInstance().SubmitUpload([name, layers, hasMipmaps, done, begin, layer_size]()
+	{
+		TextureManager& manager = GetInstance();
+		bool found;
+		uint64_t key = manager.findTexture(name.c_str(), hasMipmaps, GL_TEXTURE_2D_ARRAY, found);
+		if (found)
+		{
+			done(manager.referenceTexture(key));
+			return;
+		}
+
+		std::vector<const CookedTexture*> textures;
+		std::vector<const unsigned char*> data;
+		for (const std::shared_ptr<CookedTexture>& layer : layers)
+		{
+			textures.push_back(layer.get());
+			data.push_back(layer->GetData() + begin);
+		}
+
+		const GLsizeiptr size = static_cast<GLsizeiptr>(layer_size * layers.size());
+		GLuint pixel_buffer;
+		glGenBuffers(1, &pixel_buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (mapped == nullptr)
+		{
+			glDeleteBuffers(1, &pixel_buffer);
+			done(manager.createTexture(key, name.c_str(), hasMipmaps, GL_TEXTURE_2D_ARRAY, textures, data));
+			return;
+		}
+
+		// on a worker: copy the levels into the mapped buffer, one layer after the other
+		AssetLoader::GetInstance().SubmitJob([name, layers, hasMipmaps, done, pixel_buffer, mapped, textures, data, layer_size]()
+		{
+			for (size_t i = 0; i < layers.size(); i++)
+				memcpy(static_cast<unsigned char*>(mapped) + i * layer_size, data[i], layer_size);
+
+			// on the GL thread: the texture is filled from the buffer without a client side copy
+			AssetLoader::GetInstance().SubmitUpload([name, layers, hasMipmaps, done, pixel_buffer, textures, data, layer_size]()
+			{
+				TextureManager& manager = GetInstance();
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+				bool valid = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+
+				TextureHandle handle;
+				bool found;
+				uint64_t key = manager.findTexture(name.c_str(), hasMipmaps, GL_TEXTURE_2D_ARRAY, found);
+				if (found)
+					handle = manager.referenceTexture(key);
+				else if (valid)
+				{
+					// the layers are offsets in the bound buffer
+					std::vector<const unsigned char*> offsets;
+					for (size_t i = 0; i < layers.size(); i++)
+						offsets.push_back(reinterpret_cast<const unsigned char*>(static_cast<uintptr_t>(i * layer_size)));
+					handle = manager.createTexture(key, name.c_str(), hasMipmaps, GL_TEXTURE_2D_ARRAY, textures, offsets);
+				}
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				// the driver keeps the storage until the transfer is done
+				glDeleteBuffers(1, &pixel_buffer);
+
+				// the contents of the buffer were lost (e.g. display mode change)
+				if (!found && !valid)
+					handle = manager.createTexture(key, name.c_str(), hasMipmaps, GL_TEXTURE_2D_ARRAY, textures, data);
+				done(handle);
+			});
+		});
+	});
+}
+
+TextureHandle TextureManager::referenceTexture(uint64_t key)
+{
+	TextureContainer& container = textures[key];
+	container.references++;
+	container.lastUsed = ++requestCounter;
+	return TextureHandle(key, container.textureID);
+}
+
+TextureHandle TextureManager::RequestTexture(const char* filename, bool hasMipmaps)
+{
+	// first check if we can find it in the manager
+	bool found;
+	uint64_t key = findTexture(filename, hasMipmaps, GL_TEXTURE_2D, found);
+	if (found)
+		return referenceTexture(key);
+
+	// load the texture
+	CookedTexture cooked;
+	if (!cooked.Load(filename, compression))
+		return TextureHandle(); // error
+	return createTexture(key, filename, hasMipmaps, GL_TEXTURE_2D, std::vector<const CookedTexture*>(1, &cooked),
+		std::vector<const unsigned char*>(1, cooked.GetData() + cooked.GetLevels()[0].offset));
+}
+
+TextureHandle TextureManager::createTexture(uint64_t key, const char* filename, bool hasMipmaps, GLenum target,
+	const std::vector<const CookedTexture*>& layers, const std::vector<const unsigned char*>& data)
+{
+	// the layers of an array have the same levels
+	const CookedTexture& cooked = *layers[0];
+	const CookedTexture::Level* levels = cooked.GetLevels();
+	const unsigned int level_count = (hasMipmaps) ? cooked.GetHeader().level_count : 1;
+	const GLsizei depth = static_cast<GLsizei>(layers.size());
+
 	TextureContainer container;
 	container.filename = filename;
 	container.hasMipmaps = hasMipmaps;
-	GLenum texture_format;
-	GLint nOfColors;
+	container.target = target;
+	container.bytes = cooked.GetMemorySize(level_count) * layers.size();
+	container.references = 1;
+	container.lastUsed = ++requestCounter;
+
 	glGenTextures(1, &container.textureID);
-	glBindTexture(GL_TEXTURE_2D, container.textureID);
-	nOfColors = surf->format->BytesPerPixel;
-	switch (surf->format->BytesPerPixel)
+	glBindTexture(target, container.textureID);
+	// the rows are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (target == GL_TEXTURE_2D_ARRAY)
 	{
-	case 4: // contains alpha channel
-		if (surf->format->Rmask == 0x000000ff)	 texture_format = GL_RGBA;
-		else texture_format = GL_BGRA;
-		nOfColors = GL_RGBA;
-		break;
-	case 3: // no alpha channel
-		if (surf->format->Rmask == 0x000000ff) texture_format = GL_RGB;
-		else texture_format = GL_BGR;
-		nOfColors = GL_RGB;
-		break;
-	default:
-		printf("Error in number of colors at %s\n", filename);
-	}
+		// allocate the levels without reading from a bound pixel buffer, then fill them layer by layer
+		GLint pixel_buffer;
+		glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &pixel_buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		for (unsigned int i = 0; i < level_count; i++)
+		{
+			if (cooked.IsCompressed())
+				glCompressedTexImage3D(target, i, cooked.GetInternalFormat(), levels[i].width, levels[i].height, depth, 0, levels[i].size * depth, NULL);
+			else
+				glTexImage3D(target, i, cooked.GetInternalFormat(), levels[i].width, levels[i].height, depth, 0, cooked.GetPixelFormat(), GL_UNSIGNED_BYTE, NULL);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
 
-	unsigned char* data = new unsigned char[surf->w * surf->h * surf->format->BytesPerPixel];
-	// flip image
-	for (int y = 0; y < surf->h; y++)
-		memcpy(&data[(surf->h - y - 1) * surf->w * surf->format->BytesPerPixel], &static_cast<unsigned char*>(surf->pixels)[y * surf->w * surf->format->BytesPerPixel], surf->w * surf->format->BytesPerPixel * sizeof(unsigned char));
-
-	SDL_LockSurface(surf);
-	glTexImage2D(GL_TEXTURE_2D, 0, nOfColors, surf->w, surf->h, 0, texture_format, GL_UNSIGNED_BYTE, data);
-	SDL_UnlockSurface(surf);
-	delete[] data;
-
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	if (hasMipmaps)
+		for (GLsizei layer = 0; layer < depth; layer++)
+		{
+			for (unsigned int i = 0; i < level_count; i++)
+			{
+				const unsigned char* level_data = data[layer] + (levels[i].offset - levels[0].offset);
+				if (cooked.IsCompressed())
+					glCompressedTexSubImage3D(target, i, 0, 0, layer, levels[i].width, levels[i].height, 1, cooked.GetInternalFormat(), levels[i].size, level_data);
+				else
+					glTexSubImage3D(target, i, 0, 0, layer, levels[i].width, levels[i].height, 1, cooked.GetPixelFormat(), GL_UNSIGNED_BYTE, level_data);
+			}
+		}
+	}
+	else
 	{
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		for (unsigned int i = 0; i < level_count; i++)
+		{
+			const unsigned char* level_data = data[0] + (levels[i].offset - levels[0].offset);
+			if (cooked.IsCompressed())
+				glCompressedTexImage2D(target, i, cooked.GetInternalFormat(), levels[i].width, levels[i].height, 0, levels[i].size, level_data);
+			else
+				glTexImage2D(target, i, cooked.GetInternalFormat(), levels[i].width, levels[i].height, 0, cooked.GetPixelFormat(), GL_UNSIGNED_BYTE, level_data);
+		}
 	}
-	if (surf) SDL_FreeSurface(surf);
-	glBindTexture(GL_TEXTURE_2D, 0); // unbind the texture
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-	// save the texture
-	textures.push_back(container);
-	return container.textureID;
-}
\ No newline at end of file
+	glTexParameterf(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameterf(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameterf(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(target, GL_TEXTURE_MIN_FILTER, (hasMipmaps) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+	glBindTexture(target, 0); // unbind the texture
+
+	// save the texture and make room for it
+	textures[key] = container;
+	totalBytes += container.bytes;
+	evict();
+	return TextureHandle(key, container.textureID);
+}
@@ -5,8 +5,42 @@
 #include "GLEW\glew.h"
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <functional>
+#include <memory>
 
-// Singleton Class of Texture Manager
+/* Reference counted handle of a texture of the TextureManager
+The texture is never evicted while a handle references it, so the id stays valid for the life of the handle.
+*/
+class TextureHandle
+{
+public:
+	TextureHandle();
+	TextureHandle(const TextureHandle& other);
+	TextureHandle& operator=(const TextureHandle& other);
+	~TextureHandle();
+
+	GLuint GetID() const { return id; }
+	bool IsValid() const { return id != 0; }
+	// drop the reference
+	void Reset();
+
+private:
+	friend class TextureManager;
+	// takes over a reference that was already counted
+	TextureHandle(uint64_t key, GLuint id);
+
+	uint64_t key;
+	GLuint id;
+};
+
+/* Singleton Class of Texture Manager
+The textures are keyed by a hash of the filename and the sampling options and handed out as reference counted handles.
+The textures that are no longer referenced stay cached, the least recently used ones are deleted when
+the estimated GPU memory of all the textures goes over the budget.
+Textures with the same size and format can be packed in the layers of a single GL_TEXTURE_2D_ARRAY.
+*/
 class TextureManager
 {
 protected:
@@ -15,11 +49,42 @@ protected:
 		GLuint textureID;
 		std::string filename;
 		bool hasMipmaps;
+		// GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY for packed textures (the filename joins the layer files with '|')
+		GLenum target;
+		// estimated GPU memory
+		size_t bytes;
+		unsigned int references;
+		// request counter at the last request, the oldest unreferenced texture is evicted first
+		uint64_t lastUsed;
 	};
-	std::vector<TextureContainer> textures;
+	std::unordered_map<uint64_t, TextureContainer> textures;
+	size_t totalBytes;
+	size_t budget;
+	uint64_t requestCounter;
+
+	// find the texture with the given filename, mipmaps and target, sets found to false and returns a free key if it is not loaded
+	uint64_t findTexture(const char* filename, bool hasMipmaps, GLenum target, bool& found);
+	// add a reference to a loaded texture
+	TextureHandle referenceTexture(uint64_t key);
 
-	// find the texture with the fiven filename and mipmaps
-	int findTexture(const char* filename, bool hasMipmaps);
+	friend class TextureHandle;
+	void addReference(uint64_t key, GLuint id);
+	void releaseReference(uint64_t key, GLuint id);
+
+	// delete the least recently used unreferenced textures until the total is within the budget
+	void evict();
+
+	// true to cook the textures S3TC compressed
+	bool compression;
+
+	// create the texture of a key that is not loaded from the levels of cooked textures (a single one for GL_TEXTURE_2D),
+	// data points to the first level of every layer, or is an offset when a pixel unpack buffer is bound
+	TextureHandle createTexture(uint64_t key, const char* filename, bool hasMipmaps, GLenum target,
+		const std::vector<const class CookedTexture*>& layers, const std::vector<const unsigned char*>& data);
+	// call on an AssetLoader worker: the levels of the layers are copied to a mapped pixel buffer on a worker
+	// and the array is created from the buffer on the GL thread, where done receives the handle (invalid on errors)
+	void requestArrayAsync(const std::vector<std::string>& filenames, const std::vector<std::shared_ptr<class CookedTexture>>& layers,
+		bool hasMipmaps, std::function<void(TextureHandle)> done);
 
 public:
 	// get the static instance of Texture Manager
@@ -30,11 +95,32 @@ public:
 	}
 	~TextureManager();
 
-	// delete all textures
+	// delete all textures, the handles that are still alive become dangling
 	void Clear();
 
-	// Request a texture handle
-	GLuint RequestTexture(const char* filename, bool hasMipmaps = false);
+	// Request a texture handle, the texture is loaded from its cooked file (see CookedTexture), which is made first if needed
+	// with hasMipmaps the whole precomputed mip chain is uploaded
+	TextureHandle RequestTexture(const char* filename, bool hasMipmaps = false);
+
+	// call on an AssetLoader worker: the cooked files are opened (or made) there and packed in GL_TEXTURE_2D_ARRAYs,
+	// one for every group of textures with the same size, format and levels (split every MAX_ARRAY_LAYERS).
+	// done is called on the GL thread for every file with its array and layer (an invalid handle and -1 on errors)
+	void RequestTextureArraysAsync(const std::vector<std::string>& filenames, bool hasMipmaps, std::function<void(const std::string&, TextureHandle, int)> done);
+	// the minimum GL_MAX_ARRAY_TEXTURE_LAYERS of GL 3.3
+	static const size_t MAX_ARRAY_LAYERS = 256;
+
+	static const size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+	// memory allowed for the textures, the referenced textures are kept even over the budget
+	void SetBudget(size_t bytes);
+	size_t GetBudget() const { return budget; }
+	size_t GetUsedBytes() const { return totalBytes; }
+
+	// cook the textures BC1 / BC3 compressed, set when GL_EXT_texture_compression_s3tc is supported
+	void SetCompression(bool enabled);
+	bool GetCompression() const { return compression; }
+
+	// print the number of textures and the used memory
+	void PrintStatistics() const;
 
 protected:
 	TextureManager();	
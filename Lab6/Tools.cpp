@@ -2,6 +2,8 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 namespace Tools
 {
@@ -114,4 +116,31 @@ namespace Tools
 		else
 			return index;
 	}
+
+	bool GetFileInfo(const char* filename, int64_t& modification_time, uint64_t& size)
+	{
+#ifdef _WIN32
+		struct _stat64 file_stat;
+		if (_stat64(filename, &file_stat) != 0)
+			return false;
+#else
+		struct stat file_stat;
+		if (stat(filename, &file_stat) != 0)
+			return false;
+#endif
+		modification_time = static_cast<int64_t>(file_stat.st_mtime);
+		size = static_cast<uint64_t>(file_stat.st_size);
+		return true;
+	}
+
+	uint64_t HashFNV1a(const void* data, size_t size, uint64_t hash)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
 };
\ No newline at end of file
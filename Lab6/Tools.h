@@ -2,6 +2,7 @@
 #include <vector>
 #include "GLEW\glew.h"
 #include "glm\glm.hpp"
+#include <cstdint>
 
 #ifndef TOOLS_H
 #define TOOLS_H
@@ -21,6 +22,12 @@ namespace Tools
 	GLenum CheckFramebufferStatus(GLuint framebuffer_object);
 
 	int vectorIndex(std::vector<glm::vec2> v, glm::vec2 entry);
+
+	// last modification time and size of a file, returns false if the file does not exist
+	bool GetFileInfo(const char* filename, int64_t& modification_time, uint64_t& size);
+
+	// 64-bit FNV-1a hash
+	uint64_t HashFNV1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
 };
 
 #endif
\ No newline at end of file
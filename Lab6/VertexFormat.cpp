@@ -0,0 +1,144 @@
+#include "VertexFormat.h"
+#include "GeometricMesh.h"
+#include "glm\gtc\packing.hpp"
+#include "glm\gtc\matrix_transform.hpp"
+#include <cstring>
+#include <cfloat>
+
+namespace VertexFormat
+{
+	Layout GetLayout(unsigned int flags)
+	{
+		Layout layout;
+		layout.flags = flags;
+		layout.normal_offset = (flags & VERTEX_FLOAT_POSITION) ? 3 * sizeof(GLfloat) : 4 * sizeof(GLushort);
+		layout.texcoord_offset = layout.normal_offset + 2 * sizeof(GLshort);
+		layout.stride = layout.texcoord_offset + ((flags & VERTEX_FLOAT_TEXCOORD) ? 2 * sizeof(GLfloat) : 2 * sizeof(GLhalf));
+		return layout;
+	}
+
+	unsigned int ChooseFlags(const GeometricMesh* mesh, bool quantize_positions)
+	{
+		float max_abs_texcoord = 0.0f;
+		for (const glm::vec2& texcoord : mesh->textureCoord)
+			max_abs_texcoord = glm::max(max_abs_texcoord, glm::max(glm::abs(texcoord.x), glm::abs(texcoord.y)));
+		return ChooseFlags(max_abs_texcoord, quantize_positions);
+	}
+
+	unsigned int ChooseFlags(float max_abs_texcoord, bool quantize_positions)
+	{
+		unsigned int flags = (quantize_positions) ? 0 : VERTEX_FLOAT_POSITION;
+		if (max_abs_texcoord > HALF_TEXCOORD_LIMIT)
+			flags |= VERTEX_FLOAT_TEXCOORD;
+		return flags;
+	}
+
+	glm::mat4 GetDequantizationMatrix(unsigned int flags, const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+	{
+		if (flags & VERTEX_FLOAT_POSITION)
+			return glm::mat4(1.0f);
+		// flat axes keep a unit extent so that the matrix stays invertible
+		glm::vec3 extent = bounds_max - bounds_min;
+		for (int i = 0; i < 3; i++)
+			if (extent[i] <= 0.0f) extent[i] = 1.0f;
+		return glm::scale(glm::translate(glm::mat4(1.0f), bounds_min), extent);
+	}
+
+	glm::vec2 OctEncode(const glm::vec3& normal)
+	{
+		// the normals of the files are not checked, a zero one is encoded as +Y (as the computed ones, see OBJLoader)
+		float length = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+		if (length == 0.0f)
+			return glm::vec2(0.0f, 1.0f);
+		glm::vec3 n = normal / length;
+		glm::vec2 encoded(n.x, n.y);
+		// fold the lower hemisphere over the diagonals
+		if (n.z < 0.0f)
+		{
+			encoded.x = (1.0f - glm::abs(n.y)) * ((n.x >= 0.0f) ? 1.0f : -1.0f);
+			encoded.y = (1.0f - glm::abs(n.x)) * ((n.y >= 0.0f) ? 1.0f : -1.0f);
+		}
+		return encoded;
+	}
+
+	glm::mat4 Pack(const GeometricMesh* mesh, unsigned int flags, std::vector<unsigned char>& data)
+	{
+		glm::mat4 dequantization_matrix(1.0f);
+		if (!(flags & VERTEX_FLOAT_POSITION) && !mesh->vertices.empty())
+		{
+			glm::vec3 min_position(FLT_MAX);
+			glm::vec3 max_position(-FLT_MAX);
+			for (const glm::vec3& position : mesh->vertices)
+			{
+				min_position = glm::min(min_position, position);
+				max_position = glm::max(max_position, position);
+			}
+			dequantization_matrix = GetDequantizationMatrix(flags, min_position, max_position);
+		}
+		Pack(mesh, flags, dequantization_matrix, data);
+		return dequantization_matrix;
+	}
+
+	void Pack(const GeometricMesh* mesh, unsigned int flags, const glm::mat4& dequantization_matrix, std::vector<unsigned char>& data)
+	{
+		Layout layout = GetLayout(flags);
+		size_t vertex_count = mesh->vertices.size();
+		data.assign(vertex_count * layout.stride, 0);
+
+		// the matrix is a scale and a translation
+		glm::vec3 min_position(dequantization_matrix[3]);
+		glm::vec3 extent(dequantization_matrix[0][0], dequantization_matrix[1][1], dequantization_matrix[2][2]);
+
+		bool has_texcoords = mesh->textureCoord.size() == vertex_count;
+		for (size_t v = 0; v < vertex_count; v++)
+		{
+			unsigned char* vertex = &data[v * layout.stride];
+
+			if (flags & VERTEX_FLOAT_POSITION)
+			{
+				memcpy(vertex, &mesh->vertices[v], 3 * sizeof(GLfloat));
+			}
+			else
+			{
+				glm::vec3 normalized = (mesh->vertices[v] - min_position) / extent;
+				GLushort position[3];
+				for (int i = 0; i < 3; i++)
+					position[i] = glm::packUnorm1x16(normalized[i]);
+				memcpy(vertex, position, sizeof(position));
+			}
+
+			glm::vec2 encoded = OctEncode(mesh->normals[v]);
+			GLshort normal[2] = { static_cast<GLshort>(glm::packSnorm1x16(encoded.x)), static_cast<GLshort>(glm::packSnorm1x16(encoded.y)) };
+			memcpy(vertex + layout.normal_offset, normal, sizeof(normal));
+
+			glm::vec2 texcoord = (has_texcoords) ? mesh->textureCoord[v] : glm::vec2(0.0f);
+			if (flags & VERTEX_FLOAT_TEXCOORD)
+			{
+				memcpy(vertex + layout.texcoord_offset, &texcoord, 2 * sizeof(GLfloat));
+			}
+			else
+			{
+				GLhalf half_texcoord[2] = { glm::packHalf1x16(texcoord.x), glm::packHalf1x16(texcoord.y) };
+				memcpy(vertex + layout.texcoord_offset, half_texcoord, sizeof(half_texcoord));
+			}
+		}
+	}
+
+	void SetAttributePointers(const Layout& layout, GLintptr base_offset)
+	{
+		glEnableVertexAttribArray(0);
+		if (layout.flags & VERTEX_FLOAT_POSITION)
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, layout.stride, (const void*)(base_offset));
+		else
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, layout.stride, (const void*)(base_offset));
+
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, layout.stride, (const void*)(base_offset + layout.normal_offset));
+
+		glEnableVertexAttribArray(2);
+		if (layout.flags & VERTEX_FLOAT_TEXCOORD)
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, layout.stride, (const void*)(base_offset + layout.texcoord_offset));
+		else
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, layout.stride, (const void*)(base_offset + layout.texcoord_offset));
+	}
+};
@@ -0,0 +1,58 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <vector>
+#include "GLEW\glew.h"
+#include "glm\glm.hpp"
+
+class GeometricMesh;
+
+/* Interleaved, quantized vertex layout
+position : 3 x unorm16 relative to the mesh AABB (+2 bytes padding), or 3 x float
+normal   : 2 x snorm16 octahedral encoding
+texcoord : 2 x half float, or 2 x float when the coordinates are too large for half precision
+The default layout is 16 bytes per vertex. The shaders read the attributes with the same types as before
+(vec3 position, vec2 encoded normal, vec2 texcoord), the position is dequantized through the model matrix.
+*/
+namespace VertexFormat
+{
+	enum VERTEX_FORMAT_FLAGS
+	{
+		VERTEX_FLOAT_POSITION = 1,
+		VERTEX_FLOAT_TEXCOORD = 2,
+	};
+
+	// texcoords outside [-limit, limit] lose too much precision as half floats
+	const float HALF_TEXCOORD_LIMIT = 2.0f;
+
+	struct Layout
+	{
+		unsigned int flags;
+		GLsizei stride;
+		GLuint normal_offset;
+		GLuint texcoord_offset;
+	};
+
+	Layout GetLayout(unsigned int flags);
+
+	// choose the smallest layout that keeps the precision of the mesh
+	unsigned int ChooseFlags(const GeometricMesh* mesh, bool quantize_positions = true);
+	// same, from the largest absolute texture coordinate (for meshes that are not in memory)
+	unsigned int ChooseFlags(float max_abs_texcoord, bool quantize_positions = true);
+
+	// the matrix that maps the stored positions of a mesh with these bounds back to model space
+	glm::mat4 GetDequantizationMatrix(unsigned int flags, const glm::vec3& bounds_min, const glm::vec3& bounds_max);
+
+	// interleave the attributes of the mesh, returns the matrix that maps the stored positions back to model space
+	glm::mat4 Pack(const GeometricMesh* mesh, unsigned int flags, std::vector<unsigned char>& data);
+	// same, with the matrix of the whole mesh when the mesh is packed in blocks
+	void Pack(const GeometricMesh* mesh, unsigned int flags, const glm::mat4& dequantization_matrix, std::vector<unsigned char>& data);
+
+	// set the attribute pointers 0 (position), 1 (normal) and 2 (texcoord) of the bound vao and array buffer
+	void SetAttributePointers(const Layout& layout, GLintptr base_offset = 0);
+
+	// octahedral encoding of a unit vector to [-1, 1]^2
+	glm::vec2 OctEncode(const glm::vec3& normal);
+};
+
+#endif
@@ -5,6 +5,11 @@
 #include "Renderer.h"
 #include <string>
 #include <thread>         // std::this_thread::sleep_for
+#include <cstring>
+#include "OBJLoader.h"
+#include "CookedMesh.h"
+#include "CookedTexture.h"
+#include <algorithm>
 
 using namespace std;
 
@@ -96,6 +101,39 @@ int main(int argc, char *argv[])
 
 	srand(static_cast <unsigned> (time(0)));
 
+	// measure the OBJ parser without opening a window: --benchmark-obj file [iterations]
+	if (argc >= 3 && strcmp(argv[1], "--benchmark-obj") == 0)
+	{
+		OBJLoader::benchmark(argv[2], (argc >= 4) ? atoi(argv[3]) : 10);
+		return EXIT_SUCCESS;
+	}
+
+	// cook a large mesh to its cache with bounded memory: --cook-obj file [block_triangles]
+	if (argc >= 3 && strcmp(argv[1], "--cook-obj") == 0)
+	{
+		OBJLoader loader;
+		unsigned int block_triangles = (argc >= 4) ? static_cast<unsigned int>(atoi(argv[3])) : OBJLoader::STREAMING_BLOCK_TRIANGLES;
+		bool cooked = loader.cookStreaming(argv[2], CookedMesh::GetCacheFilename(argv[2]).c_str(), std::max(block_triangles, 1u));
+		return (cooked) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// cook textures to their cache with the full mip chain: --cook-texture [--uncompressed] file...
+	if (argc >= 3 && strcmp(argv[1], "--cook-texture") == 0)
+	{
+		bool compressed = strcmp(argv[2], "--uncompressed") != 0;
+		bool cooked = true;
+		for (int i = (compressed) ? 2 : 3; i < argc; i++)
+		{
+			CookedTexture texture;
+			bool loaded = texture.Load(argv[i], compressed);
+			if (loaded)
+				printf("%s: %ux%u, %u levels, %.1f KB\n", argv[i], texture.GetHeader().width, texture.GetHeader().height,
+					texture.GetHeader().level_count, texture.GetMemorySize(texture.GetHeader().level_count) / 1024.0);
+			cooked = cooked && loaded;
+		}
+		return (cooked) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	//Initialize
 	if (init() == false)
 	{
@@ -143,6 +181,7 @@ int main(int argc, char *argv[])
 				// Key down events
 				if (event.key.keysym.sym == SDLK_ESCAPE) quit = true;
 				if (event.key.keysym.sym == SDLK_u) renderer->ReloadShaders();
+				else if (event.key.keysym.sym == SDLK_f) renderer->CycleShadowFilter();
 				else if (event.key.keysym.sym == SDLK_w )
 				{
 					renderer->CameraMoveForward(true);
@@ -300,6 +339,24 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		// draw whatever is uploaded so far, the game starts once every asset is loaded
+		if (!renderer->AssetsLoaded())
+		{
+			renderer->Render();
+			SDL_GL_SwapWindow(window);
+			simulation_start = chrono::steady_clock::now();
+			continue;
+		}
+
+		// the meshes load after Init, a missing one is reported here instead
+		if (renderer->GetFailedAssetCount() > 0)
+		{
+			printf("Exiting with error, %u meshes failed to load\n", renderer->GetFailedAssetCount());
+			system("pause");
+			clean_up();
+			return EXIT_FAILURE;
+		}
+
 		// Compute the ellapsed time
 		auto simulation_end = chrono::steady_clock::now();
 		float dt = chrono::duration <float>(simulation_end - simulation_start).count(); // in seconds